@@ -1,4 +1,6 @@
 #include "address.h"
+#include "dns.h"
+#include "iomanager.h"
 #include "log.h"
 #include <ifaddrs.h>
 #include <netdb.h>
@@ -55,6 +57,15 @@ IPAddress::ptr Address::LookupAnyIPAddress(const std::string &host, int family,
   return nullptr;
 }
 
+/**
+ * @brief 是否数字形式的IPv4/IPv6地址
+ */
+static bool IsNumericHost(const std::string &node) {
+  in6_addr addr;
+  return inet_pton(AF_INET, node.c_str(), &addr) == 1 ||
+         inet_pton(AF_INET6, node.c_str(), &addr) == 1;
+}
+
 bool Address::Lookup(std::vector<Address::ptr> &result, const std::string &host,
                      int family, int type, int protocol) {
   addrinfo hints, *results, *next;
@@ -102,6 +113,37 @@ bool Address::Lookup(std::vector<Address::ptr> &result, const std::string &host,
   if (node.empty()) {
     node = host;
   }
+
+  // 协程中解析域名时不能阻塞工作线程, 交给DnsResolver
+  if ((family == AF_INET || family == AF_INET6 || family == AF_UNSPEC) &&
+      IOManager::GetThis() && Fiber::GetFiberId() != 0 &&
+      !IsNumericHost(node)) {
+    uint16_t port = 0;
+    if (service && *service) {
+      char *end = nullptr;
+      port = strtoul(service, &end, 10);
+      if (*end) {
+        servent *ent =
+            getservbyname(service, type == SOCK_DGRAM ? "udp" : "tcp");
+        if (!ent) {
+          return false;
+        }
+        port = byteswapOnLittleEndian((uint16_t)ent->s_port);
+      }
+    }
+    std::vector<IPAddress::ptr> addrs;
+    if (!DnsResolverMgr::GetInstance()->resolve(addrs, node, family)) {
+      ARVIN_LOG_DEBUG(g_logger) << "Address::Lookup resolve(" << host << ", "
+                                << family << ") failed";
+      return false;
+    }
+    for (auto &i : addrs) {
+      i->setPort(port);
+      result.push_back(i);
+    }
+    return true;
+  }
+
   int error = getaddrinfo(node.c_str(), service, &hints, &results);
   if (error) {
     ARVIN_LOG_DEBUG(g_logger)
@@ -0,0 +1,106 @@
+#include "blocking_pool.h"
+#include "config.h"
+#include "iomanager.h"
+#include "log.h"
+#include "scheduler.h"
+#include "util.h"
+
+namespace arvin {
+
+static Logger::ptr g_logger = ARVIN_LOG_NAME("system");
+
+static ConfigVar<uint32_t>::ptr g_fileio_threads = Config::Lookup<uint32_t>(
+    "fileio.threads", 4, "blocking file io thread count, 0 to disable");
+static ConfigVar<uint32_t>::ptr g_fileio_queue_size = Config::Lookup<uint32_t>(
+    "fileio.queue_size", 1024, "blocking file io max pending requests");
+
+BlockingPool::BlockingPool()
+    : BlockingPool(g_fileio_threads->getValue(),
+                   g_fileio_queue_size->getValue(), "fileio") {}
+
+BlockingPool::BlockingPool(size_t threads, size_t capacity,
+                           const std::string &name)
+    : m_capacity(capacity) {
+  m_threads.reserve(threads);
+  for (size_t i = 0; i < threads; ++i) {
+    m_threads.emplace_back(new Thread(std::bind(&BlockingPool::worker, this),
+                                      name + "_" + std::to_string(i)));
+  }
+}
+
+BlockingPool::~BlockingPool() { stop(); }
+
+bool BlockingPool::run(const std::function<void()> &cb) {
+  Scheduler *scheduler = Scheduler::GetThis();
+  if (!scheduler || Fiber::GetFiberId() == 0 ||
+      Fiber::GetThis().get() == Scheduler::GetMainFiber()) {
+    return false;
+  }
+  {
+    MutexType::Lock lock(m_mutex);
+    if (m_stopping || m_threads.empty() || m_tasks.size() >= m_capacity) {
+      return false;
+    }
+    Task task;
+    task.cb = cb;
+    task.scheduler = scheduler;
+    task.fiber = Fiber::GetThis();
+    // 分片模式下回到原线程, 否则由任意工作线程恢复
+    IOManager *iom = IOManager::GetThis();
+    task.thread = iom && iom->isSharded() ? GetThreadId() : -1;
+    m_tasks.push_back(std::move(task));
+  }
+  m_sem.notify();
+  // 池线程调度回来时若本协程尚未切出, 调度器会跳过EXEC状态的协程
+  Fiber::YieldToHold();
+  return true;
+}
+
+void BlockingPool::stop() {
+  {
+    MutexType::Lock lock(m_mutex);
+    if (m_stopping) {
+      return;
+    }
+    m_stopping = true;
+  }
+  for (size_t i = 0; i < m_threads.size(); ++i) {
+    m_sem.notify();
+  }
+  for (auto &i : m_threads) {
+    i->join();
+  }
+}
+
+size_t BlockingPool::getQueueSize() {
+  MutexType::Lock lock(m_mutex);
+  return m_tasks.size();
+}
+
+void BlockingPool::worker() {
+  while (true) {
+    m_sem.wait();
+    Task task;
+    {
+      MutexType::Lock lock(m_mutex);
+      if (m_tasks.empty()) {
+        if (m_stopping) {
+          break;
+        }
+        continue;
+      }
+      task = std::move(m_tasks.front());
+      m_tasks.pop_front();
+    }
+    try {
+      task.cb();
+    } catch (std::exception &ex) {
+      ARVIN_LOG_ERROR(g_logger) << "BlockingPool task except: " << ex.what();
+    } catch (...) {
+      ARVIN_LOG_ERROR(g_logger) << "BlockingPool task except";
+    }
+    task.scheduler->schedule(task.fiber, task.thread);
+  }
+}
+
+} // namespace arvin
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "fiber.h"
+#include "mutex.h"
+#include "singleton.h"
+#include "thread.h"
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace arvin {
+
+class Scheduler;
+
+/**
+ * @brief 阻塞IO线程池
+ * @details epoll无法等待普通文件, 文件读写在协程里会直接阻塞工作线程.
+ *          run把调用交给池中的线程执行, 当前协程挂起, 完成后重新调度.
+ *          队列有上限, 满时由调用方自行同步执行, 不会无限堆积
+ */
+class BlockingPool : Noncopyable {
+public:
+  typedef std::shared_ptr<BlockingPool> ptr;
+  typedef Mutex MutexType;
+
+  /**
+   * @brief 构造函数, 线程数与队列上限取自配置fileio.threads/fileio.queue_size
+   */
+  BlockingPool();
+
+  /**
+   * @brief 构造函数
+   * @param[in] threads 线程数, 为0时不卸载
+   * @param[in] capacity 等待队列上限
+   * @param[in] name 线程名称前缀
+   */
+  BlockingPool(size_t threads, size_t capacity,
+               const std::string &name = "blocking");
+
+  /**
+   * @brief 析构函数, 等待已提交的任务完成
+   */
+  ~BlockingPool();
+
+  /**
+   * @brief 在池线程中执行cb, 当前协程挂起直到cb返回
+   * @details cb在未启用hook的线程上执行, 可以直接调用阻塞的系统调用;
+   *          cb中的errno不会带回调用方, 需要时自行保存.
+   *          分片模式的IOManager中协程在挂起时所在的线程上恢复,
+   *          其他情况下由任意工作线程恢复
+   * @return 不在调度器的协程中、池已停止或队列已满时返回false,
+   *         此时cb没有执行
+   */
+  bool run(const std::function<void()> &cb);
+
+  /**
+   * @brief 停止线程池, 等待已提交的任务完成
+   */
+  void stop();
+
+  /**
+   * @brief 返回等待执行的任务数
+   */
+  size_t getQueueSize();
+
+private:
+  /**
+   * @brief 线程主函数
+   */
+  void worker();
+
+private:
+  /**
+   * @brief 等待执行的任务
+   */
+  struct Task {
+    /// 执行函数
+    std::function<void()> cb;
+    /// 完成后调度回的调度器
+    Scheduler *scheduler = nullptr;
+    /// 挂起的协程
+    Fiber::ptr fiber;
+    /// 完成后恢复协程的线程, 只在分片模式下固定为挂起时所在的线程, 否则为-1
+    int thread = -1;
+  };
+
+private:
+  MutexType m_mutex;
+  /// 等待执行的任务
+  std::deque<Task> m_tasks;
+  /// 任务数信号量
+  Semaphore m_sem;
+  /// 线程池
+  std::vector<Thread::ptr> m_threads;
+  /// 等待队列上限
+  size_t m_capacity;
+  /// 是否已停止
+  bool m_stopping = false;
+};
+
+/// 文件IO使用的阻塞IO线程池
+typedef Singleton<BlockingPool> BlockingPoolMgr;
+
+} // namespace arvin
@@ -0,0 +1,303 @@
+/**
+ * @file coroutine.h
+ * @brief C++20无栈协程接口
+ * @details 与Fiber(有栈协程)共用Scheduler/IOManager,
+ *          协程帧只占用实际需要的内存, 适合高扇出场景.
+ *          需要以 -std=c++20 编译使用方代码
+ */
+#pragma once
+
+#if defined(__cpp_impl_coroutine) && __cplusplus >= 202002L
+
+#include "iomanager.h"
+#include "scheduler.h"
+#include "task_group.h"
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+#define ARVIN_HAS_COROUTINE 1
+
+namespace arvin {
+namespace co {
+
+template <class T = void> class Task;
+
+namespace detail {
+
+/**
+ * @brief Task的promise公共部分
+ */
+class TaskPromiseBase {
+public:
+  /**
+   * @brief 协程结束时切回等待者(对称转移)
+   */
+  struct FinalAwaiter {
+    bool await_ready() const noexcept { return false; }
+    template <class P>
+    std::coroutine_handle<>
+    await_suspend(std::coroutine_handle<P> h) const noexcept {
+      std::coroutine_handle<> c = h.promise().m_continuation;
+      return c ? c : std::noop_coroutine();
+    }
+    void await_resume() const noexcept {}
+  };
+
+  /// 惰性启动, 被co_await时才开始执行
+  std::suspend_always initial_suspend() noexcept { return {}; }
+  FinalAwaiter final_suspend() noexcept { return {}; }
+  void unhandled_exception() { m_exception = std::current_exception(); }
+
+  void setContinuation(std::coroutine_handle<> c) { m_continuation = c; }
+
+protected:
+  void rethrow() {
+    if (m_exception) {
+      std::rethrow_exception(m_exception);
+    }
+  }
+
+protected:
+  /// 等待本协程结束的协程
+  std::coroutine_handle<> m_continuation;
+  /// 协程抛出的异常
+  std::exception_ptr m_exception;
+};
+
+template <class T> class TaskPromise : public TaskPromiseBase {
+public:
+  Task<T> get_return_object();
+  void return_value(T v) { m_value.emplace(std::move(v)); }
+  T result() {
+    rethrow();
+    return std::move(*m_value);
+  }
+
+private:
+  std::optional<T> m_value;
+};
+
+template <> class TaskPromise<void> : public TaskPromiseBase {
+public:
+  Task<void> get_return_object();
+  void return_void() {}
+  void result() { rethrow(); }
+};
+
+/**
+ * @brief 分离运行的协程, 开始后自行销毁
+ */
+struct Detached {
+  struct promise_type {
+    Detached get_return_object() {
+      return {std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+  std::coroutine_handle<promise_type> handle;
+};
+
+template <class T> Detached RunDetached(Task<T> task, Promise<T> promise) {
+  try {
+    if constexpr (std::is_void_v<T>) {
+      co_await std::move(task);
+      promise.setValue();
+    } else {
+      promise.setValue(co_await std::move(task));
+    }
+  } catch (...) {
+    promise.setException(std::current_exception());
+  }
+}
+
+/**
+ * @brief 在调度器上恢复协程
+ */
+inline void Resume(Scheduler *scheduler, std::coroutine_handle<> h,
+                   int thread = -1) {
+  scheduler->schedule(std::function<void()>([h]() { h.resume(); }), thread);
+}
+
+} // namespace detail
+
+/**
+ * @brief 无栈协程任务
+ * @details 惰性启动; 在另一个协程中co_await, 或用spawn交给调度器执行
+ */
+template <class T> class Task {
+public:
+  typedef detail::TaskPromise<T> promise_type;
+  typedef std::coroutine_handle<promise_type> Handle;
+
+  Task() {}
+  explicit Task(Handle h) : m_handle(h) {}
+  Task(Task &&rhs) : m_handle(std::exchange(rhs.m_handle, nullptr)) {}
+  Task &operator=(Task &&rhs) {
+    if (this != &rhs) {
+      if (m_handle) {
+        m_handle.destroy();
+      }
+      m_handle = std::exchange(rhs.m_handle, nullptr);
+    }
+    return *this;
+  }
+  Task(const Task &) = delete;
+  Task &operator=(const Task &) = delete;
+
+  ~Task() {
+    if (m_handle) {
+      m_handle.destroy();
+    }
+  }
+
+  auto operator co_await() && noexcept {
+    struct Awaiter {
+      Handle h;
+      bool await_ready() const noexcept { return !h || h.done(); }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> c) {
+        h.promise().setContinuation(c);
+        return h;
+      }
+      T await_resume() { return h.promise().result(); }
+    };
+    return Awaiter{m_handle};
+  }
+
+private:
+  Handle m_handle;
+};
+
+template <class T> Task<T> detail::TaskPromise<T>::get_return_object() {
+  return Task<T>(Task<T>::Handle::from_promise(*this));
+}
+
+inline Task<void> detail::TaskPromise<void>::get_return_object() {
+  return Task<void>(Task<void>::Handle::from_promise(*this));
+}
+
+/**
+ * @brief 在调度器上启动协程任务
+ * @param[in] scheduler 调度器, nullptr表示当前调度器
+ * @param[in] task 协程任务
+ * @return 任务结果, Fiber和普通线程都可以通过Future等待
+ */
+template <class T>
+Future<T> spawn(Task<T> task, Scheduler *scheduler = nullptr) {
+  if (!scheduler) {
+    scheduler = Scheduler::GetThis();
+  }
+  Promise<T> promise;
+  Future<T> future = promise.getFuture();
+  detail::Detached d = detail::RunDetached(std::move(task), promise);
+  detail::Resume(scheduler, d.handle);
+  return future;
+}
+
+/**
+ * @brief 切换到指定调度器(线程)继续执行
+ * @param[in] scheduler 目标调度器
+ * @param[in] thread 指定线程id, -1表示任意线程
+ */
+struct resumeOn {
+  Scheduler *scheduler;
+  int thread = -1;
+
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> h) {
+    detail::Resume(scheduler, h, thread);
+  }
+  void await_resume() const noexcept {}
+};
+
+/**
+ * @brief 让出执行权, 重新排队到当前调度器
+ */
+inline resumeOn yield() { return resumeOn{Scheduler::GetThis()}; }
+
+/**
+ * @brief 在协程中等待Future, 不阻塞调度线程
+ * @details 由一个Fiber代为等待, Future就绪后恢复协程
+ */
+template <class T> auto await(Future<T> future) {
+  struct Awaiter {
+    Future<T> future;
+    bool await_ready() const { return future.ready(); }
+    void await_suspend(std::coroutine_handle<> h) {
+      Scheduler *scheduler = Scheduler::GetThis();
+      Future<T> f = future;
+      scheduler->schedule(std::function<void()>([f, h]() {
+        f.wait();
+        h.resume();
+      }));
+    }
+    decltype(auto) await_resume() const { return future.get(); }
+  };
+  return Awaiter{std::move(future)};
+}
+
+/**
+ * @brief 等待fd的IO事件
+ * @details 基于IOManager::addEvent, 事件注册失败时不挂起
+ */
+struct IOAwaiter {
+  int fd;
+  IOManager::Event event;
+  /// 注册结果, 0成功, -1失败
+  int rt = 0;
+
+  bool await_ready() const noexcept { return false; }
+  bool await_suspend(std::coroutine_handle<> h) {
+    IOManager *iom = IOManager::GetThis();
+    // 注册成功后回调可能立即在其他线程恢复协程并释放协程帧,
+    // 之后不能再访问this
+    int r = iom ? iom->addEvent(fd, event, [h]() { h.resume(); }) : -1;
+    if (r) {
+      rt = r;
+      return false;
+    }
+    return true;
+  }
+  /**
+   * @return 事件就绪返回0, 注册失败返回-1
+   */
+  int await_resume() const noexcept { return rt; }
+};
+
+/**
+ * @brief co_await readable(fd) 等待fd可读
+ */
+inline IOAwaiter readable(int fd) { return IOAwaiter{fd, IOManager::READ}; }
+
+/**
+ * @brief co_await writable(fd) 等待fd可写
+ */
+inline IOAwaiter writable(int fd) { return IOAwaiter{fd, IOManager::WRITE}; }
+
+/**
+ * @brief co_await sleep(ms) 挂起指定毫秒
+ * @details 基于IOManager的定时器, 不在IOManager中时不挂起
+ */
+struct sleep {
+  uint64_t ms;
+
+  bool await_ready() const noexcept { return ms == 0; }
+  bool await_suspend(std::coroutine_handle<> h) {
+    IOManager *iom = IOManager::GetThis();
+    if (!iom) {
+      return false;
+    }
+    iom->addTimer(ms, [h]() { h.resume(); });
+    return true;
+  }
+  void await_resume() const noexcept {}
+};
+
+} // namespace co
+} // namespace arvin
+
+#endif
@@ -0,0 +1,556 @@
+#include "dns.h"
+#include "config.h"
+#include "iomanager.h"
+#include "log.h"
+#include "util.h"
+#include <algorithm>
+#include <errno.h>
+#include <fstream>
+#include <netdb.h>
+#include <random>
+#include <sstream>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+namespace arvin {
+
+static Logger::ptr g_logger = ARVIN_LOG_NAME("system");
+
+static ConfigVar<uint32_t>::ptr g_dns_max_ttl = Config::Lookup<uint32_t>(
+    "dns.cache.max_ttl", 300, "dns positive cache ttl upper bound seconds");
+static ConfigVar<uint32_t>::ptr g_dns_negative_ttl = Config::Lookup<uint32_t>(
+    "dns.cache.negative_ttl", 30,
+    "dns negative cache ttl upper bound seconds, used when no SOA");
+static ConfigVar<uint32_t>::ptr g_dns_fallback_ttl = Config::Lookup<uint32_t>(
+    "dns.cache.fallback_ttl", 30,
+    "dns cache ttl seconds for getaddrinfo results without ttl");
+static ConfigVar<uint32_t>::ptr g_dns_max_entries = Config::Lookup<uint32_t>(
+    "dns.cache.max_entries", 10000, "dns cache max entries");
+
+static const uint16_t DNS_TYPE_A = 1;
+static const uint16_t DNS_TYPE_SOA = 6;
+static const uint16_t DNS_TYPE_AAAA = 28;
+static const uint16_t DNS_CLASS_IN = 1;
+static const size_t DNS_HEADER_SIZE = 12;
+
+/**
+ * @brief 域名统一为小写且不带末尾的'.'
+ */
+static std::string NormalizeName(const std::string &name) {
+  std::string rt = name;
+  while (!rt.empty() && rt.back() == '.') {
+    rt.pop_back();
+  }
+  std::transform(rt.begin(), rt.end(), rt.begin(), ::tolower);
+  return rt;
+}
+
+/**
+ * @brief 复制地址, 缓存中的地址不直接交给调用方修改
+ */
+static IPAddress::ptr Clone(const IPAddress::ptr &addr) {
+  return std::dynamic_pointer_cast<IPAddress>(
+      Address::Create(addr->getAddr(), addr->getAddrLen()));
+}
+
+static void PutU16(std::string &out, uint16_t v) {
+  out.push_back((char)(v >> 8));
+  out.push_back((char)(v & 0xff));
+}
+
+/**
+ * @brief 编码只有一个问题的查询请求(RD=1)
+ */
+static bool EncodeQuery(std::string &out, uint16_t id, const std::string &name,
+                        uint16_t qtype) {
+  if (name.size() > 253) {
+    return false;
+  }
+  out.clear();
+  PutU16(out, id);
+  PutU16(out, 0x0100);
+  PutU16(out, 1);
+  PutU16(out, 0);
+  PutU16(out, 0);
+  PutU16(out, 0);
+  size_t begin = 0;
+  while (begin < name.size()) {
+    size_t end = name.find('.', begin);
+    if (end == std::string::npos) {
+      end = name.size();
+    }
+    size_t len = end - begin;
+    if (len == 0 || len > 63) {
+      return false;
+    }
+    out.push_back((char)len);
+    out.append(name, begin, len);
+    begin = end + 1;
+  }
+  out.push_back(0);
+  PutU16(out, qtype);
+  PutU16(out, DNS_CLASS_IN);
+  return true;
+}
+
+/**
+ * @brief 应答报文读取器, 越界后ok()返回false
+ */
+class DnsReader {
+public:
+  DnsReader(const uint8_t *data, size_t len) : m_data(data), m_len(len) {}
+
+  bool ok() const { return m_ok; }
+  size_t pos() const { return m_pos; }
+
+  uint16_t u16() {
+    if (!need(2)) {
+      return 0;
+    }
+    uint16_t v = (m_data[m_pos] << 8) | m_data[m_pos + 1];
+    m_pos += 2;
+    return v;
+  }
+
+  uint32_t u32() {
+    uint32_t v = u16();
+    return (v << 16) | u16();
+  }
+
+  const uint8_t *bytes(size_t n) {
+    if (!need(n)) {
+      return nullptr;
+    }
+    const uint8_t *p = m_data + m_pos;
+    m_pos += n;
+    return p;
+  }
+
+  /**
+   * @brief 跳过一个域名(可能以压缩指针结尾)
+   */
+  void skipName() {
+    while (need(1)) {
+      uint8_t c = m_data[m_pos];
+      if ((c & 0xc0) == 0xc0) {
+        bytes(2);
+        return;
+      } else if (c & 0xc0) {
+        m_ok = false;
+        return;
+      }
+      ++m_pos;
+      if (c == 0) {
+        return;
+      }
+      bytes(c);
+    }
+  }
+
+private:
+  bool need(size_t n) {
+    if (!m_ok || m_len - m_pos < n) {
+      m_ok = false;
+    }
+    return m_ok;
+  }
+
+private:
+  const uint8_t *m_data;
+  size_t m_len;
+  size_t m_pos = 0;
+  bool m_ok = true;
+};
+
+/**
+ * @brief 应答的解析结果
+ */
+enum ParseResult {
+  /// 不是本次请求的应答, 继续等待
+  PARSE_MISMATCH,
+  /// 得到地址
+  PARSE_OK,
+  /// 域名不存在或没有该类型的记录
+  PARSE_NOT_FOUND,
+  /// 服务端错误或报文错误, 换下一个nameserver
+  PARSE_FAIL
+};
+
+/**
+ * @brief 解析应答
+ * @param[in] query 发出的请求, 用于校验id与问题
+ * @param[out] ttl 结果的TTL, 否定结果取SOA的TTL与MINIMUM中较小者
+ */
+static ParseResult ParseResponse(const uint8_t *data, size_t len,
+                                 const std::string &query, uint16_t qtype,
+                                 std::vector<IPAddress::ptr> &result,
+                                 uint32_t &ttl) {
+  if (len < query.size() ||
+      memcmp(data, query.data(), 2) != 0 ||
+      memcmp(data + DNS_HEADER_SIZE, query.data() + DNS_HEADER_SIZE,
+             query.size() - DNS_HEADER_SIZE) != 0) {
+    return PARSE_MISMATCH;
+  }
+  DnsReader reader(data, len);
+  reader.u16();
+  uint16_t flags = reader.u16();
+  uint16_t qdcount = reader.u16();
+  uint16_t ancount = reader.u16();
+  uint16_t nscount = reader.u16();
+  reader.u16();
+  if (!(flags & 0x8000) || qdcount != 1) {
+    return PARSE_MISMATCH;
+  }
+  uint16_t rcode = flags & 0x000f;
+  if (rcode != 0 && rcode != 3) {
+    return PARSE_FAIL;
+  }
+  reader.bytes(query.size() - DNS_HEADER_SIZE);
+
+  ttl = ~0u;
+  size_t rdlen_want = qtype == DNS_TYPE_A ? 4 : 16;
+  // CNAME链上的目标记录也在answer中, 只取与请求类型相同的记录
+  for (uint16_t i = 0; i < ancount && reader.ok(); ++i) {
+    reader.skipName();
+    uint16_t type = reader.u16();
+    uint16_t cls = reader.u16();
+    uint32_t rttl = reader.u32();
+    uint16_t rdlen = reader.u16();
+    const uint8_t *rdata = reader.bytes(rdlen);
+    if (!rdata || type != qtype || cls != DNS_CLASS_IN ||
+        rdlen != rdlen_want) {
+      continue;
+    }
+    if (type == DNS_TYPE_A) {
+      sockaddr_in addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sin_family = AF_INET;
+      memcpy(&addr.sin_addr, rdata, 4);
+      result.emplace_back(new IPv4Address(addr));
+    } else {
+      result.emplace_back(new IPv6Address(rdata));
+    }
+    ttl = std::min(ttl, rttl);
+  }
+  if (!reader.ok()) {
+    return result.empty() ? PARSE_FAIL : PARSE_OK;
+  }
+  if (!result.empty()) {
+    return PARSE_OK;
+  }
+  if (flags & 0x0200) {
+    // 截断且没有可用记录
+    return PARSE_FAIL;
+  }
+
+  for (uint16_t i = 0; i < nscount && reader.ok(); ++i) {
+    reader.skipName();
+    uint16_t type = reader.u16();
+    reader.u16();
+    uint32_t rttl = reader.u32();
+    uint16_t rdlen = reader.u16();
+    size_t end = reader.pos() + rdlen;
+    if (type == DNS_TYPE_SOA) {
+      reader.skipName();
+      reader.skipName();
+      reader.bytes(16);
+      uint32_t minimum = reader.u32();
+      if (reader.ok() && reader.pos() == end) {
+        ttl = std::min(rttl, minimum);
+      }
+      break;
+    }
+    reader.bytes(rdlen);
+  }
+  return PARSE_NOT_FOUND;
+}
+
+DnsResolver::DnsResolver(const std::string &resolv_conf,
+                         const std::string &hosts) {
+  loadResolvConf(resolv_conf);
+  loadHosts(hosts);
+}
+
+void DnsResolver::loadResolvConf(const std::string &path) {
+  std::ifstream ifs(path);
+  std::string line;
+  while (std::getline(ifs, line)) {
+    std::stringstream ss(line);
+    std::string key;
+    ss >> key;
+    if (key == "nameserver") {
+      std::string value;
+      ss >> value;
+      IPAddress::ptr addr = IPAddress::Create(value.c_str(), 53);
+      if (addr) {
+        m_nameservers.push_back(addr);
+      }
+    } else if (key == "options") {
+      std::string opt;
+      while (ss >> opt) {
+        if (opt.compare(0, 8, "timeout:") == 0) {
+          m_timeout = atoi(opt.c_str() + 8) * 1000ull;
+        } else if (opt.compare(0, 9, "attempts:") == 0) {
+          m_attempts = atoi(opt.c_str() + 9);
+        }
+      }
+    }
+  }
+  if (m_timeout == 0) {
+    m_timeout = 1000;
+  }
+  if (m_attempts == 0) {
+    m_attempts = 1;
+  }
+}
+
+void DnsResolver::loadHosts(const std::string &path) {
+  std::ifstream ifs(path);
+  std::string line;
+  while (std::getline(ifs, line)) {
+    size_t pos = line.find('#');
+    if (pos != std::string::npos) {
+      line.resize(pos);
+    }
+    std::stringstream ss(line);
+    std::string ip;
+    ss >> ip;
+    IPAddress::ptr addr = IPAddress::Create(ip.c_str());
+    if (!addr) {
+      continue;
+    }
+    std::string name;
+    while (ss >> name) {
+      m_hosts[NormalizeName(name)].push_back(addr);
+    }
+  }
+}
+
+void DnsResolver::setNameservers(const std::vector<Address::ptr> &v) {
+  RWMutexType::WriteLock lock(m_mutex);
+  m_nameservers = v;
+}
+
+void DnsResolver::clearCache() {
+  RWMutexType::WriteLock lock(m_mutex);
+  m_cache.clear();
+}
+
+bool DnsResolver::resolve(std::vector<IPAddress::ptr> &result,
+                          const std::string &name, int family) {
+  std::string key = NormalizeName(name);
+  if (key.empty()) {
+    return false;
+  }
+
+  // hosts文件只在构造时读取, 之后不再修改
+  auto it = m_hosts.find(key);
+  if (it != m_hosts.end()) {
+    size_t count = result.size();
+    for (auto &i : it->second) {
+      if (family == AF_UNSPEC || i->getFamily() == family) {
+        result.push_back(Clone(i));
+      }
+    }
+    if (result.size() > count) {
+      return true;
+    }
+  }
+
+  bool found = false;
+  if (family == AF_INET || family == AF_UNSPEC) {
+    found |= lookup(result, key, DNS_TYPE_A) == OK;
+  }
+  if (family == AF_INET6 || family == AF_UNSPEC) {
+    found |= lookup(result, key, DNS_TYPE_AAAA) == OK;
+  }
+  return found;
+}
+
+DnsResolver::Status DnsResolver::lookup(std::vector<IPAddress::ptr> &result,
+                                        const std::string &name,
+                                        uint16_t qtype) {
+  std::string key = name + "#" + std::to_string(qtype);
+  uint64_t now = GetMonotonicMS();
+  {
+    RWMutexType::ReadLock lock(m_mutex);
+    auto it = m_cache.find(key);
+    if (it != m_cache.end() && it->second.expire > now) {
+      for (auto &i : it->second.addrs) {
+        result.push_back(Clone(i));
+      }
+      return it->second.addrs.empty() ? NOT_FOUND : OK;
+    }
+  }
+
+  std::shared_ptr<Inflight> flight;
+  bool leader = false;
+  {
+    RWMutexType::WriteLock lock(m_mutex);
+    auto it = m_inflight.find(key);
+    if (it != m_inflight.end()) {
+      flight = it->second;
+      ++flight->waiters;
+    } else {
+      flight.reset(new Inflight);
+      m_inflight[key] = flight;
+      leader = true;
+    }
+  }
+
+  if (!leader) {
+    flight->sem.wait();
+  } else {
+    uint32_t ttl = 0;
+    bool has_ns = false;
+    {
+      RWMutexType::ReadLock lock(m_mutex);
+      has_ns = !m_nameservers.empty();
+    }
+    flight->status = has_ns ? query(flight->addrs, name, qtype, ttl)
+                            : fallback(flight->addrs, name, qtype, ttl);
+    if (flight->status == OK) {
+      ttl = std::min(ttl, g_dns_max_ttl->getValue());
+    } else if (flight->status == NOT_FOUND) {
+      ttl = std::min(ttl, g_dns_negative_ttl->getValue());
+    }
+
+    size_t waiters = 0;
+    {
+      RWMutexType::WriteLock lock(m_mutex);
+      if (flight->status != FAIL && ttl > 0) {
+        if (m_cache.size() >= g_dns_max_entries->getValue()) {
+          now = GetMonotonicMS();
+          for (auto it = m_cache.begin(); it != m_cache.end();) {
+            if (it->second.expire <= now) {
+              it = m_cache.erase(it);
+            } else {
+              ++it;
+            }
+          }
+          if (m_cache.size() >= g_dns_max_entries->getValue()) {
+            m_cache.clear();
+          }
+        }
+        Entry &entry = m_cache[key];
+        entry.addrs = flight->addrs;
+        entry.expire = GetMonotonicMS() + ttl * 1000ull;
+      }
+      m_inflight.erase(key);
+      waiters = flight->waiters;
+    }
+    for (size_t i = 0; i < waiters; ++i) {
+      flight->sem.notify();
+    }
+  }
+
+  for (auto &i : flight->addrs) {
+    result.push_back(Clone(i));
+  }
+  return flight->status;
+}
+
+DnsResolver::Status DnsResolver::query(std::vector<IPAddress::ptr> &result,
+                                       const std::string &name, uint16_t qtype,
+                                       uint32_t &ttl) {
+  static thread_local std::mt19937 s_rand(std::random_device{}());
+  std::string request;
+  if (!EncodeQuery(request, (uint16_t)s_rand(), name, qtype)) {
+    return NOT_FOUND;
+  }
+
+  std::vector<Address::ptr> servers;
+  {
+    RWMutexType::ReadLock lock(m_mutex);
+    servers = m_nameservers;
+  }
+  uint8_t buf[4096];
+  for (uint32_t attempt = 0; attempt < m_attempts; ++attempt) {
+    for (auto &ns : servers) {
+      // socket经过hook, 在协程中等待应答时只挂起当前协程
+      int fd = socket(ns->getFamily(), SOCK_DGRAM, 0);
+      if (fd < 0) {
+        continue;
+      }
+      if (connect(fd, ns->getAddr(), ns->getAddrLen()) ||
+          send(fd, request.data(), request.size(), 0) !=
+              (ssize_t)request.size()) {
+        ARVIN_LOG_DEBUG(g_logger) << "dns send to " << *ns
+                                  << " errno=" << errno << " "
+                                  << strerror(errno);
+        close(fd);
+        continue;
+      }
+      ++m_queries;
+
+      ParseResult rt = PARSE_MISMATCH;
+      uint64_t deadline = GetMonotonicMS() + m_timeout;
+      while (rt == PARSE_MISMATCH) {
+        // 不匹配的应答不延长等待, 每次recv只等待剩余的时间
+        uint64_t now = GetMonotonicMS();
+        if (now >= deadline) {
+          break;
+        }
+        uint64_t remain = deadline - now;
+        timeval tv = {(time_t)(remain / 1000),
+                      (suseconds_t)(remain % 1000 * 1000)};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n < 0) {
+          break;
+        }
+        result.clear();
+        rt = ParseResponse(buf, n, request, qtype, result, ttl);
+      }
+      close(fd);
+
+      if (rt == PARSE_OK) {
+        return OK;
+      } else if (rt == PARSE_NOT_FOUND) {
+        return NOT_FOUND;
+      }
+      result.clear();
+      ARVIN_LOG_DEBUG(g_logger) << "dns query " << name << " type=" << qtype
+                                << " to " << *ns << " failed";
+    }
+  }
+  return FAIL;
+}
+
+DnsResolver::Status DnsResolver::fallback(std::vector<IPAddress::ptr> &result,
+                                          const std::string &name,
+                                          uint16_t qtype, uint32_t &ttl) {
+  addrinfo hints, *results = nullptr;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = qtype == DNS_TYPE_A ? AF_INET : AF_INET6;
+  hints.ai_socktype = SOCK_STREAM;
+
+  int error = 0;
+  auto call = [&]() {
+    error = getaddrinfo(name.c_str(), NULL, &hints, &results);
+  };
+  // getaddrinfo会阻塞到解析超时, 交给阻塞IO线程池
+  IOManager *iom = IOManager::GetThis();
+  if (!iom || !iom->runBlocking(call)) {
+    call();
+  }
+  if (error == EAI_NONAME || error == EAI_NODATA) {
+    ttl = g_dns_negative_ttl->getValue();
+    return NOT_FOUND;
+  } else if (error) {
+    return FAIL;
+  }
+  for (addrinfo *next = results; next; next = next->ai_next) {
+    IPAddress::ptr addr = std::dynamic_pointer_cast<IPAddress>(
+        Address::Create(next->ai_addr, (socklen_t)next->ai_addrlen));
+    if (addr) {
+      result.push_back(addr);
+    }
+  }
+  freeaddrinfo(results);
+  ttl = g_dns_fallback_ttl->getValue();
+  return result.empty() ? NOT_FOUND : OK;
+}
+
+} // namespace arvin
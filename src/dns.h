@@ -0,0 +1,152 @@
+#pragma once
+
+#include "address.h"
+#include "mutex.h"
+#include "singleton.h"
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace arvin {
+
+/**
+ * @brief 协程友好的DNS解析器
+ * @details 先查hosts文件, 再通过UDP向resolv.conf中的nameserver查询A/AAAA.
+ *          socket经过hook, 在协程中等待应答只挂起当前协程.
+ *          结果按应答TTL缓存, NXDOMAIN/无记录按SOA缓存为否定结果;
+ *          同一域名并发查询只发出一次请求, 其余协程等待其结果.
+ *          没有nameserver时退回getaddrinfo, 由阻塞IO线程池执行
+ */
+class DnsResolver : Noncopyable {
+public:
+  typedef std::shared_ptr<DnsResolver> ptr;
+  typedef RWMutex RWMutexType;
+
+  /**
+   * @brief 构造函数
+   * @param[in] resolv_conf resolv.conf路径, 读取nameserver与timeout/attempts
+   * @param[in] hosts hosts文件路径
+   */
+  DnsResolver(const std::string &resolv_conf = "/etc/resolv.conf",
+              const std::string &hosts = "/etc/hosts");
+
+  /**
+   * @brief 解析域名
+   * @param[out] result 解析出的地址(端口为0), 追加在末尾
+   * @param[in] name 域名
+   * @param[in] family AF_INET, AF_INET6或AF_UNSPEC(两者都查)
+   * @return 是否解析到地址
+   */
+  bool resolve(std::vector<IPAddress::ptr> &result, const std::string &name,
+               int family = AF_INET);
+
+  /**
+   * @brief 设置nameserver(可带非53端口), 替换resolv.conf中的配置
+   */
+  void setNameservers(const std::vector<Address::ptr> &v);
+
+  /**
+   * @brief 设置单次请求的等待时间(毫秒)
+   */
+  void setTimeout(uint64_t v) { m_timeout = v; }
+
+  /**
+   * @brief 设置每个nameserver的尝试次数
+   */
+  void setAttempts(uint32_t v) { m_attempts = v; }
+
+  /**
+   * @brief 清空缓存
+   */
+  void clearCache();
+
+  /**
+   * @brief 返回发出的DNS请求数
+   */
+  uint64_t getQueryCount() const { return m_queries; }
+
+private:
+  /**
+   * @brief 查询结果
+   */
+  enum Status {
+    /// 得到地址
+    OK,
+    /// 域名不存在或没有该类型的记录, 可以缓存
+    NOT_FOUND,
+    /// 超时或服务端错误, 不缓存
+    FAIL
+  };
+
+  /**
+   * @brief 缓存项, addrs为空时表示否定结果
+   */
+  struct Entry {
+    std::vector<IPAddress::ptr> addrs;
+    /// 过期时间(单调时钟毫秒)
+    uint64_t expire = 0;
+  };
+
+  /**
+   * @brief 正在进行的查询, 后来的协程等待它的结果
+   */
+  struct Inflight {
+    FiberSemaphore sem;
+    /// 等待者数量
+    size_t waiters = 0;
+    Status status = FAIL;
+    std::vector<IPAddress::ptr> addrs;
+  };
+
+  /**
+   * @brief 按记录类型查询(缓存、合并并发请求)
+   */
+  Status lookup(std::vector<IPAddress::ptr> &result, const std::string &name,
+                uint16_t qtype);
+
+  /**
+   * @brief 向nameserver发出请求
+   * @param[out] ttl 结果可以缓存的秒数
+   */
+  Status query(std::vector<IPAddress::ptr> &result, const std::string &name,
+               uint16_t qtype, uint32_t &ttl);
+
+  /**
+   * @brief 没有nameserver时通过getaddrinfo解析
+   */
+  Status fallback(std::vector<IPAddress::ptr> &result, const std::string &name,
+                  uint16_t qtype, uint32_t &ttl);
+
+  /**
+   * @brief 读取resolv.conf
+   */
+  void loadResolvConf(const std::string &path);
+
+  /**
+   * @brief 读取hosts文件
+   */
+  void loadHosts(const std::string &path);
+
+private:
+  RWMutexType m_mutex;
+  /// 域名#类型 -> 缓存项
+  std::unordered_map<std::string, Entry> m_cache;
+  /// 域名#类型 -> 正在进行的查询
+  std::unordered_map<std::string, std::shared_ptr<Inflight>> m_inflight;
+  /// hosts文件中的域名 -> 地址
+  std::unordered_map<std::string, std::vector<IPAddress::ptr>> m_hosts;
+  std::vector<Address::ptr> m_nameservers;
+  /// 单次请求的等待时间(毫秒)
+  uint64_t m_timeout = 5000;
+  /// 每个nameserver的尝试次数
+  uint32_t m_attempts = 2;
+  /// 发出的请求数
+  std::atomic<uint64_t> m_queries = {0};
+};
+
+/// 全局DNS解析器, Address::Lookup在协程中使用它
+typedef Singleton<DnsResolver> DnsResolverMgr;
+
+} // namespace arvin
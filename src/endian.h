@@ -4,6 +4,7 @@
 #define ARVIN_BIG_ENDIAN 2
 
 #include <byteswap.h>
+#include <endian.h>
 #include <stdint.h>
 #include <type_traits>
 namespace arvin {
@@ -36,12 +37,12 @@ byteswap(T value) {
 }
 
 #if BYTE_ORDER == BIG_ENDIAN
-#define SYLAR_BYTE_ORDER SYLAR_BIG_ENDIAN
+#define ARVIN_BYTE_ORDER ARVIN_BIG_ENDIAN
 #else
-#define SYLAR_BYTE_ORDER SYLAR_LITTLE_ENDIAN
+#define ARVIN_BYTE_ORDER ARVIN_LITTLE_ENDIAN
 #endif
 
-#if SYLAR_BYTE_ORDER == SYLAR_BIG_ENDIAN
+#if ARVIN_BYTE_ORDER == ARVIN_BIG_ENDIAN
 
 /**
  * @brief 只在小端机器上执行byteswap, 在大端机器上什么都不做
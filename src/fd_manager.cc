@@ -1,92 +1,91 @@
 #include "fd_manager.h"
+#include "config.h"
 #include "hook.h"
+#include <algorithm>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 namespace arvin {
-FdCtx::FdCtx(int fd)
-    : m_isInit(false), m_isSocket(false), m_sysNonblock(false),
-      m_userNonblock(false), m_isClosed(false), m_fd(fd), m_recvTimeout(-1),
-      m_sendTimeout(-1) {
-  init();
-}
-FdCtx::~FdCtx() {}
+
+static ConfigVar<uint32_t>::ptr g_fd_prealloc_max = Config::Lookup<uint32_t>(
+    "fdmanager.prealloc_max", 65536,
+    "max fd contexts preallocated from RLIMIT_NOFILE");
+
 bool FdCtx::init() {
-  if (m_isInit) {
-    return true;
-  }
-  m_recvTimeout = -1;
-  m_sendTimeout = -1;
+  uint32_t state = USED;
   struct stat fd_stat;
-  if (fstat(m_fd, &fd_stat)) {
-    m_isInit = false;
-    m_isSocket = false;
-  } else {
-    m_isInit = true;
-    m_isSocket = S_ISSOCK(fd_stat.st_mode);
+  if (!fstat(m_fd, &fd_stat)) {
+    state |= INIT;
+    if (S_ISSOCK(fd_stat.st_mode)) {
+      state |= SOCKET;
+    } else if (S_ISREG(fd_stat.st_mode)) {
+      state |= FILE;
+    }
   }
-  if (m_isSocket) {
-    int flags = fcntl(m_fd, F_GETFL, 0);
+  if (state & SOCKET) {
+    int flags = fcntl_f(m_fd, F_GETFL, 0);
     if (!(flags & O_NONBLOCK)) {
-      fcntl(m_fd, F_SETFL, flags | O_NONBLOCK);
+      fcntl_f(m_fd, F_SETFL, flags | O_NONBLOCK);
     }
-    m_sysNonblock = true;
-  } else {
-    m_sysNonblock = false;
+    state |= SYS_NONBLOCK;
   }
-  m_userNonblock = false;
-  m_isClosed = false;
-  return m_isInit;
+  m_recvTimeout.store(~0ull, std::memory_order_relaxed);
+  m_sendTimeout.store(~0ull, std::memory_order_relaxed);
+  // 并发登记同一个fd时各自算出的状态相同, 最后一次写入即可
+  m_state.store(state, std::memory_order_release);
+  return state & INIT;
 }
 
 void FdCtx::setTimeout(int type, uint64_t v) {
   if (type == SO_RCVTIMEO) {
-    m_recvTimeout = v;
+    m_recvTimeout.store(v, std::memory_order_relaxed);
   } else {
-    m_sendTimeout = v;
+    m_sendTimeout.store(v, std::memory_order_relaxed);
   }
 }
-uint64_t FdCtx::getTimeout(int type) {
+
+uint64_t FdCtx::getTimeout(int type) const {
   if (type == SO_RCVTIMEO) {
-    return m_recvTimeout;
+    return m_recvTimeout.load(std::memory_order_relaxed);
   } else {
-    return m_sendTimeout;
+    return m_sendTimeout.load(std::memory_order_relaxed);
   }
 }
 
-FdManager::FdManager() { m_datas.resize(64); }
+FdManager::FdManager()
+    : m_datas([](FdCtx &ctx, size_t fd) { ctx.m_fd = fd; }) {
+  rlimit limit;
+  size_t n = 1024;
+  if (!getrlimit(RLIMIT_NOFILE, &limit) && limit.rlim_cur != RLIM_INFINITY) {
+    n = limit.rlim_cur;
+  }
+  n = std::min<size_t>(n, g_fd_prealloc_max->getValue());
+  m_reserved = m_datas.reserve(n);
+}
 
-FdCtx::ptr FdManager::get(int fd, bool auto_create) {
-  if (fd == -1) {
+FdCtx *FdManager::get(int fd, bool auto_create) {
+  FdCtx *ctx = auto_create ? m_datas.getOrCreate(fd) : m_datas.get(fd);
+  if (!ctx) {
     return nullptr;
   }
-  RWMutexType::ReadLock lock(m_mutex);
-  if ((int)m_datas.size() <= fd) {
-    if (auto_create == false) {
-      return nullptr;
-    }
-  } else {
-    if (m_datas[fd] || !auto_create) {
-      return m_datas[fd];
-    }
+  if (ctx->m_state.load(std::memory_order_acquire) & FdCtx::USED) {
+    return ctx;
   }
-  lock.unlock();
-
-  RWMutexType::WriteLock lock2(m_mutex);
-  FdCtx::ptr ctx(new FdCtx(fd));
-  if (fd >= (int)m_datas.size()) {
-    m_datas.resize(fd * 1.5);
+  if (!auto_create) {
+    return nullptr;
   }
-  m_datas[fd] = ctx;
+  ctx->init();
   return ctx;
 }
 
 void FdManager::del(int fd) {
-  RWMutexType::WriteLock lock(m_mutex);
-  if ((int)m_datas.size() <= fd) {
+  FdCtx *ctx = m_datas.get(fd);
+  if (!ctx) {
     return;
   }
-  m_datas[fd].reset();
+  // 正在使用该记录的调用看到CLOSED, 之后的查找返回nullptr
+  ctx->m_state.store(FdCtx::CLOSED, std::memory_order_release);
 }
-} // namespace arvin
\ No newline at end of file
+} // namespace arvin
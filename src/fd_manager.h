@@ -1,7 +1,9 @@
 #pragma once
 
+#include "fd_table.h"
 #include "singleton.h"
 #include "thread.h"
+#include <atomic>
 #include <memory>
 #include <vector>
 #include <fcntl.h>
@@ -10,56 +12,75 @@ namespace arvin {
 /**
  * @brief 文件句柄上下文类
  * @details 管理文件句柄类型(是否socket)
- *          是否阻塞,是否关闭,读/写超时时间
+ *          是否阻塞,是否关闭,读/写超时时间.
+ *          记录内联在FdManager的表中, 标志位打包在一个原子字里;
+ *          fd关闭后记录留给复用该fd的句柄, 不会释放
  */
-class FdCtx : public std::enable_shared_from_this<FdCtx> {
+class FdCtx : Noncopyable {
+  friend class FdManager;
+
 public:
-  typedef std::shared_ptr<FdCtx> ptr;
-  /**
-   * @brief 通过文件句柄构造FdCtx
-   */
-  FdCtx(int fd);
   /**
-   * @brief 析构函数
+   * @brief 状态标志位
    */
-  ~FdCtx();
+  enum Flag : uint32_t {
+    /// 已登记
+    USED = 1 << 0,
+    /// 是否初始化(fstat成功)
+    INIT = 1 << 1,
+    /// 是否socket
+    SOCKET = 1 << 2,
+    /// 是否普通文件
+    FILE = 1 << 3,
+    /// 是否hook非阻塞
+    SYS_NONBLOCK = 1 << 4,
+    /// 是否用户主动设置非阻塞
+    USER_NONBLOCK = 1 << 5,
+    /// 是否关闭
+    CLOSED = 1 << 6
+  };
 
   /**
    * @brief 是否初始化完成
    */
-  bool isInit() const { return m_isInit; }
+  bool isInit() const { return test(INIT); }
 
   /**
    * @brief 是否socket
    */
-  bool isSocket() const { return m_isSocket; }
+  bool isSocket() const { return test(SOCKET); }
+
+  /**
+   * @brief 是否普通文件(epoll无法等待, hook时交给io_uring或阻塞IO线程池)
+   */
+  bool isFile() const { return test(FILE); }
 
   /**
    * @brief 是否已关闭
    */
-  bool isClose() const { return m_isClosed; }
+  bool isClose() const { return test(CLOSED); }
 
   /**
    * @brief 设置用户主动设置非阻塞
    * @param[in] v 是否阻塞
    */
-  void setUserNonblock(bool v) { m_userNonblock = v; }
+  void setUserNonblock(bool v) { set(USER_NONBLOCK, v); }
 
   /**
    * @brief 获取是否用户主动设置的非阻塞
    */
-  bool getUserNonblock() const { return m_userNonblock; }
+  bool getUserNonblock() const { return test(USER_NONBLOCK); }
 
   /**
    * @brief 设置系统非阻塞
    * @param[in] v 是否阻塞
    */
-  void setSysNonblock(bool v) { m_sysNonblock = v; }
+  void setSysNonblock(bool v) { set(SYS_NONBLOCK, v); }
 
   /**
    * @brief 获取系统非阻塞
    */
-  bool getSysNonblock() const { return m_sysNonblock; }
+  bool getSysNonblock() const { return test(SYS_NONBLOCK); }
 
   /**
    * @brief 设置超时时间
@@ -73,39 +94,49 @@ public:
    * @param[in] type 类型SO_RCVTIMEO(读超时), SO_SNDTIMEO(写超时)
    * @return 超时时间毫秒
    */
-  uint64_t getTimeout(int type);
+  uint64_t getTimeout(int type) const;
+
+  /**
+   * @brief 返回文件句柄
+   */
+  int getFd() const { return m_fd; }
 
 private:
   /**
-   * @brief 初始化
+   * @brief 登记时初始化, 重复初始化结果相同
    */
   bool init();
 
+  bool test(uint32_t flag) const {
+    return m_state.load(std::memory_order_acquire) & flag;
+  }
+
+  void set(uint32_t flag, bool v) {
+    if (v) {
+      m_state.fetch_or(flag, std::memory_order_acq_rel);
+    } else {
+      m_state.fetch_and(~flag, std::memory_order_acq_rel);
+    }
+  }
+
 private:
-  /// 是否初始化
-  bool m_isInit : 1;
-  /// 是否socket
-  bool m_isSocket : 1;
-  /// 是否hook非阻塞
-  bool m_sysNonblock : 1;
-  /// 是否用户主动设置非阻塞
-  bool m_userNonblock : 1;
-  /// 是否关闭
-  bool m_isClosed : 1;
+  /// 状态标志位
+  std::atomic<uint32_t> m_state = {0};
   /// 文件句柄
-  int m_fd;
+  int m_fd = -1;
   /// 读超时时间毫秒
-  uint64_t m_recvTimeout;
+  std::atomic<uint64_t> m_recvTimeout = {~0ull};
   /// 写超时时间毫秒
-  uint64_t m_sendTimeout;
+  std::atomic<uint64_t> m_sendTimeout = {~0ull};
 };
 
 /**
  * @brief 文件句柄管理类
+ * @details 以fd为下标的无锁表, 构造时按RLIMIT_NOFILE预分配记录,
+ *          超出部分按需分配. 查找不加锁也不增加引用计数
  */
 class FdManager {
 public:
-  typedef RWMutex RWMutexType;
   /**
    * @brief 无参构造函数
    */
@@ -115,9 +146,10 @@ public:
    * @brief 获取/创建文件句柄类FdCtx
    * @param[in] fd 文件句柄
    * @param[in] auto_create 是否自动创建
-   * @return 返回对应文件句柄类FdCtx::ptr
+   * @return 返回表中的记录, 记录不会释放, 在本次系统调用期间可直接使用;
+   *         未登记且不自动创建或fd超出容量时返回nullptr
    */
-  FdCtx::ptr get(int fd, bool auto_create = false);
+  FdCtx *get(int fd, bool auto_create = false);
 
   /**
    * @brief 删除文件句柄类
@@ -125,13 +157,18 @@ public:
    */
   void del(int fd);
 
+  /**
+   * @brief 返回预分配的记录数
+   */
+  size_t getReserved() const { return m_reserved; }
+
 private:
-  /// 读写锁
-  RWMutexType m_mutex;
-  /// 文件句柄集合
-  std::vector<FdCtx::ptr> m_datas;
+  /// 文件句柄集合, 以fd为下标
+  FdTable<FdCtx> m_datas;
+  /// 预分配的记录数
+  size_t m_reserved = 0;
 };
 
 /// 文件句柄单例
 typedef Singleton<FdManager> FdMgr;
-} // namespace sylar
\ No newline at end of file
+} // namespace arvin
@@ -0,0 +1,107 @@
+/**
+ * @file fd_table.h
+ * @brief 以文件句柄为下标的分段表
+ * @details 两级结构: 固定大小的目录 + 按需分配的定长分段.
+ *          查找只做两次原子读, 不加锁; 扩容只分配新分段, 已有元素地址不变.
+ *          分段在表析构前不会释放
+ */
+#pragma once
+
+#include "noncopyable.h"
+#include <atomic>
+#include <functional>
+#include <stddef.h>
+
+namespace arvin {
+
+/**
+ * @brief 分段表
+ * @tparam T 元素类型, 需可默认构造
+ * @tparam ChunkBits 每个分段的元素数(2的幂)
+ * @tparam DirSize 目录的分段数, 容量为 DirSize << ChunkBits
+ */
+template <class T, size_t ChunkBits = 10, size_t DirSize = 4096>
+class FdTable : Noncopyable {
+public:
+  /// 新分段中每个元素的初始化函数, 参数为元素和下标
+  typedef std::function<void(T &, size_t)> InitFunc;
+
+  static constexpr size_t kChunkSize = (size_t)1 << ChunkBits;
+  static constexpr size_t kCapacity = DirSize << ChunkBits;
+
+  /**
+   * @brief 构造函数
+   * @param[in] init 分段分配后对每个元素执行一次
+   */
+  FdTable(InitFunc init = nullptr) : m_init(std::move(init)) {
+    for (size_t i = 0; i < DirSize; ++i) {
+      m_chunks[i].store(nullptr, std::memory_order_relaxed);
+    }
+  }
+
+  ~FdTable() {
+    for (size_t i = 0; i < DirSize; ++i) {
+      delete[] m_chunks[i].load(std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * @brief 查找元素, 所在分段未分配时返回nullptr
+   */
+  T *get(int idx) const {
+    if (idx < 0 || (size_t)idx >= kCapacity) {
+      return nullptr;
+    }
+    T *chunk = m_chunks[idx >> ChunkBits].load(std::memory_order_acquire);
+    return chunk ? &chunk[idx & (kChunkSize - 1)] : nullptr;
+  }
+
+  /**
+   * @brief 查找元素, 所在分段未分配时分配
+   * @return 超出容量时返回nullptr
+   */
+  T *getOrCreate(int idx) {
+    if (idx < 0 || (size_t)idx >= kCapacity) {
+      return nullptr;
+    }
+    std::atomic<T *> &slot = m_chunks[idx >> ChunkBits];
+    T *chunk = slot.load(std::memory_order_acquire);
+    if (!chunk) {
+      T *tmp = new T[kChunkSize];
+      if (m_init) {
+        size_t base = (size_t)idx & ~(kChunkSize - 1);
+        for (size_t i = 0; i < kChunkSize; ++i) {
+          m_init(tmp[i], base + i);
+        }
+      }
+      // 多个线程同时分配同一分段时只有一个成功, 其余丢弃
+      if (slot.compare_exchange_strong(chunk, tmp, std::memory_order_acq_rel,
+                                       std::memory_order_acquire)) {
+        chunk = tmp;
+      } else {
+        delete[] tmp;
+      }
+    }
+    return &chunk[idx & (kChunkSize - 1)];
+  }
+
+  /**
+   * @brief 预先分配覆盖[0, n)的分段
+   * @return 实际覆盖的元素数(不超过容量)
+   */
+  size_t reserve(size_t n) {
+    n = n < kCapacity ? n : kCapacity;
+    for (size_t i = 0; i < n; i += kChunkSize) {
+      getOrCreate((int)i);
+    }
+    return n;
+  }
+
+private:
+  /// 分段目录
+  std::atomic<T *> m_chunks[DirSize];
+  /// 元素初始化函数
+  InitFunc m_init;
+};
+
+} // namespace arvin
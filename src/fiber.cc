@@ -2,8 +2,8 @@
 #include "config.h"
 #include "log.h"
 // #include "macro.h"
+#include "scheduler.h"
 #include <atomic>
-// #include "scheduler.h"
 
 namespace arvin {
 
@@ -98,6 +98,7 @@ void Fiber::reset(std::function<void()> cb) {
   // ARVIN_ASSERT(m_stack);
   // ARVIN_ASSERT(m_state == TERM || m_state == EXCEPT || m_state == INIT);
   m_cb = cb;
+  m_deadline = ~0ull;
   if (getcontext(&m_ctx)) {
     // ARVIN_ASSERT2(false, "getcontext");
   }
@@ -127,20 +128,20 @@ void Fiber::back() {
 
 // 从调度器的主协程切换到当前协程
 void Fiber::swapIn() {
-  // SetThis(this);
-  // //ARVIN_ASSERT(m_state != EXEC);
-  // m_state = EXEC;
-  // if(swapcontext(&Scheduler::GetMainFiber()->m_ctx, &m_ctx)) {
-  //     //ARVIN_ASSERT2(false, "swapcontext");
-  // }
+  SetThis(this);
+  // ARVIN_ASSERT(m_state != EXEC);
+  m_state = EXEC;
+  if (swapcontext(&Scheduler::GetMainFiber()->m_ctx, &m_ctx)) {
+    // ARVIN_ASSERT2(false, "swapcontext");
+  }
 }
 
 // 从当前协程切换到调度器主协程
 void Fiber::swapOut() {
-  // SetThis(Scheduler::GetMainFiber());
-  // if(swapcontext(&m_ctx, &Scheduler::GetMainFiber()->m_ctx)) {
-  //     //ARVIN_ASSERT2(false, "swapcontext");
-  // }
+  SetThis(Scheduler::GetMainFiber());
+  if (swapcontext(&m_ctx, &Scheduler::GetMainFiber()->m_ctx)) {
+    // ARVIN_ASSERT2(false, "swapcontext");
+  }
 }
 
 // 设置当前协程
@@ -173,6 +174,22 @@ void Fiber::YieldToHold() {
   cur->swapOut();
 }
 
+// 抢占安全点，只有watchdog请求时才让出
+void Fiber::MaybeYield() {
+  Scheduler::WorkerStats *stats = Scheduler::GetWorkerStats();
+  if (!stats || !stats->yield_requested.load(std::memory_order_relaxed)) {
+    return;
+  }
+  stats->yield_requested.store(false, std::memory_order_relaxed);
+  stats->preempts.fetch_add(1, std::memory_order_relaxed);
+  uint64_t start = stats->slice_start_us.load(std::memory_order_relaxed);
+  ARVIN_LOG_WARN(g_logger) << "Fiber preempted fiber_id=" << GetFiberId()
+                           << " run_us=" << arvin::GetMonotonicUS() - start
+                           << std::endl
+                           << arvin::BacktraceToString(64, 2, "    ");
+  YieldToReady();
+}
+
 // 总协程数
 uint64_t Fiber::TotalFibers() { return s_fiber_count; }
 
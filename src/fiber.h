@@ -99,6 +99,16 @@ public:
    */
   State getState() const { return m_state; }
 
+  /**
+   * @brief 返回截止时间(单调时钟毫秒), ~0ull表示没有截止时间
+   */
+  uint64_t getDeadline() const { return m_deadline; }
+
+  /**
+   * @brief 设置截止时间, hook的IO调用以剩余时间作为超时
+   */
+  void setDeadline(uint64_t v) { m_deadline = v; }
+
 public:
   /**
    * @brief 设置当前线程的运行协程
@@ -123,6 +133,13 @@ public:
    */
   static void YieldToHold();
 
+  /**
+   * @brief 抢占安全点
+   * @details 调度器的watchdog发现当前任务执行超过时间片且有其他任务等待时,
+   *          记录调用栈并让出(READY), 否则立即返回. 适合在CPU密集的循环中调用
+   */
+  static void MaybeYield();
+
   /**
    * @brief 返回当前协程的总数量
    */
@@ -158,5 +175,7 @@ private:
   void *m_stack = nullptr;
   /// 协程运行函数
   std::function<void()> m_cb;
+  /// 截止时间(单调时钟毫秒)
+  uint64_t m_deadline = ~0ull;
 };
 } // namespace arvin
\ No newline at end of file
@@ -0,0 +1,61 @@
+#include "histogram.h"
+
+namespace arvin {
+
+void Histogram::Data::merge(const Data &o) {
+  count += o.count;
+  sum += o.sum;
+  if (o.max > max) {
+    max = o.max;
+  }
+  for (size_t i = 0; i < BUCKETS; ++i) {
+    buckets[i] += o.buckets[i];
+  }
+}
+
+uint64_t Histogram::Data::percentile(double p) const {
+  if (!count) {
+    return 0;
+  }
+  uint64_t target = p * count;
+  if (target == 0) {
+    target = 1;
+  }
+  uint64_t seen = 0;
+  for (size_t i = 0; i < BUCKETS; ++i) {
+    seen += buckets[i];
+    if (seen >= target) {
+      uint64_t upper = i ? (i >= 63 ? ~0ull : (1ull << i) - 1) : 0;
+      return upper < max ? upper : max;
+    }
+  }
+  return max;
+}
+
+std::ostream &Histogram::Data::dump(std::ostream &os) const {
+  os << "count=" << count << " mean=" << mean() << " p50=" << percentile(0.5)
+     << " p99=" << percentile(0.99) << " max=" << max;
+  return os;
+}
+
+Histogram::Histogram() { reset(); }
+
+void Histogram::snapshot(Data &d) const {
+  d.count = m_count.load(std::memory_order_relaxed);
+  d.sum = m_sum.load(std::memory_order_relaxed);
+  d.max = m_max.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < BUCKETS; ++i) {
+    d.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+  }
+}
+
+void Histogram::reset() {
+  m_count = 0;
+  m_sum = 0;
+  m_max = 0;
+  for (size_t i = 0; i < BUCKETS; ++i) {
+    m_buckets[i] = 0;
+  }
+}
+
+} // namespace arvin
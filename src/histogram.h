@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <iostream>
+#include <stdint.h>
+
+/**
+ * @brief IO延迟埋点开关
+ * @details 由cmake选项ARVIN_IO_TRACE打开; 关闭时埋点语句不参与编译
+ */
+#if ARVIN_IO_TRACE
+#define ARVIN_IO_TRACE_ONLY(...) __VA_ARGS__
+#else
+#define ARVIN_IO_TRACE_ONLY(...)
+#endif
+
+namespace arvin {
+
+/**
+ * @brief 无锁直方图
+ * @details 按2的幂分桶(第i个桶为[2^(i-1), 2^i)), 记录时只做relaxed原子操作,
+ *          适合在热路径上采样, 读取时通过snapshot拷贝出一份数据
+ */
+class Histogram {
+public:
+  /// 桶数量
+  static const size_t BUCKETS = 64;
+
+  /**
+   * @brief 直方图数据快照
+   */
+  struct Data {
+    /// 样本数量
+    uint64_t count = 0;
+    /// 样本总和
+    uint64_t sum = 0;
+    /// 最大样本
+    uint64_t max = 0;
+    /// 各桶的样本数量
+    uint64_t buckets[BUCKETS] = {0};
+
+    /**
+     * @brief 合并另一份数据
+     */
+    void merge(const Data &o);
+
+    /**
+     * @brief 返回平均值
+     */
+    double mean() const { return count ? (double)sum / count : 0; }
+
+    /**
+     * @brief 返回分位数的近似值(所在桶的上界)
+     * @param[in] p 分位, 取值(0, 1]
+     */
+    uint64_t percentile(double p) const;
+
+    /**
+     * @brief 输出count/mean/p50/p99/max到流中
+     */
+    std::ostream &dump(std::ostream &os) const;
+  };
+
+  Histogram();
+
+  /**
+   * @brief 记录一个样本
+   */
+  void record(uint64_t v) {
+    m_buckets[Bucket(v)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(v, std::memory_order_relaxed);
+    uint64_t max = m_max.load(std::memory_order_relaxed);
+    while (v > max &&
+           !m_max.compare_exchange_weak(max, v, std::memory_order_relaxed)) {
+    }
+  }
+
+  /**
+   * @brief 拷贝当前数据
+   */
+  void snapshot(Data &d) const;
+
+  /**
+   * @brief 清空数据
+   */
+  void reset();
+
+  /**
+   * @brief 返回样本所在的桶
+   */
+  static size_t Bucket(uint64_t v) {
+    return v ? 64 - __builtin_clzll(v) - (v >> 63) : 0;
+  }
+
+private:
+  /// 样本数量
+  std::atomic<uint64_t> m_count;
+  /// 样本总和
+  std::atomic<uint64_t> m_sum;
+  /// 最大样本
+  std::atomic<uint64_t> m_max;
+  /// 各桶的样本数量
+  std::atomic<uint64_t> m_buckets[BUCKETS];
+};
+
+} // namespace arvin
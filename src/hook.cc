@@ -0,0 +1,945 @@
+#include "hook.h"
+#include "config.h"
+#include "fd_manager.h"
+#include "fiber.h"
+#include "iomanager.h"
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+#include <algorithm>
+#include <dlfcn.h>
+#include <errno.h>
+#include <sstream>
+#include <stdarg.h>
+
+static arvin::Logger::ptr g_logger = ARVIN_LOG_NAME("system");
+
+namespace arvin {
+
+static arvin::ConfigVar<int>::ptr g_tcp_connect_timeout =
+    arvin::Config::Lookup("tcp.connect.timeout", 5000, "tcp connect timeout");
+
+/// 当前线程是否启用hook
+static thread_local bool t_hook_enable = false;
+
+#define HOOK_FUN(XX)                                                           \
+  XX(sleep)                                                                    \
+  XX(usleep)                                                                   \
+  XX(nanosleep)                                                                \
+  XX(socket)                                                                   \
+  XX(connect)                                                                  \
+  XX(accept)                                                                   \
+  XX(open)                                                                     \
+  XX(openat)                                                                   \
+  XX(read)                                                                     \
+  XX(pread)                                                                    \
+  XX(readv)                                                                    \
+  XX(recv)                                                                     \
+  XX(recvfrom)                                                                 \
+  XX(recvmsg)                                                                  \
+  XX(write)                                                                    \
+  XX(writev)                                                                   \
+  XX(pwrite)                                                                   \
+  XX(fsync)                                                                    \
+  XX(fdatasync)                                                                \
+  XX(send)                                                                     \
+  XX(sendto)                                                                   \
+  XX(sendmsg)                                                                  \
+  XX(sendfile)                                                                 \
+  XX(close)                                                                    \
+  XX(fcntl)                                                                    \
+  XX(ioctl)                                                                    \
+  XX(getsockopt)                                                               \
+  XX(setsockopt)
+
+/// hook函数编号
+enum HookFunc {
+#define XX(name) HOOK_##name,
+  HOOK_FUN(XX)
+#undef XX
+  HOOK_FUNC_COUNT
+};
+
+/// hook函数名
+static const char *s_hook_names[] = {
+#define XX(name) #name,
+    HOOK_FUN(XX)
+#undef XX
+};
+
+void hook_init() {
+  static bool is_inited = false;
+  if (is_inited) {
+    return;
+  }
+#define XX(name) name##_f = (name##_fun)dlsym(RTLD_NEXT, #name);
+  HOOK_FUN(XX);
+#undef XX
+  is_inited = true;
+}
+
+static uint64_t s_connect_timeout = -1;
+struct _HookIniter {
+  _HookIniter() {
+    hook_init();
+    s_connect_timeout = g_tcp_connect_timeout->getValue();
+
+    g_tcp_connect_timeout->addListener(
+        [](const int &old_value, const int &new_value) {
+          ARVIN_LOG_INFO(g_logger) << "tcp connect timeout changed from "
+                                   << old_value << " to " << new_value;
+          s_connect_timeout = new_value;
+        });
+  }
+};
+
+static _HookIniter s_hook_initer;
+
+bool is_hook_enable() { return t_hook_enable; }
+
+void set_hook_enable(bool flag) { t_hook_enable = flag; }
+
+uint64_t get_deadline_remaining() {
+  uint64_t deadline = Fiber::GetThis()->getDeadline();
+  if (deadline == ~0ull) {
+    return ~0ull;
+  }
+  uint64_t now = GetMonotonicMS();
+  return deadline > now ? deadline - now : 0;
+}
+
+DeadlineScope::DeadlineScope(uint64_t timeout_ms) {
+  Fiber::ptr fiber = Fiber::GetThis();
+  m_prev = fiber->getDeadline();
+  uint64_t now = GetMonotonicMS();
+  uint64_t deadline = timeout_ms >= ~0ull - now ? ~0ull : now + timeout_ms;
+  fiber->setDeadline(std::min(m_prev, deadline));
+}
+
+DeadlineScope::~DeadlineScope() { Fiber::GetThis()->setDeadline(m_prev); }
+
+void HookStatsData::merge(const HookStatsData &o) {
+  calls += o.calls;
+  yields += o.yields;
+  timeouts += o.timeouts;
+  blocked_us += o.blocked_us;
+}
+
+#if ARVIN_HOOK_STATS
+/// fd类型
+enum HookFdType { HOOK_FD_SOCKET, HOOK_FD_FILE, HOOK_FD_OTHER, HOOK_FD_COUNT };
+
+/// fd类型名
+static const char *s_fd_type_names[] = {"socket", "file", "other"};
+
+/**
+ * @brief 按(函数, fd类型)索引的统计表
+ */
+struct HookStatsTable {
+  HookStatsData data[HOOK_FUNC_COUNT][HOOK_FD_COUNT];
+};
+
+/**
+ * @brief 计数器, 只由所属线程写入, 其他线程只读
+ */
+struct HookCounter {
+  std::atomic<uint64_t> calls = {0};
+  std::atomic<uint64_t> yields = {0};
+  std::atomic<uint64_t> timeouts = {0};
+  std::atomic<uint64_t> blocked_us = {0};
+
+  /**
+   * @brief 单写者累加, 不需要原子的读改写
+   */
+  static void add(std::atomic<uint64_t> &c, uint64_t v) {
+    c.store(c.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+  }
+};
+
+struct HookThreadStats;
+
+/**
+ * @brief 所有线程的计数器, 线程退出时合并到retired
+ */
+struct HookStatsRegistry {
+  Mutex mutex;
+  std::vector<HookThreadStats *> threads;
+  HookStatsTable retired;
+};
+
+static HookStatsRegistry &GetHookStatsRegistry() {
+  static HookStatsRegistry s_registry;
+  return s_registry;
+}
+
+/**
+ * @brief 线程的hook计数器
+ */
+struct HookThreadStats {
+  HookCounter counters[HOOK_FUNC_COUNT][HOOK_FD_COUNT];
+
+  HookThreadStats() {
+    HookStatsRegistry &registry = GetHookStatsRegistry();
+    Mutex::Lock lock(registry.mutex);
+    registry.threads.push_back(this);
+  }
+
+  ~HookThreadStats() {
+    HookStatsRegistry &registry = GetHookStatsRegistry();
+    Mutex::Lock lock(registry.mutex);
+    snapshot(registry.retired);
+    registry.threads.erase(
+        std::remove(registry.threads.begin(), registry.threads.end(), this),
+        registry.threads.end());
+  }
+
+  /**
+   * @brief 累加到table
+   */
+  void snapshot(HookStatsTable &table) const {
+    for (size_t i = 0; i < HOOK_FUNC_COUNT; ++i) {
+      for (size_t j = 0; j < HOOK_FD_COUNT; ++j) {
+        const HookCounter &c = counters[i][j];
+        HookStatsData &d = table.data[i][j];
+        d.calls += c.calls.load(std::memory_order_relaxed);
+        d.yields += c.yields.load(std::memory_order_relaxed);
+        d.timeouts += c.timeouts.load(std::memory_order_relaxed);
+        d.blocked_us += c.blocked_us.load(std::memory_order_relaxed);
+      }
+    }
+  }
+};
+
+static thread_local HookThreadStats t_hook_stats;
+
+/**
+ * @brief 当前线程上(函数, fd类型)的计数器
+ * @attention 协程挂起后可能在其他线程恢复, 不能跨挂起持有返回值
+ */
+static HookCounter &hook_counter(HookFunc func, const FdCtx *ctx) {
+  HookFdType type = HOOK_FD_OTHER;
+  if (ctx && ctx->isSocket()) {
+    type = HOOK_FD_SOCKET;
+  } else if (ctx && ctx->isFile()) {
+    type = HOOK_FD_FILE;
+  }
+  return t_hook_stats.counters[func][type];
+}
+
+static void hook_stat_call(HookFunc func, const FdCtx *ctx) {
+  HookCounter::add(hook_counter(func, ctx).calls, 1);
+}
+
+static void hook_stat_timeout(HookFunc func, const FdCtx *ctx) {
+  HookCounter::add(hook_counter(func, ctx).timeouts, 1);
+}
+
+/**
+ * @brief 记录一次从start_us开始的挂起等待
+ */
+static void hook_stat_wait(HookFunc func, const FdCtx *ctx, uint64_t start_us) {
+  HookCounter &c = hook_counter(func, ctx);
+  HookCounter::add(c.yields, 1);
+  HookCounter::add(c.blocked_us, GetMonotonicUS() - start_us);
+}
+#endif
+
+void get_hook_stats(std::map<std::string, HookStatsData> &stats) {
+#if ARVIN_HOOK_STATS
+  HookStatsRegistry &registry = GetHookStatsRegistry();
+  HookStatsTable table;
+  {
+    Mutex::Lock lock(registry.mutex);
+    table = registry.retired;
+    for (auto i : registry.threads) {
+      i->snapshot(table);
+    }
+  }
+  for (size_t i = 0; i < HOOK_FUNC_COUNT; ++i) {
+    for (size_t j = 0; j < HOOK_FD_COUNT; ++j) {
+      if (table.data[i][j].calls) {
+        stats[std::string(s_hook_names[i]) + "/" + s_fd_type_names[j]].merge(
+            table.data[i][j]);
+      }
+    }
+  }
+#endif
+}
+
+std::ostream &dump_hook_stats(std::ostream &os) {
+  std::map<std::string, HookStatsData> stats;
+  get_hook_stats(stats);
+  os << "[HookStats]";
+  for (auto &i : stats) {
+    const HookStatsData &d = i.second;
+    os << std::endl
+       << "    " << i.first << " calls=" << d.calls << " yields=" << d.yields
+       << " timeouts=" << d.timeouts << " blocked_us=" << d.blocked_us
+       << " avg_blocked_us=" << (d.yields ? d.blocked_us / d.yields : 0);
+  }
+  return os;
+}
+
+std::shared_ptr<Timer> start_hook_stats_dump(IOManager *iom,
+                                             uint64_t interval_ms,
+                                             std::shared_ptr<Logger> logger) {
+#if ARVIN_HOOK_STATS
+  if (!logger) {
+    logger = g_logger;
+  }
+  return iom->addTimer(
+      interval_ms,
+      [logger]() {
+        std::stringstream ss;
+        dump_hook_stats(ss);
+        ARVIN_LOG_INFO(logger) << ss.str();
+      },
+      true);
+#else
+  return nullptr;
+#endif
+}
+
+} // namespace arvin
+
+/**
+ * @brief 等待超时的标记, 由超时定时器与等待的协程共享
+ */
+struct timer_info {
+  int cancelled = 0;
+};
+
+/**
+ * @brief 用当前协程的剩余时间收紧本次等待的超时
+ * @return 截止时间已到返回false
+ */
+static bool apply_deadline(uint64_t &timeout) {
+  uint64_t remain = arvin::get_deadline_remaining();
+  if (remain == 0) {
+    return false;
+  }
+  timeout = std::min(timeout, remain);
+  return true;
+}
+
+/**
+ * @brief 没有对应的io_uring操作
+ */
+struct no_uring {
+  ssize_t operator()() const { return -ENOSYS; }
+};
+
+/**
+ * @brief 普通文件IO: 优先提交uring_op, 否则交给阻塞IO线程池, 当前协程挂起
+ * @details 都不可用(不在协程中、队列已满)时在当前线程直接调用
+ */
+template <typename OriginFun, typename UringOp, typename... Args>
+static ssize_t file_io(arvin::IOManager *iom, arvin::FdCtx *ctx,
+                       arvin::HookFunc func, int fd, OriginFun fun,
+                       UringOp uring_op, Args &&...args) {
+  ARVIN_HOOK_STATS_ONLY(uint64_t wait_start = arvin::GetMonotonicUS();)
+  if (iom->isUring()) {
+    ssize_t rt = uring_op();
+    if (rt != -ENOSYS) {
+      ARVIN_HOOK_STATS_ONLY(arvin::hook_stat_wait(func, ctx, wait_start);)
+      if (rt < 0) {
+        errno = -rt;
+        return -1;
+      }
+      return rt;
+    }
+  }
+
+  ssize_t n = -1;
+  int error = 0;
+  bool offloaded = iom->runBlocking([&]() {
+    do {
+      n = fun(fd, args...);
+    } while (n == -1 && errno == EINTR);
+    error = errno;
+  });
+  if (!offloaded) {
+    return fun(fd, std::forward<Args>(args)...);
+  }
+  ARVIN_HOOK_STATS_ONLY(arvin::hook_stat_wait(func, ctx, wait_start);)
+  if (n == -1) {
+    errno = error;
+  }
+  return n;
+}
+
+/**
+ * @brief 只对普通文件有意义的调用(pread/pwrite/fsync), 其他fd直接调用
+ */
+template <typename OriginFun, typename UringOp, typename... Args>
+static ssize_t do_file_io(int fd, OriginFun fun, arvin::HookFunc func,
+                          UringOp uring_op, Args &&...args) {
+  if (!arvin::t_hook_enable) {
+    return fun(fd, std::forward<Args>(args)...);
+  }
+  arvin::IOManager *iom = arvin::IOManager::GetThis();
+  arvin::FdCtx *ctx = arvin::FdMgr::GetInstance()->get(fd);
+  if (!iom || !ctx || ctx->isClose() || !ctx->isFile()) {
+    return fun(fd, std::forward<Args>(args)...);
+  }
+  ARVIN_HOOK_STATS_ONLY(arvin::hook_stat_call(func, ctx);)
+  return file_io(iom, ctx, func, fd, fun, uring_op,
+                 std::forward<Args>(args)...);
+}
+
+/**
+ * @brief 把阻塞的socket IO变成协程等待
+ * @details 普通文件交给file_io. socket先直接调用, EAGAIN时注册事件并挂起
+ *          当前协程, 就绪后重试.
+ *          设置了SO_RCVTIMEO/SO_SNDTIMEO或协程截止时间(DeadlineScope)时
+ *          用条件定时器取消等待, 返回ETIMEDOUT.
+ *          未设置超时且启用io_uring时改为提交uring_op, 省去就绪后的重试;
+ *          uring_op返回-ENOSYS时退回事件等待
+ */
+template <typename OriginFun, typename UringOp, typename... Args>
+static ssize_t do_io(int fd, OriginFun fun, arvin::HookFunc func,
+                     uint32_t event, int timeout_so, UringOp uring_op,
+                     Args &&...args) {
+  if (!arvin::t_hook_enable) {
+    return fun(fd, std::forward<Args>(args)...);
+  }
+
+  arvin::IOManager *iom = arvin::IOManager::GetThis();
+  arvin::FdCtx *ctx = arvin::FdMgr::GetInstance()->get(fd);
+  if (!iom || !ctx) {
+    return fun(fd, std::forward<Args>(args)...);
+  }
+  ARVIN_HOOK_STATS_ONLY(arvin::hook_stat_call(func, ctx);)
+
+  if (ctx->isClose()) {
+    errno = EBADF;
+    return -1;
+  }
+
+  if (ctx->isFile()) {
+    return file_io(iom, ctx, func, fd, fun, uring_op,
+                   std::forward<Args>(args)...);
+  }
+
+  if (!ctx->isSocket() || ctx->getUserNonblock()) {
+    return fun(fd, std::forward<Args>(args)...);
+  }
+
+  uint64_t to = ctx->getTimeout(timeout_so);
+  if (!apply_deadline(to)) {
+    ARVIN_HOOK_STATS_ONLY(arvin::hook_stat_timeout(func, ctx);)
+    errno = ETIMEDOUT;
+    return -1;
+  }
+  std::shared_ptr<timer_info> tinfo;
+
+retry:
+  ssize_t n = fun(fd, std::forward<Args>(args)...);
+  while (n == -1 && errno == EINTR) {
+    n = fun(fd, std::forward<Args>(args)...);
+  }
+  if (n == -1 && errno == EAGAIN) {
+    // 每次等待都按协程截止时间重新计算, 重试不会得到新的完整超时
+    to = ctx->getTimeout(timeout_so);
+    if (!apply_deadline(to)) {
+      ARVIN_HOOK_STATS_ONLY(arvin::hook_stat_timeout(func, ctx);)
+      errno = ETIMEDOUT;
+      return -1;
+    }
+    ARVIN_HOOK_STATS_ONLY(uint64_t wait_start = arvin::GetMonotonicUS();)
+    if (to == (uint64_t)-1 && iom->isUring()) {
+      ssize_t rt = uring_op();
+      if (rt != -ENOSYS) {
+        ARVIN_HOOK_STATS_ONLY(arvin::hook_stat_wait(func, ctx, wait_start);)
+        if (rt < 0) {
+          errno = -rt;
+          return -1;
+        }
+        return rt;
+      }
+    }
+
+    arvin::Timer::ptr timer;
+    if (to != (uint64_t)-1) {
+      if (!tinfo) {
+        tinfo.reset(new timer_info);
+      }
+      std::weak_ptr<timer_info> winfo(tinfo);
+      timer = iom->addConditionTimer(
+          to,
+          [winfo, fd, iom, event]() {
+            auto t = winfo.lock();
+            if (!t || t->cancelled) {
+              return;
+            }
+            t->cancelled = ETIMEDOUT;
+            iom->cancelEvent(fd, (arvin::IOManager::Event)(event));
+          },
+          winfo);
+    }
+
+    int rt = iom->addEvent(fd, (arvin::IOManager::Event)(event));
+    if (ARVIN_UNLIKELY(rt)) {
+      ARVIN_LOG_ERROR(g_logger)
+          << arvin::s_hook_names[func] << " addEvent(" << fd << ", " << event
+          << ")";
+      if (timer) {
+        timer->cancel();
+      }
+      return -1;
+    }
+    arvin::Fiber::YieldToHold();
+    ARVIN_HOOK_STATS_ONLY(arvin::hook_stat_wait(func, ctx, wait_start);)
+    if (timer) {
+      timer->cancel();
+    }
+    if (tinfo && tinfo->cancelled) {
+      ARVIN_HOOK_STATS_ONLY(arvin::hook_stat_timeout(func, ctx);)
+      errno = tinfo->cancelled;
+      return -1;
+    }
+    goto retry;
+  }
+
+  // 同一连接连续读取太多次时让出, 避免饿死同一线程上的其他连接
+  if (n > 0 && event == arvin::IOManager::READ && iom->chargeRead(fd)) {
+    arvin::Fiber::YieldToReady();
+  }
+  return n;
+}
+
+/**
+ * @brief 挂起当前协程ms毫秒
+ * @return 不能挂起(不在IOManager的协程中)时返回false
+ */
+static bool fiber_sleep(arvin::HookFunc func, uint64_t ms) {
+  arvin::IOManager *iom = arvin::IOManager::GetThis();
+  if (!iom) {
+    return false;
+  }
+  ARVIN_HOOK_STATS_ONLY(arvin::hook_stat_call(func, nullptr);
+                        uint64_t wait_start = arvin::GetMonotonicUS();)
+  arvin::Fiber::ptr fiber = arvin::Fiber::GetThis();
+  // 分片模式下回到原线程继续执行
+  int thread = iom->isSharded() ? arvin::GetThreadId() : -1;
+  iom->addTimerHandle(ms, [iom, fiber, thread]() {
+    iom->schedule(fiber, thread);
+  });
+  arvin::Fiber::YieldToHold();
+  ARVIN_HOOK_STATS_ONLY(arvin::hook_stat_wait(func, nullptr, wait_start);)
+  return true;
+}
+
+extern "C" {
+#define XX(name) name##_fun name##_f = nullptr;
+HOOK_FUN(XX);
+#undef XX
+
+unsigned int sleep(unsigned int seconds) {
+  if (!arvin::t_hook_enable || !fiber_sleep(arvin::HOOK_sleep, seconds * 1000ull)) {
+    return sleep_f(seconds);
+  }
+  return 0;
+}
+
+int usleep(useconds_t usec) {
+  if (!arvin::t_hook_enable || !fiber_sleep(arvin::HOOK_usleep, usec / 1000)) {
+    return usleep_f(usec);
+  }
+  return 0;
+}
+
+int nanosleep(const struct timespec *req, struct timespec *rem) {
+  if (!arvin::t_hook_enable || !req ||
+      !fiber_sleep(arvin::HOOK_nanosleep,
+                   req->tv_sec * 1000ull + req->tv_nsec / 1000 / 1000)) {
+    return nanosleep_f(req, rem);
+  }
+  return 0;
+}
+
+int socket(int domain, int type, int protocol) {
+  if (!arvin::t_hook_enable) {
+    return socket_f(domain, type, protocol);
+  }
+  int fd = socket_f(domain, type, protocol);
+  if (fd == -1) {
+    return fd;
+  }
+  arvin::FdMgr::GetInstance()->get(fd, true);
+  return fd;
+}
+
+int connect_with_timeout(int fd, const struct sockaddr *addr,
+                         socklen_t addrlen, uint64_t timeout_ms) {
+  if (!arvin::t_hook_enable) {
+    return connect_f(fd, addr, addrlen);
+  }
+  arvin::IOManager *iom = arvin::IOManager::GetThis();
+  arvin::FdCtx *ctx = arvin::FdMgr::GetInstance()->get(fd);
+  if (!iom || !ctx || ctx->isClose()) {
+    errno = EBADF;
+    return -1;
+  }
+
+  if (!ctx->isSocket() || ctx->getUserNonblock()) {
+    return connect_f(fd, addr, addrlen);
+  }
+  ARVIN_HOOK_STATS_ONLY(arvin::hook_stat_call(arvin::HOOK_connect, ctx);)
+
+  if (!apply_deadline(timeout_ms)) {
+    ARVIN_HOOK_STATS_ONLY(arvin::hook_stat_timeout(arvin::HOOK_connect, ctx);)
+    errno = ETIMEDOUT;
+    return -1;
+  }
+
+  int n = connect_f(fd, addr, addrlen);
+  if (n == 0) {
+    return 0;
+  } else if (n != -1 || errno != EINPROGRESS) {
+    return n;
+  }
+
+  std::shared_ptr<timer_info> tinfo(new timer_info);
+  std::weak_ptr<timer_info> winfo(tinfo);
+  arvin::Timer::ptr timer;
+
+  if (timeout_ms != (uint64_t)-1) {
+    timer = iom->addConditionTimer(
+        timeout_ms,
+        [winfo, fd, iom]() {
+          auto t = winfo.lock();
+          if (!t || t->cancelled) {
+            return;
+          }
+          t->cancelled = ETIMEDOUT;
+          iom->cancelEvent(fd, arvin::IOManager::WRITE);
+        },
+        winfo);
+  }
+
+  ARVIN_HOOK_STATS_ONLY(uint64_t wait_start = arvin::GetMonotonicUS();)
+  int rt = iom->addEvent(fd, arvin::IOManager::WRITE);
+  if (rt == 0) {
+    arvin::Fiber::YieldToHold();
+    ARVIN_HOOK_STATS_ONLY(
+        arvin::hook_stat_wait(arvin::HOOK_connect, ctx, wait_start);)
+    if (timer) {
+      timer->cancel();
+    }
+    if (tinfo->cancelled) {
+      ARVIN_HOOK_STATS_ONLY(
+          arvin::hook_stat_timeout(arvin::HOOK_connect, ctx);)
+      errno = tinfo->cancelled;
+      return -1;
+    }
+  } else {
+    if (timer) {
+      timer->cancel();
+    }
+    ARVIN_LOG_ERROR(g_logger) << "connect addEvent(" << fd << ", WRITE) error";
+  }
+
+  int error = 0;
+  socklen_t len = sizeof(int);
+  if (-1 == getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len)) {
+    return -1;
+  }
+  if (!error) {
+    return 0;
+  } else {
+    errno = error;
+    return -1;
+  }
+}
+
+int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
+  return connect_with_timeout(sockfd, addr, addrlen, arvin::s_connect_timeout);
+}
+
+int accept(int s, struct sockaddr *addr, socklen_t *addrlen) {
+  int fd = do_io(
+      s, accept_f, arvin::HOOK_accept, arvin::IOManager::READ, SO_RCVTIMEO,
+      [s, addr, addrlen]() -> ssize_t {
+        return arvin::IOManager::GetThis()->uringAccept(s, addr, addrlen);
+      },
+      addr, addrlen);
+  if (fd >= 0) {
+    arvin::FdMgr::GetInstance()->get(fd, true);
+  }
+  return fd;
+}
+
+/**
+ * @brief open/openat得到的普通文件登记到FdMgr, 之后的读写才会被卸载
+ */
+static int register_fd(int fd) {
+  if (fd >= 0 && arvin::t_hook_enable) {
+    arvin::FdMgr::GetInstance()->get(fd, true);
+  }
+  return fd;
+}
+
+int open(const char *pathname, int flags, ...) {
+  mode_t mode = 0;
+  if (flags & (O_CREAT | O_TMPFILE)) {
+    va_list va;
+    va_start(va, flags);
+    mode = va_arg(va, mode_t);
+    va_end(va);
+  }
+  return register_fd(open_f(pathname, flags, mode));
+}
+
+int openat(int dirfd, const char *pathname, int flags, ...) {
+  mode_t mode = 0;
+  if (flags & (O_CREAT | O_TMPFILE)) {
+    va_list va;
+    va_start(va, flags);
+    mode = va_arg(va, mode_t);
+    va_end(va);
+  }
+  return register_fd(openat_f(dirfd, pathname, flags, mode));
+}
+
+ssize_t read(int fd, void *buf, size_t count) {
+  return do_io(
+      fd, read_f, arvin::HOOK_read, arvin::IOManager::READ, SO_RCVTIMEO,
+      [fd, buf, count]() {
+        return arvin::IOManager::GetThis()->uringRead(fd, buf, count);
+      },
+      buf, count);
+}
+
+ssize_t pread(int fd, void *buf, size_t count, off_t offset) {
+  return do_file_io(
+      fd, pread_f, arvin::HOOK_pread,
+      [fd, buf, count, offset]() {
+        return arvin::IOManager::GetThis()->uringRead(fd, buf, count, offset);
+      },
+      buf, count, offset);
+}
+
+ssize_t readv(int fd, const struct iovec *iov, int iovcnt) {
+  return do_io(fd, readv_f, arvin::HOOK_readv, arvin::IOManager::READ,
+               SO_RCVTIMEO, no_uring(), iov, iovcnt);
+}
+
+ssize_t recv(int sockfd, void *buf, size_t len, int flags) {
+  return do_io(sockfd, recv_f, arvin::HOOK_recv, arvin::IOManager::READ,
+               SO_RCVTIMEO, no_uring(), buf, len, flags);
+}
+
+ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags,
+                 struct sockaddr *src_addr, socklen_t *addrlen) {
+  return do_io(sockfd, recvfrom_f, arvin::HOOK_recvfrom,
+               arvin::IOManager::READ, SO_RCVTIMEO, no_uring(), buf, len, flags,
+               src_addr, addrlen);
+}
+
+ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) {
+  return do_io(
+      sockfd, recvmsg_f, arvin::HOOK_recvmsg, arvin::IOManager::READ,
+      SO_RCVTIMEO,
+      [sockfd, msg, flags]() {
+        return arvin::IOManager::GetThis()->uringRecvmsg(sockfd, msg, flags);
+      },
+      msg, flags);
+}
+
+ssize_t write(int fd, const void *buf, size_t count) {
+  return do_io(
+      fd, write_f, arvin::HOOK_write, arvin::IOManager::WRITE, SO_SNDTIMEO,
+      [fd, buf, count]() {
+        return arvin::IOManager::GetThis()->uringWrite(fd, buf, count);
+      },
+      buf, count);
+}
+
+ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
+  return do_io(fd, writev_f, arvin::HOOK_writev, arvin::IOManager::WRITE,
+               SO_SNDTIMEO, no_uring(), iov, iovcnt);
+}
+
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset) {
+  return do_file_io(
+      fd, pwrite_f, arvin::HOOK_pwrite,
+      [fd, buf, count, offset]() {
+        return arvin::IOManager::GetThis()->uringWrite(fd, buf, count, offset);
+      },
+      buf, count, offset);
+}
+
+int fsync(int fd) {
+  return do_file_io(fd, fsync_f, arvin::HOOK_fsync, [fd]() -> ssize_t {
+    return arvin::IOManager::GetThis()->uringFsync(fd);
+  });
+}
+
+int fdatasync(int fd) {
+  return do_file_io(fd, fdatasync_f, arvin::HOOK_fdatasync,
+                    [fd]() -> ssize_t {
+                      return arvin::IOManager::GetThis()->uringFsync(fd, true);
+                    });
+}
+
+ssize_t send(int s, const void *msg, size_t len, int flags) {
+  return do_io(s, send_f, arvin::HOOK_send, arvin::IOManager::WRITE,
+               SO_SNDTIMEO, no_uring(), msg, len, flags);
+}
+
+ssize_t sendto(int s, const void *msg, size_t len, int flags,
+               const struct sockaddr *to, socklen_t tolen) {
+  return do_io(s, sendto_f, arvin::HOOK_sendto, arvin::IOManager::WRITE,
+               SO_SNDTIMEO, no_uring(), msg, len, flags, to, tolen);
+}
+
+ssize_t sendmsg(int s, const struct msghdr *msg, int flags) {
+  return do_io(
+      s, sendmsg_f, arvin::HOOK_sendmsg, arvin::IOManager::WRITE,
+      SO_SNDTIMEO,
+      [s, msg, flags]() {
+        return arvin::IOManager::GetThis()->uringSendmsg(s, msg, flags);
+      },
+      msg, flags);
+}
+
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
+  return do_io(out_fd, sendfile_f, arvin::HOOK_sendfile,
+               arvin::IOManager::WRITE, SO_SNDTIMEO, no_uring(), in_fd, offset,
+               count);
+}
+
+int close(int fd) {
+  if (!arvin::t_hook_enable) {
+    return close_f(fd);
+  }
+
+  // 关闭前必须移出epoll, 否则复用该fd时不会重新注册
+  arvin::IOManager *iom = arvin::IOManager::GetThis();
+  if (iom) {
+    iom->cancelAll(fd);
+  }
+  arvin::FdCtx *ctx = arvin::FdMgr::GetInstance()->get(fd);
+  if (ctx) {
+    arvin::FdMgr::GetInstance()->del(fd);
+  }
+  return close_f(fd);
+}
+
+int fcntl(int fd, int cmd, ... /* arg */) {
+  va_list va;
+  va_start(va, cmd);
+  switch (cmd) {
+  case F_SETFL: {
+    int arg = va_arg(va, int);
+    va_end(va);
+    arvin::FdCtx *ctx = arvin::FdMgr::GetInstance()->get(fd);
+    if (!ctx || ctx->isClose() || !ctx->isSocket()) {
+      return fcntl_f(fd, cmd, arg);
+    }
+    ctx->setUserNonblock(arg & O_NONBLOCK);
+    if (ctx->getSysNonblock()) {
+      arg |= O_NONBLOCK;
+    } else {
+      arg &= ~O_NONBLOCK;
+    }
+    return fcntl_f(fd, cmd, arg);
+  } break;
+  case F_GETFL: {
+    va_end(va);
+    int arg = fcntl_f(fd, cmd);
+    arvin::FdCtx *ctx = arvin::FdMgr::GetInstance()->get(fd);
+    if (!ctx || ctx->isClose() || !ctx->isSocket()) {
+      return arg;
+    }
+    if (ctx->getUserNonblock()) {
+      return arg | O_NONBLOCK;
+    } else {
+      return arg & ~O_NONBLOCK;
+    }
+  } break;
+  case F_DUPFD:
+  case F_DUPFD_CLOEXEC:
+  case F_SETFD:
+  case F_SETOWN:
+  case F_SETSIG:
+  case F_SETLEASE:
+  case F_NOTIFY:
+#ifdef F_SETPIPE_SZ
+  case F_SETPIPE_SZ:
+#endif
+  {
+    int arg = va_arg(va, int);
+    va_end(va);
+    return fcntl_f(fd, cmd, arg);
+  } break;
+  case F_GETFD:
+  case F_GETOWN:
+  case F_GETSIG:
+  case F_GETLEASE:
+#ifdef F_GETPIPE_SZ
+  case F_GETPIPE_SZ:
+#endif
+  {
+    va_end(va);
+    return fcntl_f(fd, cmd);
+  } break;
+  case F_SETLK:
+  case F_SETLKW:
+  case F_GETLK: {
+    struct flock *arg = va_arg(va, struct flock *);
+    va_end(va);
+    return fcntl_f(fd, cmd, arg);
+  } break;
+  case F_GETOWN_EX:
+  case F_SETOWN_EX: {
+    struct f_owner_exlock *arg = va_arg(va, struct f_owner_exlock *);
+    va_end(va);
+    return fcntl_f(fd, cmd, arg);
+  } break;
+  default:
+    va_end(va);
+    return fcntl_f(fd, cmd);
+  }
+}
+
+int ioctl(int d, unsigned long int request, ...) {
+  va_list va;
+  va_start(va, request);
+  void *arg = va_arg(va, void *);
+  va_end(va);
+
+  if (FIONBIO == request) {
+    bool user_nonblock = !!*(int *)arg;
+    arvin::FdCtx *ctx = arvin::FdMgr::GetInstance()->get(d);
+    if (!ctx || ctx->isClose() || !ctx->isSocket()) {
+      return ioctl_f(d, request, arg);
+    }
+    ctx->setUserNonblock(user_nonblock);
+  }
+  return ioctl_f(d, request, arg);
+}
+
+int getsockopt(int sockfd, int level, int optname, void *optval,
+               socklen_t *optlen) {
+  return getsockopt_f(sockfd, level, optname, optval, optlen);
+}
+
+int setsockopt(int sockfd, int level, int optname, const void *optval,
+               socklen_t optlen) {
+  if (!arvin::t_hook_enable) {
+    return setsockopt_f(sockfd, level, optname, optval, optlen);
+  }
+  if (level == SOL_SOCKET) {
+    if (optname == SO_RCVTIMEO || optname == SO_SNDTIMEO) {
+      arvin::FdCtx *ctx = arvin::FdMgr::GetInstance()->get(sockfd);
+      if (ctx) {
+        const timeval *v = (const timeval *)optval;
+        ctx->setTimeout(optname, v->tv_sec * 1000 + v->tv_usec / 1000);
+      }
+    }
+  }
+  return setsockopt_f(sockfd, level, optname, optval, optlen);
+}
+}
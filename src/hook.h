@@ -2,13 +2,32 @@
 
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#include <sys/sendfile.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <stdint.h>
 #include <time.h>
 #include <unistd.h>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+
+/**
+ * @brief hook统计开关
+ * @details 由cmake选项ARVIN_HOOK_STATS打开; 关闭时统计语句不参与编译
+ */
+#if ARVIN_HOOK_STATS
+#define ARVIN_HOOK_STATS_ONLY(...) __VA_ARGS__
+#else
+#define ARVIN_HOOK_STATS_ONLY(...)
+#endif
+
+namespace arvin {
+    class IOManager;
+    class Logger;
+    class Timer;
 
-namespace sylar {
     /**
      * @brief 当前线程是否hook
      */
@@ -17,6 +36,75 @@ namespace sylar {
      * @brief 设置当前线程的hook状态
      */
     void set_hook_enable(bool flag);
+
+    /**
+     * @brief 当前协程距截止时间的剩余毫秒数
+     * @return 没有截止时间返回~0ull, 已到期返回0
+     */
+    uint64_t get_deadline_remaining();
+
+    /**
+     * @brief 单个hook函数在一种fd类型上的统计
+     */
+    struct HookStatsData {
+        /// hook生效的调用次数
+        uint64_t calls = 0;
+        /// 挂起等待的次数(EAGAIN、io_uring、阻塞IO线程池、sleep)
+        uint64_t yields = 0;
+        /// 返回ETIMEDOUT的次数
+        uint64_t timeouts = 0;
+        /// 挂起等待的总时间(微秒)
+        uint64_t blocked_us = 0;
+
+        /**
+         * @brief 合并另一份统计
+         */
+        void merge(const HookStatsData& o);
+    };
+
+    /**
+     * @brief 获取hook统计快照, 所有线程(含已退出线程)的合计
+     * @details 需开启ARVIN_HOOK_STATS, 否则为空
+     * @param[out] stats 键为"函数名/fd类型", fd类型为socket, file或other
+     */
+    void get_hook_stats(std::map<std::string, HookStatsData>& stats);
+
+    /**
+     * @brief 输出hook统计
+     */
+    std::ostream& dump_hook_stats(std::ostream& os);
+
+    /**
+     * @brief 在iom上添加循环定时器, 每interval_ms毫秒把hook统计输出到logger
+     * @param[in] logger 为空时输出到system日志
+     * @return 定时器, cancel后停止输出; 未开启ARVIN_HOOK_STATS时返回nullptr
+     */
+    std::shared_ptr<Timer> start_hook_stats_dump(IOManager* iom, uint64_t interval_ms,
+                                                 std::shared_ptr<Logger> logger = nullptr);
+
+    /**
+     * @brief 协程截止时间作用域
+     * @details 构造时把当前协程的截止时间收紧到timeout_ms毫秒之后
+     *          (外层已有更早的截止时间时保留外层), 析构时恢复.
+     *          作用域内hook的socket IO与connect以剩余时间作为超时,
+     *          到期后返回-1且errno为ETIMEDOUT
+     */
+    class DeadlineScope {
+    public:
+        /**
+         * @brief 构造函数
+         * @param[in] timeout_ms 从现在起的毫秒数
+         */
+        DeadlineScope(uint64_t timeout_ms);
+
+        /**
+         * @brief 析构函数, 恢复外层的截止时间
+         */
+        ~DeadlineScope();
+    private:
+        /// 外层的截止时间
+        uint64_t m_prev;
+    };
 }
 
 extern "C" {
@@ -41,10 +129,20 @@ extern connect_fun connect_f;
 typedef int (*accept_fun)(int s, struct sockaddr *addr, socklen_t *addrlen);
 extern accept_fun accept_f;
 
+//file
+typedef int (*open_fun)(const char *pathname, int flags, ...);
+extern open_fun open_f;
+
+typedef int (*openat_fun)(int dirfd, const char *pathname, int flags, ...);
+extern openat_fun openat_f;
+
 //read
 typedef ssize_t (*read_fun)(int fd, void *buf, size_t count);
 extern read_fun read_f;
 
+typedef ssize_t (*pread_fun)(int fd, void *buf, size_t count, off_t offset);
+extern pread_fun pread_f;
+
 typedef ssize_t (*readv_fun)(int fd, const struct iovec *iov, int iovcnt);
 extern readv_fun readv_f;
 
@@ -64,6 +162,15 @@ extern write_fun write_f;
 typedef ssize_t (*writev_fun)(int fd, const struct iovec *iov, int iovcnt);
 extern writev_fun writev_f;
 
+typedef ssize_t (*pwrite_fun)(int fd, const void *buf, size_t count, off_t offset);
+extern pwrite_fun pwrite_f;
+
+typedef int (*fsync_fun)(int fd);
+extern fsync_fun fsync_f;
+
+typedef int (*fdatasync_fun)(int fd);
+extern fdatasync_fun fdatasync_f;
+
 typedef ssize_t (*send_fun)(int s, const void *msg, size_t len, int flags);
 extern send_fun send_f;
 
@@ -73,6 +180,9 @@ extern sendto_fun sendto_f;
 typedef ssize_t (*sendmsg_fun)(int s, const struct msghdr *msg, int flags);
 extern sendmsg_fun sendmsg_f;
 
+typedef ssize_t (*sendfile_fun)(int out_fd, int in_fd, off_t *offset, size_t count);
+extern sendfile_fun sendfile_f;
+
 typedef int (*close_fun)(int fd);
 extern close_fun close_f;
 
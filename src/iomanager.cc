@@ -1,12 +1,33 @@
 #include "iomanager.h"
+#include "blocking_pool.h"
+#include "config.h"
 #include "log.h"
 #include "macro.h"
-#include <fcntl.h>     // for fcntl()
-#include <sys/epoll.h> // for epoll_xxx()
-#include <unistd.h>    // for pipe()
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/epoll.h>   // for epoll_xxx()
+#include <sys/eventfd.h> // for eventfd()
+#include <unistd.h>
 
 namespace arvin {
 static arvin::Logger::ptr g_logger = ARVIN_LOG_NAME("system");
+
+static ConfigVar<uint32_t>::ptr g_epoll_batch_size = Config::Lookup<uint32_t>(
+    "iomanager.epoll.batch_size", 256,
+    "iomanager max events harvested per epoll_wait");
+static ConfigVar<std::string>::ptr g_backend = Config::Lookup<std::string>(
+    "iomanager.backend", "epoll",
+    "iomanager backend epoll or io_uring, io_uring falls back to epoll");
+static ConfigVar<uint32_t>::ptr g_uring_entries = Config::Lookup<uint32_t>(
+    "iomanager.uring.entries", 256, "iomanager io_uring submission queue size");
+static ConfigVar<int>::ptr g_shard_policy = Config::Lookup<int>(
+    "iomanager.shard.policy", 0,
+    "sharded iomanager fd placement 0:local 1:hash 2:least_load");
+static ConfigVar<uint32_t>::ptr g_read_budget = Config::Lookup<uint32_t>(
+    "iomanager.read_budget", 16,
+    "iomanager back-to-back reads on one fd before the reader yields");
 enum EpollCtlOp {};
 static std::ostream &operator<<(std::ostream &os, const EpollCtlOp &op) {
   switch ((int)op) {
@@ -59,12 +80,899 @@ IOManager::FdContext::getContext(IOManager::Event event) {
     return read;
   case IOManager::WRITE:
     return write;
+  case IOManager::PRI:
+    return pri;
   default:
-    //ARVIN_ASSERT2(false, "getContext");
+    ARVIN_ASSERT2(false, "getContext");
   }
   throw std::invalid_argument("getContext invalid event");
 }
 
+void IOManager::FdContext::resetContext(EventContext &ctx) {
+  ctx.scheduler = nullptr;
+  ctx.fiber.reset();
+  ctx.cb = nullptr;
+}
+
+bool IOManager::FdContext::takeWaiter(EventContext &ctx) {
+  int state = EventContext::WAITING;
+  return ctx.state.compare_exchange_strong(state, EventContext::BUSY,
+                                           std::memory_order_acquire);
+}
+
+void IOManager::FdContext::dispatch(EventContext &ctx,
+                                    std::vector<FiberAndThread> *batch,
+                                    int thread) {
+  Scheduler *scheduler = ctx.scheduler;
+  ctx.scheduler = nullptr;
+  if (batch && scheduler == Scheduler::GetThis()) {
+    if (ctx.cb) {
+      batch->emplace_back(&ctx.cb, thread);
+    } else {
+      batch->emplace_back(&ctx.fiber, thread);
+    }
+    ctx.state.store(EventContext::IDLE, std::memory_order_release);
+    return;
+  }
+  // 先取出再置IDLE, 之后同一方向可以立即注册新的等待者
+  std::function<void()> cb;
+  Fiber::ptr fiber;
+  cb.swap(ctx.cb);
+  fiber.swap(ctx.fiber);
+  ctx.state.store(EventContext::IDLE, std::memory_order_release);
+  if (cb) {
+    scheduler->schedule(&cb);
+  } else {
+    scheduler->schedule(&fiber);
+  }
+}
+
+bool IOManager::FdContext::triggerEvent(IOManager::Event event,
+                                        std::vector<FiberAndThread> *batch,
+                                        int thread) {
+  EventContext &ctx = getContext(event);
+  int state = ctx.state.load(std::memory_order_acquire);
+  while (true) {
+    if (state == EventContext::WAITING) {
+      if (takeWaiter(ctx)) {
+        dispatch(ctx, batch, thread);
+        return true;
+      }
+    } else if (state == EventContext::IDLE) {
+      if (ctx.state.compare_exchange_weak(state, EventContext::READY,
+                                          std::memory_order_release)) {
+        return false;
+      }
+      continue;
+    } else if (state == EventContext::READY) {
+      return false;
+    }
+    // BUSY: 其他线程正在取走等待者, 很快结束
+    state = ctx.state.load(std::memory_order_acquire);
+  }
+}
+
+IOManager::IOManager(size_t threads, bool use_caller, const std::string &name,
+                     bool sharded)
+    : Scheduler(threads, use_caller, name), m_sharded(sharded),
+      m_fdContexts([](FdContext &ctx, size_t fd) { ctx.fd = fd; }) {
+  setBatchSize(g_epoll_batch_size->getValue());
+  m_readBudget = std::max<uint32_t>(g_read_budget->getValue(), 1);
+  m_shardPolicy = (ShardPolicy)g_shard_policy->getValue();
+
+  if (g_backend->getValue() == "io_uring") {
+    m_uring = IoUring::IsSupported();
+    if (!m_uring) {
+      ARVIN_LOG_WARN(g_logger) << "io_uring not supported, fallback to epoll";
+    }
+  }
+
+  size_t shards = m_sharded ? std::max<size_t>(m_threadCount, 1) : 1;
+  for (size_t i = 0; i < shards; ++i) {
+    Shard *shard = new Shard;
+    shard->epfd = epoll_create(5000);
+    ARVIN_ASSERT(shard->epfd > 0);
+
+    shard->tickleFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ARVIN_ASSERT(shard->tickleFd >= 0);
+
+    epoll_event event;
+    memset(&event, 0, sizeof(epoll_event));
+    event.events = EPOLLIN | EPOLLET;
+    event.data.fd = shard->tickleFd;
+
+    int rt = epoll_ctl(shard->epfd, EPOLL_CTL_ADD, shard->tickleFd, &event);
+    ARVIN_ASSERT(!rt);
+    m_shards.push_back(shard);
+
+    if (m_uring) {
+      // 有完成事件时io_uring的fd可读, 与IO事件一起由epoll_wait等待
+      shard->uring = new IoUring(g_uring_entries->getValue());
+      event.data.fd = shard->uring->getFd();
+      if (!shard->uring->isValid() ||
+          epoll_ctl(shard->epfd, EPOLL_CTL_ADD, shard->uring->getFd(),
+                    &event)) {
+        ARVIN_LOG_WARN(g_logger) << "io_uring init failed, fallback to epoll";
+        m_uring = false;
+      }
+    }
+  }
+  if (!m_uring) {
+    for (auto i : m_shards) {
+      delete i->uring;
+      i->uring = nullptr;
+    }
+  }
+
+  start();
+
+  if (m_sharded) {
+    // 每个工作线程独占一个分片, 只有caller线程时由caller线程独占
+    size_t idx = 0;
+    for (auto id : m_threadIds) {
+      if (idx >= shards) {
+        break;
+      }
+      if (id != m_rootThread || m_threadCount == 0) {
+        m_shards[idx++]->thread = id;
+      }
+    }
+  }
+  m_shardsReady = true;
+}
+
+IOManager::~IOManager() {
+  stop();
+  for (auto i : m_shards) {
+    close(i->epfd);
+    close(i->tickleFd);
+    delete i->uring;
+    delete i;
+  }
+}
+
+IOManager::Shard *IOManager::getShard() {
+  if (m_shards.size() == 1) {
+    return m_shards[0];
+  }
+  int thread = arvin::GetThreadId();
+  for (auto i : m_shards) {
+    if (i->thread == thread) {
+      return i;
+    }
+  }
+  // 阻塞区间补充的线程等不独占分片的线程, 与其他线程共用
+  return m_shards[thread % m_shards.size()];
+}
+
+IOManager::Shard *IOManager::assignShard(FdContext *fd_ctx) {
+  if (fd_ctx->shard >= 0) {
+    return m_shards[fd_ctx->shard];
+  }
+  size_t n = m_shards.size();
+  int idx = -1;
+  if (n == 1) {
+    idx = 0;
+  } else if (m_shardPolicy == SHARD_HASH) {
+    idx = fd_ctx->fd % n;
+  } else {
+    if (m_shardPolicy == SHARD_LOCAL && Scheduler::GetThis() == this) {
+      int thread = arvin::GetThreadId();
+      for (size_t i = 0; i < n; ++i) {
+        if (m_shards[i]->thread == thread) {
+          idx = i;
+          break;
+        }
+      }
+    }
+    if (idx < 0) {
+      idx = 0;
+      for (size_t i = 1; i < n; ++i) {
+        if (m_shards[i]->fds < m_shards[idx]->fds) {
+          idx = i;
+        }
+      }
+    }
+  }
+  fd_ctx->shard = idx;
+  ++m_shards[idx]->fds;
+  return m_shards[idx];
+}
+
+bool IOManager::registerFd(FdContext *fd_ctx) {
+  FdContext::MutexType::Lock lock(fd_ctx->mutex);
+  if (fd_ctx->registered) {
+    return true;
+  }
+  Shard *shard = assignShard(fd_ctx);
+  epoll_event epevent;
+  epevent.events = EPOLLET | EPOLLIN | EPOLLOUT | EPOLLPRI | EPOLLRDHUP;
+  epevent.data.ptr = fd_ctx;
+  int rt = epoll_ctl(shard->epfd, EPOLL_CTL_ADD, fd_ctx->fd, &epevent);
+  if (rt) {
+    ARVIN_LOG_ERROR(g_logger)
+        << "epoll_ctl(" << shard->epfd << ", " << (EpollCtlOp)EPOLL_CTL_ADD
+        << ", " << fd_ctx->fd << ", " << (EPOLL_EVENTS)epevent.events
+        << "):" << rt << " (" << errno << ") (" << strerror(errno) << ")";
+    --shard->fds;
+    fd_ctx->shard = -1;
+    return false;
+  }
+  fd_ctx->peerClosed = false;
+  fd_ctx->reads = 0;
+  fd_ctx->registered.store(true, std::memory_order_release);
+  return true;
+}
+
+int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
+  FdContext *fd_ctx = m_fdContexts.getOrCreate(fd);
+  if (ARVIN_UNLIKELY(!fd_ctx)) {
+    ARVIN_LOG_ERROR(g_logger) << "addEvent fd=" << fd << " out of range";
+    return -1;
+  }
+  if (ARVIN_UNLIKELY(!fd_ctx->registered.load(std::memory_order_acquire)) &&
+      !registerFd(fd_ctx)) {
+    return -1;
+  }
+
+  typedef FdContext::EventContext EventContext;
+  EventContext &event_ctx = fd_ctx->getContext(event);
+  int state = event_ctx.state.load(std::memory_order_acquire);
+  while (state == EventContext::BUSY) {
+    // 上一个等待者正在被取走
+    state = event_ctx.state.load(std::memory_order_acquire);
+  }
+  if (ARVIN_UNLIKELY(state == EventContext::WAITING)) {
+    ARVIN_LOG_ERROR(g_logger) << "addEvent assert fd=" << fd
+                              << " event=" << (EPOLL_EVENTS)event
+                              << " already has a waiter";
+    ARVIN_ASSERT(state != EventContext::WAITING);
+  }
+
+  // 状态为IDLE/READY时只有本线程会修改等待者
+  event_ctx.scheduler = Scheduler::GetThis();
+  if (cb) {
+    event_ctx.cb.swap(cb);
+    if (!event_ctx.scheduler) {
+      // 非调度线程注册的回调在本IOManager中执行
+      event_ctx.scheduler = this;
+    }
+  } else {
+    event_ctx.fiber = Fiber::GetThis();
+    ARVIN_ASSERT2(event_ctx.fiber->getState() == Fiber::EXEC,
+                  "state=" << event_ctx.fiber->getState());
+  }
+  if (event == READ) {
+    fd_ctx->reads.store(0, std::memory_order_relaxed);
+  }
+
+  ++m_pendingEventCount;
+  while (true) {
+    if (state == EventContext::IDLE) {
+      if (event_ctx.state.compare_exchange_weak(state, EventContext::WAITING,
+                                                std::memory_order_release)) {
+        return 0;
+      }
+    } else {
+      ARVIN_ASSERT(state == EventContext::READY);
+      if (event_ctx.state.compare_exchange_weak(state, EventContext::BUSY,
+                                                std::memory_order_acquire)) {
+        // 注册前已就绪, 立即调度; 协程让出后才会被恢复
+        --m_pendingEventCount;
+        fd_ctx->dispatch(event_ctx);
+        return 0;
+      }
+    }
+  }
+}
+
+bool IOManager::delEvent(int fd, Event event) {
+  FdContext *fd_ctx = m_fdContexts.get(fd);
+  if (!fd_ctx) {
+    return false;
+  }
+  FdContext::EventContext &event_ctx = fd_ctx->getContext(event);
+  if (!fd_ctx->takeWaiter(event_ctx)) {
+    return false;
+  }
+  fd_ctx->resetContext(event_ctx);
+  event_ctx.state.store(FdContext::EventContext::IDLE,
+                        std::memory_order_release);
+  --m_pendingEventCount;
+  return true;
+}
+
+bool IOManager::cancelEvent(int fd, Event event) {
+  FdContext *fd_ctx = m_fdContexts.get(fd);
+  if (!fd_ctx) {
+    return false;
+  }
+  FdContext::EventContext &event_ctx = fd_ctx->getContext(event);
+  if (!fd_ctx->takeWaiter(event_ctx)) {
+    return false;
+  }
+  fd_ctx->dispatch(event_ctx);
+  --m_pendingEventCount;
+  return true;
+}
+
+bool IOManager::cancelAll(int fd) {
+  FdContext *fd_ctx = m_fdContexts.get(fd);
+  if (!fd_ctx) {
+    return false;
+  }
+
+  FdContext::MutexType::Lock lock(fd_ctx->mutex);
+  if (!fd_ctx->registered) {
+    return false;
+  }
+
+  epoll_event epevent;
+  epevent.events = 0;
+  epevent.data.ptr = fd_ctx;
+  int epfd = m_shards[fd_ctx->shard]->epfd;
+  int rt = epoll_ctl(epfd, EPOLL_CTL_DEL, fd, &epevent);
+  if (rt && errno != EBADF && errno != ENOENT) {
+    ARVIN_LOG_ERROR(g_logger)
+        << "epoll_ctl(" << epfd << ", " << (EpollCtlOp)EPOLL_CTL_DEL << ", "
+        << fd << ", " << (EPOLL_EVENTS)epevent.events << "):" << rt << " ("
+        << errno << ") (" << strerror(errno) << ")";
+    return false;
+  }
+  fd_ctx->registered = false;
+
+  bool cancelled = false;
+  for (Event event : {READ, WRITE, PRI}) {
+    FdContext::EventContext &event_ctx = fd_ctx->getContext(event);
+    if (fd_ctx->takeWaiter(event_ctx)) {
+      fd_ctx->dispatch(event_ctx);
+      --m_pendingEventCount;
+      cancelled = true;
+    }
+    // 清除残留的就绪状态, 复用的fd从头开始
+    int state = FdContext::EventContext::READY;
+    event_ctx.state.compare_exchange_strong(state,
+                                            FdContext::EventContext::IDLE);
+  }
+
+  // 释放分片以便复用的fd重新分配
+  --m_shards[fd_ctx->shard]->fds;
+  fd_ctx->shard = -1;
+  return cancelled;
+}
+
+void IOManager::getLoopStats(LoopStats &stats) const {
+  stats = LoopStats();
+#if ARVIN_IO_TRACE
+  for (auto i : m_shards) {
+    Histogram::Data d;
+    i->events.snapshot(d);
+    stats.events.merge(d);
+    i->timers.snapshot(d);
+    stats.timers.merge(d);
+    i->loop_us.snapshot(d);
+    stats.loop_us.merge(d);
+    i->wait_us.snapshot(d);
+    stats.wait_us.merge(d);
+  }
+#endif
+}
+
+std::ostream &IOManager::dump(std::ostream &os) {
+  Scheduler::dump(os);
+  LoopStats stats;
+  getLoopStats(stats);
+  if (stats.events.count) {
+    os << std::endl << "    epoll_events: ";
+    stats.events.dump(os) << std::endl << "    epoll_timers: ";
+    stats.timers.dump(os) << std::endl << "    epoll_loop_us: ";
+    stats.loop_us.dump(os) << std::endl << "    epoll_wait_us: ";
+    stats.wait_us.dump(os);
+  }
+  return os;
+}
+
+bool IOManager::isPeerClosed(int fd) const {
+  FdContext *fd_ctx = m_fdContexts.get(fd);
+  return fd_ctx && fd_ctx->peerClosed.load(std::memory_order_relaxed);
+}
+
+bool IOManager::chargeRead(int fd) {
+  FdContext *fd_ctx = m_fdContexts.getOrCreate(fd);
+  if (!fd_ctx) {
+    return false;
+  }
+  if (fd_ctx->reads.fetch_add(1, std::memory_order_relaxed) + 1 <
+      m_readBudget) {
+    return false;
+  }
+  fd_ctx->reads.store(0, std::memory_order_relaxed);
+  return true;
+}
+
+IOManager *IOManager::GetThis() {
+  return dynamic_cast<IOManager *>(Scheduler::GetThis());
+}
+
+void IOManager::runOnShards(std::function<void(size_t)> cb) {
+  for (size_t i = 0; i < m_shards.size(); ++i) {
+    int thread = m_sharded ? m_shards[i]->thread.load() : -1;
+    schedule(std::function<void()>(std::bind(cb, i)), thread);
+  }
+}
+
+bool IOManager::tickleShard(Shard *shard) {
+  // 与idle中先登记waiters再检查任务队列配对, 不会丢失唤醒
+  size_t pending = shard->pendingWakes;
+  do {
+    if (pending >= shard->waiters) {
+      return false;
+    }
+  } while (!shard->pendingWakes.compare_exchange_weak(pending, pending + 1));
+
+  uint64_t one = 1;
+  int rt = write(shard->tickleFd, &one, sizeof(one));
+  ARVIN_ASSERT(rt == sizeof(one));
+  if (Scheduler::WorkerStats *stats = GetWorkerStats()) {
+    stats->tickles.fetch_add(1, std::memory_order_relaxed);
+  }
+  return true;
+}
+
+void IOManager::tickle() {
+  size_t n = m_shards.size();
+  if (n == 1) {
+    tickleShard(m_shards[0]);
+    return;
+  }
+  // 轮询分片, 唤醒一个还有未被唤醒的等待线程的分片
+  size_t start = m_tickleSeq++;
+  for (size_t i = 0; i < n; ++i) {
+    if (tickleShard(m_shards[(start + i) % n])) {
+      return;
+    }
+  }
+}
+
+void IOManager::tickleThread(int thread) {
+  if (m_sharded) {
+    for (auto i : m_shards) {
+      if (i->thread == thread) {
+        tickleShard(i);
+        return;
+      }
+    }
+  }
+  // 线程不独占分片, 无法定向唤醒
+  tickle();
+}
+
+bool IOManager::stopping(uint64_t &timeout) {
+  timeout = getNextTimer();
+  return timeout == ~0ull && m_pendingEventCount == 0 && Scheduler::stopping();
+}
+
+bool IOManager::stopping() {
+  uint64_t timeout = 0;
+  return stopping(timeout);
+}
+
+void IOManager::idle() {
+  ARVIN_LOG_DEBUG(g_logger) << "idle";
+  const uint64_t MAX_EVENTS = m_batchSize;
+  std::unique_ptr<epoll_event[]> events(new epoll_event[MAX_EVENTS]);
+  std::vector<std::function<void()>> cbs;
+  std::vector<FiberAndThread> batch;
+  batch.reserve(MAX_EVENTS);
+  // 本线程添加的定时器由本线程处理, 退出时交给其他线程
+  attachTimerThread();
+
+  while (true) {
+    // 定时器使用每轮缓存的单调时钟, 不受系统时间调整影响
+    arvin::UpdateLoopMS();
+    uint64_t next_timeout = 0;
+    if (ARVIN_UNLIKELY(stopping(next_timeout))) {
+      ARVIN_LOG_INFO(g_logger) << "name=" << getName() << " idle stopping exit";
+      // 同一个eventfd事件只会唤醒一个线程, 退出前接力唤醒下一个
+      for (auto i : m_shards) {
+        if (i->waiters > 0) {
+          uint64_t one = 1;
+          int rt = write(i->tickleFd, &one, sizeof(one));
+          ARVIN_ASSERT(rt == sizeof(one));
+        }
+      }
+      break;
+    }
+
+    // 队列里已有任务时只收取就绪事件, 不阻塞
+    if (idleSpin()) {
+      next_timeout = 0;
+    }
+
+    static const int MAX_TIMEOUT = 3000;
+    if (next_timeout != ~0ull) {
+      next_timeout =
+          (int)next_timeout > MAX_TIMEOUT ? MAX_TIMEOUT : next_timeout;
+    } else {
+      next_timeout = MAX_TIMEOUT;
+    }
+    if (!m_shardsReady) {
+      // 启动期间分片的独占线程还未确定, 短暂等待后重新选择分片
+      next_timeout = std::min<uint64_t>(next_timeout, 10);
+    }
 
+    Shard *shard = getShard();
+    // 先登记为等待线程再检查任务, 与tickle之间不会丢失唤醒
+    bool waiting = false;
+    if (next_timeout) {
+      ++shard->waiters;
+      waiting = true;
+      if (hasRunnableTask(arvin::GetThreadId()) || stopping()) {
+        next_timeout = 0;
+      }
+    }
+
+    if (shard->uring) {
+      // 批量提交协程运行期间积攒的提交项
+      Spinlock::Lock lock(shard->uringMutex);
+      shard->uring->submit();
+    }
+
+    ARVIN_IO_TRACE_ONLY(uint64_t wait_start_us = arvin::GetMonotonicUS();)
+    int rt = 0;
+    do {
+      rt = epoll_wait(shard->epfd, events.get(), MAX_EVENTS, (int)next_timeout);
+    } while (rt < 0 && errno == EINTR);
+    if (waiting) {
+      --shard->waiters;
+    }
+    arvin::UpdateLoopMS();
+#if ARVIN_IO_TRACE
+    uint64_t ready_us = arvin::GetMonotonicUS();
+    shard->wait_us.record(ready_us - wait_start_us);
+#endif
+
+    // 到期的定时器与就绪的IO事件合并为一批调度
+    listExpiredCb(cbs);
+    ARVIN_IO_TRACE_ONLY(shard->timers.record(cbs.size());)
+    for (auto &cb : cbs) {
+      batch.emplace_back(&cb, -1);
+    }
+    cbs.clear();
+    ARVIN_IO_TRACE_ONLY(size_t io_begin = batch.size();)
+
+    // 分片模式下事件固定在分片的独占线程上执行
+    int owner = m_sharded ? shard->thread.load() : -1;
+    if (shard->uring) {
+      uringReap(shard, batch, owner);
+    }
+    for (int i = 0; i < rt; ++i) {
+      epoll_event &event = events[i];
+      if (shard->uring && event.data.fd == shard->uring->getFd()) {
+        continue;
+      }
+      if (event.data.fd == shard->tickleFd) {
+        uint64_t dummy;
+        while (read(shard->tickleFd, &dummy, sizeof(dummy)) > 0)
+          ;
+        // 计数已清零, 在途的唤醒都已被消费
+        shard->pendingWakes = 0;
+        if (Scheduler::WorkerStats *stats = GetWorkerStats()) {
+          stats->wakeups.fetch_add(1, std::memory_order_relaxed);
+        }
+        continue;
+      }
+
+      FdContext *fd_ctx = (FdContext *)event.data.ptr;
+      uint32_t ev = event.events;
+      if (ev & (EPOLLERR | EPOLLHUP)) {
+        // 出错时唤醒所有方向, 由IO调用返回具体错误
+        ev |= EPOLLIN | EPOLLOUT | EPOLLPRI;
+      }
+      if (ev & EPOLLRDHUP) {
+        fd_ctx->peerClosed.store(true, std::memory_order_relaxed);
+        ev |= EPOLLIN;
+      }
+      if ((ev & EPOLLIN) && fd_ctx->triggerEvent(READ, &batch, owner)) {
+        --m_pendingEventCount;
+      }
+      if ((ev & EPOLLOUT) && fd_ctx->triggerEvent(WRITE, &batch, owner)) {
+        --m_pendingEventCount;
+      }
+      if ((ev & EPOLLPRI) && fd_ctx->triggerEvent(PRI, &batch, owner)) {
+        --m_pendingEventCount;
+      }
+    }
+
+#if ARVIN_IO_TRACE
+    // 定时器之后的都是IO事件, 记下就绪时间供恢复执行时统计
+    for (size_t i = io_begin; i < batch.size(); ++i) {
+      batch[i].ready_us = ready_us;
+    }
+    shard->events.record(batch.size() - io_begin);
+#endif
+
+    bool timed_out = rt == 0 && batch.empty();
+    scheduleBatch(batch);
+    ARVIN_IO_TRACE_ONLY(
+        shard->loop_us.record(arvin::GetMonotonicUS() - ready_us);)
+    // 分片的独占线程退出后分片上的fd与定时器无人处理, 只有共用分片的线程可以退出
+    if (timed_out && !(m_sharded && shard->thread == arvin::GetThreadId()) &&
+        shouldRetire()) {
+      break;
+    }
+
+    Fiber::YieldToHold();
+  }
+  detachTimerThread();
+}
+
+void IOManager::onTimerInsertedAtFront() { tickle(); }
+
+void IOManager::onTimerPosted(int thread) {
+  if (m_sharded) {
+    tickleThread(thread);
+    return;
+  }
+  for (auto i : m_shards) {
+    while (tickleShard(i))
+      ;
+  }
+}
+
+int IOManager::uringPrepare(Shard *shard,
+                            const std::function<void(io_uring_sqe *)> &prep,
+                            UringWaiter *waiter) {
+  io_uring_sqe *sqe = shard->uring->getSqe();
+  if (!sqe) {
+    // 提交队列已满, 先提交再取
+    shard->uring->submit();
+    sqe = shard->uring->getSqe();
+    if (!sqe) {
+      return -EBUSY;
+    }
+  }
+  prep(sqe);
+  sqe->user_data = (uint64_t)waiter;
+  ++m_pendingEventCount;
+  // 当前线程还有其他任务时延迟提交, 由idle在epoll_wait前统一提交
+  if (Scheduler::GetThis() != this || !hasPendingTasks() ||
+      shard->uring->unsubmitted() >= m_batchSize) {
+    int rt = shard->uring->submit();
+    if (rt < 0 && rt != -EBUSY && rt != -EAGAIN) {
+      ARVIN_LOG_ERROR(g_logger) << "io_uring_enter errno=" << -rt << " "
+                                << strerror(-rt);
+    }
+  }
+  return 0;
+}
+
+void IOManager::uringReap(Shard *shard, std::vector<FiberAndThread> &batch,
+                          int owner) {
+  std::vector<io_uring_cqe> cqes;
+  {
+    Spinlock::Lock lock(shard->uringMutex);
+    shard->uring->reap(cqes);
+  }
+  for (auto &cqe : cqes) {
+    UringWaiter *waiter = (UringWaiter *)cqe.user_data;
+    if (!waiter) {
+      // POLL_REMOVE等不关心结果的操作
+      continue;
+    }
+    if (waiter->cb) {
+      batch.emplace_back(std::function<void()>(std::bind(waiter->cb, cqe.res)),
+                         owner);
+      if (!(cqe.flags & IORING_CQE_F_MORE)) {
+        --m_pendingEventCount;
+        delete waiter;
+      }
+    } else {
+      // 协程恢复后waiter所在的栈随时可能失效, 先取出协程
+      Fiber::ptr fiber;
+      fiber.swap(waiter->fiber);
+      waiter->res = cqe.res;
+      --m_pendingEventCount;
+      batch.emplace_back(&fiber, owner);
+    }
+  }
+}
+
+bool IOManager::runBlocking(const std::function<void()> &cb) {
+  ++m_pendingEventCount;
+  // 线程池调度回协程后才减少, 期间stopping()不会成立
+  bool rt = BlockingPoolMgr::GetInstance()->run(cb);
+  --m_pendingEventCount;
+  return rt;
+}
+
+int IOManager::uringSubmit(const std::function<void(io_uring_sqe *)> &prep) {
+  if (!m_uring || Scheduler::GetThis() != this ||
+      Fiber::GetThis().get() == Scheduler::GetMainFiber()) {
+    return -ENOSYS;
+  }
+  Shard *shard = getShard();
+  UringWaiter waiter;
+  waiter.fiber = Fiber::GetThis();
+  {
+    Spinlock::Lock lock(shard->uringMutex);
+    int rt = uringPrepare(shard, prep, &waiter);
+    if (rt) {
+      return rt;
+    }
+  }
+  Fiber::YieldToHold();
+  return waiter.res;
+}
+
+ssize_t IOManager::uringRead(int fd, void *buf, size_t len, off_t offset) {
+  return uringSubmit([=](io_uring_sqe *sqe) {
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)buf;
+    sqe->len = len;
+    sqe->off = offset;
+  });
+}
+
+ssize_t IOManager::uringWrite(int fd, const void *buf, size_t len,
+                              off_t offset) {
+  return uringSubmit([=](io_uring_sqe *sqe) {
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)buf;
+    sqe->len = len;
+    sqe->off = offset;
+  });
+}
+
+int IOManager::uringFsync(int fd, bool datasync) {
+  return uringSubmit([=](io_uring_sqe *sqe) {
+    sqe->opcode = IORING_OP_FSYNC;
+    sqe->fd = fd;
+    sqe->fsync_flags = datasync ? IORING_FSYNC_DATASYNC : 0;
+  });
+}
+
+ssize_t IOManager::uringReadFixed(int fd, void *buf, size_t len, int buf_index,
+                                  off_t offset) {
+  return uringSubmit([=](io_uring_sqe *sqe) {
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)buf;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->buf_index = buf_index;
+  });
+}
+
+ssize_t IOManager::uringWriteFixed(int fd, const void *buf, size_t len,
+                                   int buf_index, off_t offset) {
+  return uringSubmit([=](io_uring_sqe *sqe) {
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)buf;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->buf_index = buf_index;
+  });
+}
+
+int IOManager::uringAccept(int fd, sockaddr *addr, socklen_t *addrlen,
+                           int flags) {
+  return uringSubmit([=](io_uring_sqe *sqe) {
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)addr;
+    sqe->addr2 = (uint64_t)addrlen;
+    sqe->accept_flags = flags;
+  });
+}
+
+int IOManager::uringConnect(int fd, const sockaddr *addr, socklen_t addrlen) {
+  return uringSubmit([=](io_uring_sqe *sqe) {
+    sqe->opcode = IORING_OP_CONNECT;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)addr;
+    sqe->off = addrlen;
+  });
+}
+
+ssize_t IOManager::uringSendmsg(int fd, const msghdr *msg, int flags) {
+  return uringSubmit([=](io_uring_sqe *sqe) {
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)msg;
+    sqe->len = 1;
+    sqe->msg_flags = flags;
+  });
+}
+
+ssize_t IOManager::uringRecvmsg(int fd, msghdr *msg, int flags) {
+  return uringSubmit([=](io_uring_sqe *sqe) {
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)msg;
+    sqe->len = 1;
+    sqe->msg_flags = flags;
+  });
+}
+
+uint64_t IOManager::uringPoll(int fd, uint32_t mask,
+                              std::function<void(int)> cb) {
+  if (!m_uring || !cb) {
+    return 0;
+  }
+  Shard *shard = getShard();
+  UringWaiter *waiter = new UringWaiter;
+  waiter->cb.swap(cb);
+  Spinlock::Lock lock(shard->uringMutex);
+  int rt = uringPrepare(
+      shard,
+      [=](io_uring_sqe *sqe) {
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = fd;
+        sqe->len = IORING_POLL_ADD_MULTI;
+        sqe->poll32_events = mask;
+      },
+      waiter);
+  if (rt) {
+    delete waiter;
+    return 0;
+  }
+  return (uint64_t)waiter;
+}
+
+bool IOManager::uringPollCancel(uint64_t id) {
+  if (!m_uring || !id) {
+    return false;
+  }
+  // 轮询可能在任一分片上, 只有所在分片会找到它, 其余返回-ENOENT
+  for (auto shard : m_shards) {
+    Spinlock::Lock lock(shard->uringMutex);
+    io_uring_sqe *sqe = shard->uring->getSqe();
+    if (!sqe) {
+      shard->uring->submit();
+      sqe = shard->uring->getSqe();
+      if (!sqe) {
+        return false;
+      }
+    }
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = id;
+    sqe->user_data = 0;
+    shard->uring->submit();
+  }
+  return true;
+}
+
+int IOManager::registerBuffers(const iovec *iovs, unsigned count) {
+  if (!m_uring) {
+    return -ENOSYS;
+  }
+  for (auto shard : m_shards) {
+    Spinlock::Lock lock(shard->uringMutex);
+    int rt = shard->uring->registerBuffers(iovs, count);
+    if (rt < 0) {
+      return rt;
+    }
+  }
+  return 0;
+}
+
+int IOManager::registerFiles(const int *fds, unsigned count) {
+  if (!m_uring) {
+    return -ENOSYS;
+  }
+  for (auto shard : m_shards) {
+    Spinlock::Lock lock(shard->uringMutex);
+    int rt = shard->uring->registerFiles(fds, count);
+    if (rt < 0) {
+      return rt;
+    }
+  }
+  return 0;
+}
 
-} // namespace arvin
\ No newline at end of file
+} // namespace arvin
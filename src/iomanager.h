@@ -1,7 +1,10 @@
 #pragma once
 
+#include "fd_table.h"
 #include "scheduler.h"
 #include "timer.h"
+#include "uring.h"
+#include <sys/socket.h>
 
 namespace arvin {
 /**
@@ -18,15 +21,50 @@ public:
   enum Event {
     /// 无事件
     NONE = 0x0,
-    /// 读事件(EPOLLIN)
+    /// 读事件(EPOLLIN), 对端关闭写(EPOLLRDHUP)也会唤醒
     READ = 0x1,
+    /// 带外数据(EPOLLPRI)
+    PRI = 0x2,
     /// 写事件(EPOLLOUT)
     WRITE = 0x4,
   };
 
+  /**
+   * @brief 事件循环统计快照
+   * @details 需开启ARVIN_IO_TRACE, 否则各项为空
+   */
+  struct LoopStats {
+    /// 单次epoll_wait返回的事件数(含io_uring完成事件)
+    Histogram::Data events;
+    /// 单轮到期的定时器数
+    Histogram::Data timers;
+    /// 单轮从epoll_wait返回到任务入队完成的时间(微秒)
+    Histogram::Data loop_us;
+    /// 单次epoll_wait阻塞的时间(微秒)
+    Histogram::Data wait_us;
+  };
+
+  /**
+   * @brief 分片模式下新fd分配分片的策略
+   */
+  enum ShardPolicy {
+    /// 分配给注册事件的工作线程所在分片, 非工作线程按负载分配
+    SHARD_LOCAL = 0,
+    /// 按fd取模
+    SHARD_HASH = 1,
+    /// 分配给fd数量最少的分片
+    SHARD_LEAST_LOAD = 2,
+  };
+
 private:
   /**
    * @brief Socket事件上线文类
+   * @details fd首次注册时以边缘触发方式一次加入epoll(读/写/PRI/RDHUP),
+   *          此后addEvent只修改每个方向的原子状态, 不再调用epoll_ctl,
+   *          触发事件也不需要加锁.
+   *          每个方向的状态: IDLE -> WAITING(有等待者) -> BUSY(正在取走
+   *          等待者) -> IDLE; 没有等待者时到达的边缘记为READY,
+   *          下一次addEvent立即返回就绪, 可能是虚假唤醒, 调用方需重试IO
    */
   struct FdContext {
     typedef Mutex MutexType;
@@ -34,12 +72,24 @@ private:
      * @brief 事件上线文类
      */
     struct EventContext {
+      enum State {
+        /// 无等待者, 未就绪
+        IDLE = 0,
+        /// 有等待者
+        WAITING = 1,
+        /// 无等待者时收到了就绪边缘
+        READY = 2,
+        /// 等待者正在被取走
+        BUSY = 3,
+      };
       /// 事件执行的调度器
       Scheduler *scheduler = nullptr;
       /// 事件协程
       Fiber::ptr fiber;
       /// 事件的回调函数
       std::function<void()> cb;
+      /// 方向状态
+      std::atomic<int> state = {IDLE};
     };
 
     /**
@@ -56,20 +106,43 @@ private:
     void resetContext(EventContext &ctx);
 
     /**
-     * @brief 触发事件
-     * @param[in] event 事件类型
+     * @brief 取走等待者, 成功后状态为BUSY, 需调用dispatch或resetContext
+     */
+    bool takeWaiter(EventContext &ctx);
+
+    /**
+     * @brief 调度已取走的等待者, 并将状态置回IDLE
+     * @param[out] batch 非空且事件属于当前调度器时, 放入批量调度数组而不是立即调度
+     * @param[in] thread 放入批量调度数组时指定的执行线程, -1表示任意线程
      */
-    void triggerEvent(Event event);
+    void dispatch(EventContext &ctx, std::vector<FiberAndThread> *batch = nullptr,
+                  int thread = -1);
+
+    /**
+     * @brief 收到就绪边缘
+     * @details 有等待者时唤醒, 否则记为READY
+     * @return 是否唤醒了等待者
+     */
+    bool triggerEvent(Event event, std::vector<FiberAndThread> *batch = nullptr,
+                      int thread = -1);
 
     /// 读事件上下文
     EventContext read;
     /// 写事件上下文
     EventContext write;
+    /// 带外数据事件上下文
+    EventContext pri;
     /// 事件关联的句柄
     int fd = 0;
-    /// 当前的事件
-    Event events = NONE;
-    /// 事件的Mutex
+    /// 所属的epoll分片, -1表示未分配
+    int shard = -1;
+    /// 是否已加入epoll
+    std::atomic<bool> registered = {false};
+    /// 对端是否已关闭写(EPOLLRDHUP)
+    std::atomic<bool> peerClosed = {false};
+    /// 未挂起连续完成的读次数, 用于读公平性
+    std::atomic<uint32_t> reads = {0};
+    /// 注册/注销epoll的Mutex
     MutexType mutex;
   };
 
@@ -79,9 +152,12 @@ public:
    * @param[in] threads 线程数量
    * @param[in] use_caller 是否将调用线程包含进去
    * @param[in] name 调度器的名称
+   * @param[in] sharded 是否为分片模式
+   * @details 分片模式下每个工作线程独占一个epoll, fd固定属于一个分片,
+   *          其事件只在该分片的线程上执行, 连接从accept到close不离开同一个核
    */
   IOManager(size_t threads = 1, bool use_caller = true,
-            const std::string &name = "");
+            const std::string &name = "", bool sharded = false);
 
   /**
    * @brief 析构函数
@@ -114,27 +190,204 @@ public:
   bool cancelEvent(int fd, Event event);
 
   /**
-   * @brief 取消所有事件
+   * @brief 取消所有事件, 并将fd移出epoll
    * @param[in] fd socket句柄
+   * @attention 关闭fd前必须调用, 否则复用该fd时不会重新加入epoll
    */
   bool cancelAll(int fd);
 
+  /**
+   * @brief 对端是否已关闭写(收到过EPOLLRDHUP)
+   */
+  bool isPeerClosed(int fd) const;
+
+  /**
+   * @brief 记录fd上一次未挂起就完成的读
+   * @details 同一fd连续读取iomanager.read_budget次后返回true并清零,
+   *          调用方应Fiber::YieldToReady让出工作线程, 避免一个繁忙连接
+   *          饿死同一线程上的其他连接. 每次真正等待读事件时计数清零
+   * @return 是否应让出执行权
+   */
+  bool chargeRead(int fd);
+
   /**
    * @brief 返回当前的IOManager
    */
   static IOManager *GetThis();
 
+  /**
+   * @brief 设置单次epoll_wait最多收取的事件数
+   * @pre 在idle开始前调用
+   */
+  void setBatchSize(uint32_t v) { m_batchSize = v ? v : 1; }
+
+  /**
+   * @brief 返回单次epoll_wait最多收取的事件数
+   */
+  uint32_t getBatchSize() const { return m_batchSize; }
+
+  /**
+   * @brief 是否为分片模式
+   */
+  bool isSharded() const { return m_sharded; }
+
+  /**
+   * @brief 返回epoll分片数量, 非分片模式为1
+   */
+  size_t getShardCount() const { return m_shards.size(); }
+
+  /**
+   * @brief 设置新fd分配分片的策略
+   */
+  void setShardPolicy(ShardPolicy v) { m_shardPolicy = v; }
+
+  /**
+   * @brief 返回新fd分配分片的策略
+   */
+  ShardPolicy getShardPolicy() const { return m_shardPolicy; }
+
+  /**
+   * @brief 是否使用io_uring后端
+   * @details 由配置iomanager.backend选择, 内核不支持时回退到epoll
+   */
+  bool isUring() const { return m_uring; }
+
+  /**
+   * @brief 把阻塞调用交给阻塞IO线程池执行, 当前协程挂起直到完成
+   * @details 等待期间计入待处理事件, IOManager不会在完成前退出
+   * @return 未能卸载(不在协程中、队列已满)时返回false, cb没有执行
+   */
+  bool runBlocking(const std::function<void()> &cb);
+
+  /**
+   * @brief 通过io_uring提交一个操作, 当前协程挂起直到完成
+   * @details 提交项由prep填写, 可设置IOSQE_FIXED_FILE等标志.
+   *          当前线程还有其他任务时延迟到idle中与其他提交项一起提交
+   * @param[in] prep 填写提交项的函数, 不能修改user_data
+   * @return 完成事件的res, 失败为-errno; 未启用io_uring或不在本IOManager
+   *         的协程中时返回-ENOSYS, 调用方应退回普通系统调用
+   */
+  int uringSubmit(const std::function<void(io_uring_sqe *)> &prep);
+
+  /**
+   * @brief io_uring读, offset为-1时使用文件当前偏移
+   * @return 读取的字节数, 失败为-errno
+   */
+  ssize_t uringRead(int fd, void *buf, size_t len, off_t offset = -1);
+
+  /**
+   * @brief io_uring写, offset为-1时使用文件当前偏移
+   * @return 写入的字节数, 失败为-errno
+   */
+  ssize_t uringWrite(int fd, const void *buf, size_t len, off_t offset = -1);
+
+  /**
+   * @brief io_uring fsync
+   * @param[in] datasync 是否只同步数据(fdatasync)
+   * @return 成功返回0, 失败为-errno
+   */
+  int uringFsync(int fd, bool datasync = false);
+
+  /**
+   * @brief 读入registerBuffers注册的第buf_index个缓冲区
+   */
+  ssize_t uringReadFixed(int fd, void *buf, size_t len, int buf_index,
+                         off_t offset = -1);
+
+  /**
+   * @brief 从registerBuffers注册的第buf_index个缓冲区写出
+   */
+  ssize_t uringWriteFixed(int fd, const void *buf, size_t len, int buf_index,
+                          off_t offset = -1);
+
+  /**
+   * @brief io_uring accept
+   * @return 新连接的fd, 失败为-errno
+   */
+  int uringAccept(int fd, sockaddr *addr, socklen_t *addrlen, int flags = 0);
+
+  /**
+   * @brief io_uring connect
+   * @return 成功返回0, 失败为-errno
+   */
+  int uringConnect(int fd, const sockaddr *addr, socklen_t addrlen);
+
+  /**
+   * @brief io_uring sendmsg
+   */
+  ssize_t uringSendmsg(int fd, const msghdr *msg, int flags);
+
+  /**
+   * @brief io_uring recvmsg
+   */
+  ssize_t uringRecvmsg(int fd, msghdr *msg, int flags);
+
+  /**
+   * @brief 多次触发的就绪轮询(IORING_POLL_ADD_MULTI)
+   * @details 每次就绪以事件掩码调用一次cb; 轮询结束(被取消或出错)时以-errno
+   *          最后调用一次. 活跃的轮询会阻止IOManager停止
+   * @param[in] fd 文件句柄
+   * @param[in] mask POLLIN/POLLOUT等
+   * @param[in] cb 回调函数
+   * @return 轮询id, 用于uringPollCancel; 未启用io_uring返回0
+   */
+  uint64_t uringPoll(int fd, uint32_t mask, std::function<void(int)> cb);
+
+  /**
+   * @brief 取消多次触发的就绪轮询
+   */
+  bool uringPollCancel(uint64_t id);
+
+  /**
+   * @brief 在所有分片的io_uring上注册固定缓冲区
+   * @return 成功返回0, 失败返回-errno
+   */
+  int registerBuffers(const iovec *iovs, unsigned count);
+
+  /**
+   * @brief 在所有分片的io_uring上注册固定文件
+   * @return 成功返回0, 失败返回-errno
+   */
+  int registerFiles(const int *fds, unsigned count);
+
+  /**
+   * @brief 获取所有分片合计的事件循环统计
+   */
+  void getLoopStats(LoopStats &stats) const;
+
+  /**
+   * @brief 输出调度器与事件循环统计
+   */
+  std::ostream &dump(std::ostream &os);
+
+  /**
+   * @brief 在每个分片的线程上执行一次回调
+   * @details 用于每个分片各自创建SO_REUSEPORT监听socket,
+   *          在回调中注册的fd按SHARD_LOCAL策略属于该分片
+   * @param[in] cb 回调函数, 参数为分片序号
+   */
+  void runOnShards(std::function<void(size_t)> cb);
+
 protected:
+  /**
+   * @brief 唤醒一个阻塞在epoll_wait中的线程
+   * @details 已发出的唤醒足够覆盖所有等待线程时不再写eventfd
+   */
   void tickle() override;
+  void tickleThread(int thread) override;
   bool stopping() override;
   void idle() override;
   void onTimerInsertedAtFront() override;
+  /**
+   * @brief 唤醒定时器分片的所属线程
+   * @details 非分片模式下所有线程等待同一个epoll, 只能唤醒全部等待线程
+   */
+  void onTimerPosted(int thread) override;
 
   /**
-   * @brief 重置socket句柄上下文的容器大小
-   * @param[in] size 容量大小
+   * @brief fd首次使用时以边缘触发方式加入epoll
    */
-  void contextResize(size_t size);
+  bool registerFd(FdContext *fd_ctx);
 
   /**
    * @brief 判断是否可以停止
@@ -144,15 +397,95 @@ protected:
   bool stopping(uint64_t &timeout);
 
 private:
-  /// epoll 文件句柄
-  int m_epfd = 0;
-  /// pipe 文件句柄
-  int m_tickleFds[2];
+  /**
+   * @brief epoll分片
+   */
+  struct Shard {
+    /// epoll 文件句柄
+    int epfd = -1;
+    /// 用于唤醒epoll_wait的eventfd
+    int tickleFd = -1;
+    /// 独占该分片的线程id, -1表示所有线程共用
+    std::atomic<int> thread = {-1};
+    /// 分配到该分片的fd数量
+    std::atomic<size_t> fds = {0};
+    /// 阻塞在epoll_wait中的线程数量
+    std::atomic<size_t> waiters = {0};
+    /// 已发出尚未被消费的唤醒数量
+    std::atomic<size_t> pendingWakes = {0};
+    /// io_uring后端, epoll后端时为nullptr
+    IoUring *uring = nullptr;
+    /// 保护uring的提交与收割
+    Spinlock uringMutex;
+#if ARVIN_IO_TRACE
+    Histogram events;
+    Histogram timers;
+    Histogram loop_us;
+    Histogram wait_us;
+#endif
+  };
+
+  /**
+   * @brief io_uring操作的等待者, user_data指向它
+   */
+  struct UringWaiter {
+    /// 等待完成的协程
+    Fiber::ptr fiber;
+    /// 多次触发轮询的回调
+    std::function<void(int)> cb;
+    /// 完成结果
+    int res = 0;
+  };
+
+  /**
+   * @brief 在分片的io_uring上填写一个提交项
+   * @return 成功返回0, 提交队列满时返回-EBUSY
+   */
+  int uringPrepare(Shard *shard, const std::function<void(io_uring_sqe *)> &prep,
+                   UringWaiter *waiter);
+
+  /**
+   * @brief 收割分片的io_uring完成事件, 放入批量调度数组
+   */
+  void uringReap(Shard *shard, std::vector<FiberAndThread> &batch, int owner);
+
+  /**
+   * @brief 返回当前线程等待的分片
+   */
+  Shard *getShard();
+
+  /**
+   * @brief 返回fd所属的分片, 未分配时按策略分配
+   * @pre 持有fd_ctx->mutex
+   */
+  Shard *assignShard(FdContext *fd_ctx);
+
+  /**
+   * @brief 唤醒分片上一个阻塞在epoll_wait中的线程
+   * @return 是否写了eventfd
+   */
+  bool tickleShard(Shard *shard);
+
+private:
+  /// epoll分片, 非分片模式只有一个由所有线程共用
+  std::vector<Shard *> m_shards;
+  /// 是否为分片模式
+  bool m_sharded = false;
+  /// 分片的独占线程是否已确定
+  std::atomic<bool> m_shardsReady = {false};
+  /// 新fd分配分片的策略
+  ShardPolicy m_shardPolicy = SHARD_LOCAL;
+  /// tickle轮询分片的起点
+  std::atomic<size_t> m_tickleSeq = {0};
+  /// 是否使用io_uring后端
+  bool m_uring = false;
   /// 当前等待执行的事件数量
   std::atomic<size_t> m_pendingEventCount = {0};
-  /// IOManager的Mutex
-  RWMutexType m_mutex;
-  /// socket事件上下文的容器
-  std::vector<FdContext *> m_fdContexts;
+  /// socket事件上下文的容器, 以fd为下标, 查找无锁且地址不变
+  FdTable<FdContext> m_fdContexts;
+  /// 单次epoll_wait最多收取的事件数
+  uint32_t m_batchSize = 256;
+  /// 同一fd连续读取的上限
+  uint32_t m_readBudget = 16;
 };
 } // namespace arvin
\ No newline at end of file
@@ -1,4 +1,9 @@
 #include "mutex.h"
+#include "scheduler.h"
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
 
 namespace arvin {
 Semaphore::Semaphore(uint32_t count) {
@@ -21,4 +26,91 @@ void Semaphore::notify() {
   }
 }
 
+static int futex(std::atomic<int32_t> *addr, int op, int32_t val,
+                 const struct timespec *ts) {
+  return syscall(SYS_futex, (int32_t *)addr, op, val, ts, nullptr, 0);
+}
+
+bool Parker::park(uint64_t timeout_ms) {
+  // 已有许可, 直接消费
+  if (m_state.fetch_sub(1, std::memory_order_acquire) == 1) {
+    return true;
+  }
+  struct timespec ts;
+  struct timespec *pts = nullptr;
+  if (timeout_ms != ~0ull) {
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000 * 1000;
+    pts = &ts;
+  }
+  futex(&m_state, FUTEX_WAIT_PRIVATE, -1, pts);
+  return m_state.exchange(0, std::memory_order_acquire) == 1;
+}
+
+void Parker::unpark() {
+  if (m_state.exchange(1, std::memory_order_release) == -1) {
+    futex(&m_state, FUTEX_WAKE_PRIVATE, 1, nullptr);
+  }
+}
+
+FiberSemaphore::FiberSemaphore(size_t initial_concurrency)
+    : m_concurrency(initial_concurrency) {}
+
+FiberSemaphore::~FiberSemaphore() {
+  // ARVIN_ASSERT(m_waiters.empty());
+}
+
+bool FiberSemaphore::tryWait() {
+  MutexType::Lock lock(m_mutex);
+  if (m_concurrency > 0u) {
+    --m_concurrency;
+    return true;
+  }
+  return false;
+}
+
+void FiberSemaphore::wait() {
+  Scheduler *scheduler = Scheduler::GetThis();
+  bool in_fiber = scheduler && Fiber::GetFiberId() != 0;
+  Semaphore sem;
+  {
+    MutexType::Lock lock(m_mutex);
+    if (m_concurrency > 0u) {
+      --m_concurrency;
+      return;
+    }
+    Waiter waiter;
+    if (in_fiber) {
+      waiter.scheduler = scheduler;
+      waiter.fiber = Fiber::GetThis();
+    } else {
+      waiter.sem = &sem;
+    }
+    m_waiters.push_back(waiter);
+  }
+  if (in_fiber) {
+    Fiber::YieldToHold();
+  } else {
+    sem.wait();
+  }
+}
+
+void FiberSemaphore::notify() {
+  Waiter waiter;
+  {
+    MutexType::Lock lock(m_mutex);
+    if (m_waiters.empty()) {
+      ++m_concurrency;
+      return;
+    }
+    waiter = m_waiters.front();
+    m_waiters.pop_front();
+  }
+  if (waiter.sem) {
+    waiter.sem->notify();
+  } else {
+    waiter.scheduler->schedule(waiter.fiber);
+  }
+}
+
 } // namespace arvin
\ No newline at end of file
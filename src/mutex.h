@@ -5,12 +5,13 @@
 #include <memory>
 #include <pthread.h>
 #include <semaphore.h>
+#include <stdexcept>
 #include <stdint.h>
 #include <atomic>
 #include <list>
 
 #include "noncopyable.h"
-//#include "fiber.h"
+#include "fiber.h"
 
 namespace arvin {
 
@@ -43,6 +44,29 @@ private:
     sem_t m_semaphore;
 };
 
+/**
+ * @brief 基于futex的线程挂起/唤醒原语
+ * @details 同一时刻只允许一个线程park, 任意线程可以unpark.
+ *          先unpark后park时, park立即返回(许可不会丢失)
+ */
+class Parker : Noncopyable {
+public:
+    /**
+     * @brief 挂起当前线程, 直到被unpark或超时
+     * @param[in] timeout_ms 超时时间(毫秒), ~0ull表示不超时
+     * @return 是否被unpark唤醒
+     */
+    bool park(uint64_t timeout_ms = ~0ull);
+
+    /**
+     * @brief 唤醒park中的线程
+     */
+    void unpark();
+private:
+    /// 0:空闲 1:已通知 -1:挂起中
+    std::atomic<int32_t> m_state = {0};
+};
+
 /**
  * @brief 局部锁的模板实现
  */
@@ -423,26 +447,62 @@ private:
     volatile std::atomic_flag m_mutex;
 };
 
-/*
 class Scheduler;
+
+/**
+ * @brief 协程信号量
+ * @details 在协程中等待时只挂起当前协程, 不阻塞线程;
+ *          不在调度器的协程中时退化为阻塞当前线程
+ */
 class FiberSemaphore : Noncopyable {
 public:
     typedef Spinlock MutexType;
 
+    /**
+     * @brief 构造函数
+     * @param[in] initial_concurrency 初始值
+     */
     FiberSemaphore(size_t initial_concurrency = 0);
+
+    /**
+     * @brief 析构函数
+     */
     ~FiberSemaphore();
 
+    /**
+     * @brief 尝试获取信号量
+     * @return 是否获取成功
+     */
     bool tryWait();
+
+    /**
+     * @brief 获取信号量
+     */
     void wait();
+
+    /**
+     * @brief 释放信号量
+     */
     void notify();
 
     size_t getConcurrency() const { return m_concurrency;}
     void reset() { m_concurrency = 0;}
+private:
+    /**
+     * @brief 等待者
+     */
+    struct Waiter {
+        /// 协程所在的调度器
+        Scheduler* scheduler = nullptr;
+        /// 等待的协程
+        Fiber::ptr fiber;
+        /// 非协程等待时阻塞的信号量
+        Semaphore* sem = nullptr;
+    };
 private:
     MutexType m_mutex;
-    std::list<std::pair<Scheduler*, Fiber::ptr> > m_waiters;
+    std::list<Waiter> m_waiters;
     size_t m_concurrency;
 };
-*/
 }
 
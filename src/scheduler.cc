@@ -1,7 +1,10 @@
 #include "scheduler.h"
+#include "config.h"
 #include "log.h"
-// #include "macro.h"
+#include "macro.h"
 #include "hook.h"
+#include <algorithm>
+#include <sched.h>
 
 namespace arvin {
 
@@ -12,9 +15,53 @@ static thread_local Scheduler *t_scheduler = nullptr;
 /// 当前线程的调度协程，每个线程都独有一份
 static thread_local Fiber *t_scheduler_fiber = nullptr;
 
+static ConfigVar<uint32_t>::ptr g_idle_spin_count = Config::Lookup<uint32_t>(
+    "scheduler.idle.spin_count", 256, "scheduler idle spin count");
+static ConfigVar<uint32_t>::ptr g_idle_yield_count = Config::Lookup<uint32_t>(
+    "scheduler.idle.yield_count", 4, "scheduler idle sched_yield count");
+static ConfigVar<uint32_t>::ptr g_idle_park_ms = Config::Lookup<uint32_t>(
+    "scheduler.idle.park_ms", 1000, "scheduler idle max park time ms");
+
+static ConfigVar<uint32_t>::ptr g_elastic_grow_ms = Config::Lookup<uint32_t>(
+    "scheduler.elastic.grow_ms", 10,
+    "elastic scheduler grows after tasks stay queued with no idle worker ms");
+static ConfigVar<uint32_t>::ptr g_elastic_queue_latency_ms =
+    Config::Lookup<uint32_t>(
+        "scheduler.elastic.queue_latency_ms", 20,
+        "elastic scheduler grows when a task waited in queue longer than ms");
+static ConfigVar<uint32_t>::ptr g_elastic_retire_ms = Config::Lookup<uint32_t>(
+    "scheduler.elastic.retire_ms", 10000,
+    "elastic scheduler retires a worker idle longer than ms");
+
+static ConfigVar<uint32_t>::ptr g_time_slice_ms = Config::Lookup<uint32_t>(
+    "scheduler.time_slice_ms", 0,
+    "scheduler task time slice ms before Fiber::MaybeYield yields, 0 disable");
+
+/// 当前工作线程最近一次执行任务的时间(毫秒)
+static thread_local uint64_t t_last_active_ms = 0;
+/// 当前工作线程是否已因空闲而退出
+static thread_local bool t_retired = false;
+/// 当前工作线程的统计
+static thread_local Scheduler::WorkerStats *t_worker_stats = nullptr;
+
+/**
+ * @brief 自旋等待时提示CPU降低功耗, 让出流水线给超线程
+ */
+static inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield" ::: "memory");
+#endif
+}
+
 Scheduler::Scheduler(size_t threads, bool use_caller, const std::string &name)
     : m_name(name) {
   // ARVIN_ASSERT(threads>0);
+  m_idlePolicy.spin_count = g_idle_spin_count->getValue();
+  m_idlePolicy.yield_count = g_idle_yield_count->getValue();
+  m_idlePolicy.park_ms = g_idle_park_ms->getValue();
+  m_timeSlice = g_time_slice_ms->getValue();
   if (use_caller) {
     arvin::Fiber::GetThis();
     --threads;
@@ -35,6 +82,8 @@ Scheduler::Scheduler(size_t threads, bool use_caller, const std::string &name)
     m_rootThread = -1;
   }
   m_threadCount = threads;
+  m_minThreads = threads;
+  m_maxThreads = threads;
 }
 
 Scheduler::~Scheduler() {
@@ -44,8 +93,47 @@ Scheduler::~Scheduler() {
   }
 }
 
+Scheduler *Scheduler::GetThis() { return t_scheduler; }
+
 Fiber *Scheduler::GetMainFiber() { return t_scheduler_fiber; }
 
+Scheduler::WorkerStats *Scheduler::GetWorkerStats() { return t_worker_stats; }
+
+void Scheduler::WorkerStats::snapshot(WorkerStatsData &d) const {
+  d.thread = thread;
+  d.tasks = tasks.load(std::memory_order_relaxed);
+  d.steals = steals.load(std::memory_order_relaxed);
+  d.tickles = tickles.load(std::memory_order_relaxed);
+  d.wakeups = wakeups.load(std::memory_order_relaxed);
+  d.overruns = overruns.load(std::memory_order_relaxed);
+  d.preempts = preempts.load(std::memory_order_relaxed);
+  queue_depth.snapshot(d.queue_depth);
+  queue_wait_us.snapshot(d.queue_wait_us);
+  run_us.snapshot(d.run_us);
+  idle_us.snapshot(d.idle_us);
+  park_us.snapshot(d.park_us);
+#if ARVIN_IO_TRACE
+  io_dispatch_us.snapshot(d.io_dispatch_us);
+  io_resume_us.snapshot(d.io_resume_us);
+#endif
+}
+
+void Scheduler::WorkerStatsData::merge(const WorkerStatsData &o) {
+  tasks += o.tasks;
+  steals += o.steals;
+  tickles += o.tickles;
+  wakeups += o.wakeups;
+  overruns += o.overruns;
+  preempts += o.preempts;
+  queue_depth.merge(o.queue_depth);
+  queue_wait_us.merge(o.queue_wait_us);
+  run_us.merge(o.run_us);
+  idle_us.merge(o.idle_us);
+  park_us.merge(o.park_us);
+  io_dispatch_us.merge(o.io_dispatch_us);
+  io_resume_us.merge(o.io_resume_us);
+}
+
 void Scheduler::start() {
   MutexType::Lock lock(m_mutex);
   if (!m_stopping) {
@@ -54,15 +142,168 @@ void Scheduler::start() {
   m_stopping = false;
   // ARVIN_ASSERT(m_threads.empty());
 
+  m_workerCount = m_threadCount;
   m_threads.resize(m_threadCount);
   for (size_t i = 0; i < m_threadCount; ++i) {
     m_threads[i].reset(new Thread(std::bind(&Scheduler::run, this),
-                                  m_name + "_" + std::to_string(i)));
+                                  m_name + "_" + std::to_string(m_threadSeq++)));
     m_threadIds.push_back(m_threads[i]->getId());
   }
+  if (m_timeSlice) {
+    m_watchdog.reset(new Thread(std::bind(&Scheduler::watchdog, this),
+                                m_name + "_watchdog"));
+  }
   lock.unlock();
 }
 
+void Scheduler::setElastic(size_t min_threads, size_t max_threads) {
+  // 工作线程启动后再修改上下限, 计数与已启动的线程不一致
+  ARVIN_ASSERT2(m_stopping,
+                m_name << " setElastic must be called before start");
+  m_elastic = true;
+  m_minThreads = min_threads;
+  m_maxThreads = std::max(min_threads, max_threads);
+  m_threadCount = min_threads;
+}
+
+bool Scheduler::addThread() {
+  std::vector<Thread::ptr> retired;
+  {
+    MutexType::Lock lock(m_mutex);
+    if (m_stopping || m_workerCount >= m_maxThreads + m_blockingCount) {
+      return false;
+    }
+    // 顺带回收已退出的线程
+    for (auto id : m_retiredIds) {
+      for (auto it = m_threads.begin(); it != m_threads.end(); ++it) {
+        if ((*it)->getId() == id) {
+          retired.push_back(*it);
+          m_threads.erase(it);
+          break;
+        }
+      }
+      for (auto it = m_workerStats.begin(); it != m_workerStats.end(); ++it) {
+        if ((*it)->thread == id) {
+          WorkerStatsData data;
+          (*it)->snapshot(data);
+          m_retiredStats.merge(data);
+          m_workerStats.erase(it);
+          break;
+        }
+      }
+      m_threadIds.erase(std::remove(m_threadIds.begin(), m_threadIds.end(), id),
+                        m_threadIds.end());
+    }
+    m_retiredIds.clear();
+
+    ++m_workerCount;
+    Thread::ptr thr(new Thread(std::bind(&Scheduler::run, this),
+                               m_name + "_" + std::to_string(m_threadSeq++)));
+    m_threads.push_back(thr);
+    m_threadIds.push_back(thr->getId());
+    ARVIN_LOG_INFO(g_logger) << m_name << " add worker " << thr->getId()
+                             << " workers=" << m_workerCount;
+  }
+  for (auto &i : retired) {
+    i->join();
+  }
+  return true;
+}
+
+void Scheduler::watchdog() {
+  uint64_t interval = std::max<uint64_t>(m_timeSlice / 2, 1);
+  uint64_t slice_us = m_timeSlice * 1000ull;
+  while (!m_watchdogParker.park(interval)) {
+    std::vector<WorkerStats::ptr> workers;
+    {
+      MutexType::Lock lock(m_mutex);
+      workers = m_workerStats;
+    }
+    uint64_t now_us = arvin::GetMonotonicUS();
+    for (auto &i : workers) {
+      uint64_t start = i->slice_start_us.load(std::memory_order_relaxed);
+      if (!start || now_us < start + slice_us ||
+          i->yield_requested.load(std::memory_order_relaxed)) {
+        continue;
+      }
+      // 同一个任务只记录一次超时
+      if (i->overrun_start == start) {
+        continue;
+      }
+      i->overrun_start = start;
+      i->overruns.fetch_add(1, std::memory_order_relaxed);
+      // 不经过安全点的任务不会在MaybeYield中留下记录, 由watchdog报告
+      ARVIN_LOG_WARN(g_logger)
+          << m_name << " task overrun thread=" << i->thread
+          << " fiber_id=" << i->fiber_id.load(std::memory_order_relaxed)
+          << " run_us=" << now_us - start;
+      if (hasPendingTasks()) {
+        i->yield_requested.store(true, std::memory_order_relaxed);
+      }
+    }
+  }
+}
+
+bool Scheduler::shouldRetire() {
+  int thread = arvin::GetThreadId();
+  if (thread == m_rootThread || arvin::GetMonotonicMS() - t_last_active_ms <
+                                    g_elastic_retire_ms->getValue()) {
+    return false;
+  }
+  // 与投递任务在同一把锁下判断, 固定到本线程的任务不会在退出后被遗留
+  MutexType::Lock lock(m_mutex);
+  for (auto &i : m_fibers) {
+    if (i.thread == thread) {
+      return false;
+    }
+  }
+  size_t n = m_workerCount;
+  do {
+    if (n <= m_minThreads + m_blockingCount) {
+      return false;
+    }
+  } while (!m_workerCount.compare_exchange_weak(n, n - 1));
+  t_retired = true;
+
+  m_retiredIds.push_back(thread);
+  ARVIN_LOG_INFO(g_logger) << m_name << " retire worker " << thread
+                           << " workers=" << n - 1;
+  return true;
+}
+
+void Scheduler::checkGrow(uint64_t ts) {
+  if (!hasPendingTasks() || m_idleThreadCount > 0) {
+    if (m_saturatedSince) {
+      m_saturatedSince = 0;
+    }
+    return;
+  }
+  uint64_t now_ms = arvin::GetMonotonicMS();
+  bool grow = now_ms - ts / 1000 >= g_elastic_queue_latency_ms->getValue();
+  if (!grow) {
+    uint64_t since = m_saturatedSince;
+    if (!since) {
+      m_saturatedSince.compare_exchange_strong(since, now_ms);
+      return;
+    }
+    grow = now_ms - since >= g_elastic_grow_ms->getValue();
+  }
+  if (grow && addThread()) {
+    m_saturatedSince = 0;
+  }
+}
+
+void Scheduler::enterBlocking() {
+  ++m_blockingCount;
+  if (m_idleThreadCount == 0) {
+    addThread();
+  } else if (hasPendingTasks()) {
+    tickle();
+  }
+}
+
+void Scheduler::leaveBlocking() { --m_blockingCount; }
+
 void Scheduler::stop() {
   m_autoStop = true;
   if (m_rootFiber && m_threadCount == 0 &&
@@ -84,7 +325,7 @@ void Scheduler::stop() {
   }
 
   m_stopping = true;
-  for (size_t i = 0; i < m_threadCount; ++i) {
+  for (size_t i = 0; i < m_workerCount; ++i) {
     tickle();
   }
 
@@ -116,6 +357,11 @@ void Scheduler::stop() {
   for (auto &i : thrs) {
     i->join();
   }
+  if (m_watchdog) {
+    m_watchdogParker.unpark();
+    m_watchdog->join();
+    m_watchdog.reset();
+  }
   // if(exit_on_this_fiber) {
   // }
 }
@@ -127,6 +373,17 @@ void Scheduler::run() {
   if (arvin::GetThreadId() != m_rootThread) {
     t_scheduler_fiber = Fiber::GetThis().get();
   }
+  t_last_active_ms = arvin::GetMonotonicMS();
+  t_retired = false;
+
+  const int thread_id = arvin::GetThreadId();
+  WorkerStats::ptr stats(new WorkerStats);
+  stats->thread = thread_id;
+  {
+    MutexType::Lock lock(m_mutex);
+    m_workerStats.push_back(stats);
+  }
+  t_worker_stats = stats.get();
 
   Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this)));
   Fiber::ptr cb_fiber;
@@ -135,14 +392,15 @@ void Scheduler::run() {
   while (true) {
     ft.reset();
     bool tickle_me = false;
+    int tickle_thread = -1;
     bool is_active = false;
     {
       MutexType::Lock lock(m_mutex);
       auto it = m_fibers.begin();
       while (it != m_fibers.end()) {
-        if (it->thread != -1 && it->thread != arvin::GetThreadId()) {
+        if (it->thread != -1 && it->thread != thread_id) {
+          tickle_thread = it->thread;
           ++it;
-          tickle_me = true;
           continue;
         }
 
@@ -153,6 +411,10 @@ void Scheduler::run() {
         }
 
         ft = *it;
+        if (ft.thread == -1) {
+          --m_pendingTaskCount;
+        }
+        stats->queue_depth.record(m_fibers.size());
         m_fibers.erase(it++);
         ++m_activeThreadCount;
         is_active = true;
@@ -164,11 +426,40 @@ void Scheduler::run() {
     if (tickle_me) {
       tickle();
     }
+    if (tickle_thread != -1) {
+      tickleThread(tickle_thread);
+    }
+    uint64_t start_us = 0;
+    if (is_active) {
+      start_us = arvin::GetMonotonicUS();
+      // 任务中添加的定时器以此为起点, 连续执行任务时不回到idle也要刷新
+      arvin::UpdateLoopMS();
+      stats->slice_start_us.store(start_us, std::memory_order_relaxed);
+      t_last_active_ms = start_us / 1000;
+      stats->queue_wait_us.record(start_us - ft.ts);
+#if ARVIN_IO_TRACE
+      if (ft.ready_us) {
+        stats->io_dispatch_us.record(ft.ts - ft.ready_us);
+        stats->io_resume_us.record(start_us - ft.ready_us);
+      }
+#endif
+      if (ft.owner && ft.owner != stats.get()) {
+        stats->steals.fetch_add(1, std::memory_order_relaxed);
+      }
+      if (m_elastic) {
+        checkGrow(ft.ts);
+      }
+    }
 
     if (ft.fiber && (ft.fiber->getState() != Fiber::TERM &&
                      ft.fiber->getState() != Fiber::EXCEPT)) {
+      stats->fiber_id.store(ft.fiber->getId(), std::memory_order_relaxed);
       ft.fiber->swapIn();
       --m_activeThreadCount;
+      stats->slice_start_us.store(0, std::memory_order_relaxed);
+      stats->yield_requested.store(false, std::memory_order_relaxed);
+      stats->run_us.record(arvin::GetMonotonicUS() - start_us);
+      stats->tasks.fetch_add(1, std::memory_order_relaxed);
 
       if (ft.fiber->getState() == Fiber::READY) {
         schedule(ft.fiber);
@@ -184,8 +475,13 @@ void Scheduler::run() {
         cb_fiber.reset(new Fiber(ft.cb));
       }
       ft.reset();
+      stats->fiber_id.store(cb_fiber->getId(), std::memory_order_relaxed);
       cb_fiber->swapIn();
       --m_activeThreadCount;
+      stats->slice_start_us.store(0, std::memory_order_relaxed);
+      stats->yield_requested.store(false, std::memory_order_relaxed);
+      stats->run_us.record(arvin::GetMonotonicUS() - start_us);
+      stats->tasks.fetch_add(1, std::memory_order_relaxed);
       if (cb_fiber->getState() == Fiber::READY) {
         schedule(cb_fiber);
         cb_fiber.reset();
@@ -198,17 +494,27 @@ void Scheduler::run() {
       }
     } else {
       if (is_active) {
+        stats->slice_start_us.store(0, std::memory_order_relaxed);
         --m_activeThreadCount;
         continue;
       }
       if (idle_fiber->getState() == Fiber::TERM) {
         ARVIN_LOG_INFO(g_logger) << "idle fiber term";
+        if (thread_id != m_rootThread && !t_retired) {
+          --m_workerCount;
+        }
+        t_worker_stats = nullptr;
+        arvin::ClearLoopMS();
+        // caller线程退出调度后恢复为普通线程
+        set_hook_enable(false);
         break;
       }
 
       ++m_idleThreadCount;
+      uint64_t idle_start_us = arvin::GetMonotonicUS();
       idle_fiber->swapIn();
       --m_idleThreadCount;
+      stats->idle_us.record(arvin::GetMonotonicUS() - idle_start_us);
       if (idle_fiber->getState() != Fiber::TERM &&
           idle_fiber->getState() != Fiber::EXCEPT) {
         idle_fiber->m_state = Fiber::HOLD;
@@ -217,7 +523,49 @@ void Scheduler::run() {
   }
 }
 
-void Scheduler::tickle() { ARVIN_LOG_INFO(g_logger) << "tickle"; }
+void Scheduler::scheduleBatch(std::vector<FiberAndThread> &tasks) {
+  if (tasks.empty()) {
+    return;
+  }
+  bool need_tickle = false;
+  bool has_any = false;
+  // 指定了其他线程执行的任务需要定向唤醒
+  std::vector<int> threads;
+  const int self = arvin::GetThreadId();
+  {
+    MutexType::Lock lock(m_mutex);
+    need_tickle = m_fibers.empty();
+    uint64_t now_us = arvin::GetMonotonicUS();
+    const WorkerStats *owner = GetWorkerStats();
+    for (auto &i : tasks) {
+      if (!i.fiber && !i.cb) {
+        continue;
+      }
+      i.ts = now_us;
+      i.owner = owner;
+      if (i.thread == -1) {
+        ++m_pendingTaskCount;
+        has_any = true;
+      } else if (i.thread != self &&
+                 std::find(threads.begin(), threads.end(), i.thread) ==
+                     threads.end()) {
+        threads.push_back(i.thread);
+      }
+      m_fibers.push_back(std::move(i));
+    }
+  }
+  tasks.clear();
+  for (auto i : threads) {
+    tickleThread(i);
+  }
+  if (need_tickle && has_any) {
+    tickle();
+  }
+}
+
+void Scheduler::tickle() { wakeParked(); }
+
+void Scheduler::tickleThread(int thread) { wakeParked(thread); }
 
 bool Scheduler::stopping() {
   MutexType::Lock lock(m_mutex);
@@ -228,10 +576,110 @@ bool Scheduler::stopping() {
 void Scheduler::idle() {
   ARVIN_LOG_INFO(g_logger) << "idle";
   while (!stopping()) {
+    if (!idleSpin() && !idlePark() && shouldRetire()) {
+      break;
+    }
     arvin::Fiber::YieldToHold();
   }
 }
 
+bool Scheduler::idleSpin() {
+  for (uint32_t i = 0; i < m_idlePolicy.spin_count; ++i) {
+    if (hasPendingTasks()) {
+      return true;
+    }
+    CpuRelax();
+  }
+  for (uint32_t i = 0; i < m_idlePolicy.yield_count; ++i) {
+    if (hasPendingTasks()) {
+      return true;
+    }
+    sched_yield();
+  }
+  return hasPendingTasks();
+}
+
+bool Scheduler::idlePark() {
+  IdleWaiter waiter;
+  waiter.thread = arvin::GetThreadId();
+  {
+    Spinlock::Lock lock(m_idleMutex);
+    m_parked.push_back(&waiter);
+  }
+
+  // 先登记再检查, 保证与schedule/tickle之间不会丢失唤醒
+  uint64_t timeout = m_idlePolicy.park_ms;
+  if (hasRunnableTask(waiter.thread) || stopping()) {
+    timeout = 0;
+  } else if (m_stopping) {
+    // 正在停止时还有任务在执行, 它们结束时不会tickle, 只能短暂挂起后重新检查
+    timeout = std::min<uint64_t>(timeout, 10);
+  }
+
+  bool woken = false;
+  if (timeout) {
+    uint64_t park_start_us = arvin::GetMonotonicUS();
+    woken = waiter.parker.park(timeout);
+    if (t_worker_stats) {
+      t_worker_stats->park_us.record(arvin::GetMonotonicUS() - park_start_us);
+    }
+  }
+
+  Spinlock::Lock lock(m_idleMutex);
+  auto it = std::find(m_parked.begin(), m_parked.end(), &waiter);
+  if (it != m_parked.end()) {
+    m_parked.erase(it);
+  } else {
+    // 已被wakeParked摘下并在锁内完成了unpark
+    woken = true;
+  }
+  if (woken && t_worker_stats) {
+    t_worker_stats->wakeups.fetch_add(1, std::memory_order_relaxed);
+  }
+  return woken;
+}
+
+bool Scheduler::wakeParked(int thread) {
+  IdleWaiter *waiter = nullptr;
+  {
+    Spinlock::Lock lock(m_idleMutex);
+    if (m_parked.empty()) {
+      return false;
+    }
+    if (thread == -1) {
+      waiter = m_parked.back();
+      m_parked.pop_back();
+    } else {
+      for (auto it = m_parked.begin(); it != m_parked.end(); ++it) {
+        if ((*it)->thread == thread) {
+          waiter = *it;
+          m_parked.erase(it);
+          break;
+        }
+      }
+      if (!waiter) {
+        return false;
+      }
+    }
+    // 在锁内unpark, 保证waiter在此期间不会被销毁
+    waiter->parker.unpark();
+  }
+  if (t_worker_stats) {
+    t_worker_stats->tickles.fetch_add(1, std::memory_order_relaxed);
+  }
+  return true;
+}
+
+bool Scheduler::hasRunnableTask(int thread) {
+  MutexType::Lock lock(m_mutex);
+  for (auto &i : m_fibers) {
+    if (i.thread == -1 || i.thread == thread) {
+      return true;
+    }
+  }
+  return false;
+}
+
 void Scheduler::switchTo(int thread) {
   // ARVIN_ASSERT(Scheduler::GetThis() != nullptr);
   if (Scheduler::GetThis() == this) {
@@ -243,8 +691,30 @@ void Scheduler::switchTo(int thread) {
   Fiber::YieldToHold();
 }
 
+void Scheduler::getStats(Stats &stats) {
+  std::vector<WorkerStats::ptr> workers;
+  {
+    MutexType::Lock lock(m_mutex);
+    workers = m_workerStats;
+    stats.queue_size = m_fibers.size();
+    stats.total = m_retiredStats;
+  }
+  stats.workers = m_workerCount;
+  stats.active = m_activeThreadCount;
+  stats.idle = m_idleThreadCount;
+  stats.per_worker.resize(workers.size());
+  for (size_t i = 0; i < workers.size(); ++i) {
+    workers[i]->snapshot(stats.per_worker[i]);
+    stats.total.merge(stats.per_worker[i]);
+  }
+}
+
 std::ostream &Scheduler::dump(std::ostream &os) {
+  Stats stats;
+  getStats(stats);
+  MutexType::Lock lock(m_mutex);
   os << "[Scheduler name=" << m_name << " size=" << m_threadCount
+     << " workers=" << m_workerCount << " blocking=" << m_blockingCount
      << " active_count=" << m_activeThreadCount
      << " idle_count=" << m_idleThreadCount << " stopping=" << m_stopping
      << " ]" << std::endl
@@ -255,6 +725,19 @@ std::ostream &Scheduler::dump(std::ostream &os) {
     }
     os << m_threadIds[i];
   }
+  os << std::endl
+     << "    queue_size=" << stats.queue_size
+     << " tasks=" << stats.total.tasks << " steals=" << stats.total.steals
+     << " tickles=" << stats.total.tickles
+     << " wakeups=" << stats.total.wakeups << std::endl
+     << "    queue_wait_us: ";
+  stats.total.queue_wait_us.dump(os) << std::endl << "    run_us: ";
+  stats.total.run_us.dump(os);
+  if (stats.total.io_resume_us.count) {
+    os << std::endl << "    io_dispatch_us: ";
+    stats.total.io_dispatch_us.dump(os) << std::endl << "    io_resume_us: ";
+    stats.total.io_resume_us.dump(os);
+  }
   return os;
 }
 
@@ -271,4 +754,16 @@ SchedulerSwitcher::~SchedulerSwitcher() {
   }
 }
 
+BlockingSection::BlockingSection() : m_scheduler(Scheduler::GetThis()) {
+  if (m_scheduler) {
+    m_scheduler->enterBlocking();
+  }
+}
+
+BlockingSection::~BlockingSection() {
+  if (m_scheduler) {
+    m_scheduler->leaveBlocking();
+  }
+}
+
 } // namespace arvin
\ No newline at end of file
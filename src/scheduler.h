@@ -5,7 +5,9 @@
 #include <iostream>
 #include <cstddef>
 #include "fiber.h"
+#include "histogram.h"
 #include "thread.h"
+#include "util.h"
 
 namespace arvin {
 
@@ -19,6 +21,113 @@ public:
     typedef std::shared_ptr<Scheduler> ptr;
     typedef Mutex MutexType;
 
+    /**
+     * @brief 空闲策略
+     * @details 工作线程没有任务时, 先自旋检查任务队列, 再sched_yield让出CPU,
+     *          最后挂起在futex上, 由tickle定向唤醒
+     */
+    struct IdlePolicy {
+        /// 自旋检查的次数
+        uint32_t spin_count = 0;
+        /// sched_yield的次数
+        uint32_t yield_count = 0;
+        /// 单次挂起的最长时间(毫秒)
+        uint32_t park_ms = 0;
+    };
+
+    /**
+     * @brief 工作线程统计快照
+     */
+    struct WorkerStatsData {
+        /// 线程id
+        int thread = 0;
+        /// 执行的任务数
+        uint64_t tasks = 0;
+        /// 执行的由其他线程投递的任务数
+        uint64_t steals = 0;
+        /// 本线程发出的唤醒数
+        uint64_t tickles = 0;
+        /// 本线程挂起后被唤醒的次数
+        uint64_t wakeups = 0;
+        /// 任务执行超过时间片的次数
+        uint64_t overruns = 0;
+        /// 超时任务在安全点让出的次数
+        uint64_t preempts = 0;
+        /// 取任务时的队列长度
+        Histogram::Data queue_depth;
+        /// 任务排队时间(微秒)
+        Histogram::Data queue_wait_us;
+        /// 任务单次执行时间(微秒)
+        Histogram::Data run_us;
+        /// 单次空闲时间(微秒)
+        Histogram::Data idle_us;
+        /// 单次挂起时间(微秒)
+        Histogram::Data park_us;
+        /// IO就绪(epoll返回)到入队的时间(微秒), 需开启ARVIN_IO_TRACE
+        Histogram::Data io_dispatch_us;
+        /// IO就绪(epoll返回)到协程恢复执行的时间(微秒), 需开启ARVIN_IO_TRACE
+        Histogram::Data io_resume_us;
+
+        /**
+         * @brief 合并另一个线程的统计
+         */
+        void merge(const WorkerStatsData& o);
+    };
+
+    /**
+     * @brief 调度器统计快照
+     */
+    struct Stats {
+        /// 当前队列长度
+        size_t queue_size = 0;
+        /// 当前工作线程数量
+        size_t workers = 0;
+        /// 正在执行任务的线程数量
+        size_t active = 0;
+        /// 空闲线程数量
+        size_t idle = 0;
+        /// 各工作线程的统计
+        std::vector<WorkerStatsData> per_worker;
+        /// 所有线程(含已退出线程)的合计
+        WorkerStatsData total;
+    };
+
+    /**
+     * @brief 工作线程的统计(只由所属线程写入)
+     */
+    struct WorkerStats {
+        typedef std::shared_ptr<WorkerStats> ptr;
+        int thread = 0;
+        std::atomic<uint64_t> tasks = {0};
+        std::atomic<uint64_t> steals = {0};
+        std::atomic<uint64_t> tickles = {0};
+        std::atomic<uint64_t> wakeups = {0};
+        std::atomic<uint64_t> overruns = {0};
+        std::atomic<uint64_t> preempts = {0};
+        /// 当前任务开始执行的单调时间(微秒), 0表示没有在执行任务
+        std::atomic<uint64_t> slice_start_us = {0};
+        /// 当前执行任务的协程id, 供watchdog定位超时的任务
+        std::atomic<uint64_t> fiber_id = {0};
+        /// watchdog请求当前任务在安全点让出
+        std::atomic<bool> yield_requested = {false};
+        /// watchdog已记录超时的任务开始时间(只由watchdog读写)
+        uint64_t overrun_start = 0;
+        Histogram queue_depth;
+        Histogram queue_wait_us;
+        Histogram run_us;
+        Histogram idle_us;
+        Histogram park_us;
+#if ARVIN_IO_TRACE
+        Histogram io_dispatch_us;
+        Histogram io_resume_us;
+#endif
+
+        /**
+         * @brief 拷贝统计
+         */
+        void snapshot(WorkerStatsData& d) const;
+    };
+
     /**
      * @brief 构造函数
      * @param[in] threads 线程数量
@@ -47,6 +156,11 @@ public:
      */
     static Fiber* GetMainFiber();
 
+    /**
+     * @brief 返回当前线程的统计, 非工作线程返回nullptr
+     */
+    static WorkerStats* GetWorkerStats();
+
     /**
      * @brief 启动协程调度器
      */
@@ -70,7 +184,9 @@ public:
             need_tickle = scheduleNoLock(fc, thread);
         }
 
-        if(need_tickle) {
+        if(thread != -1) {
+            tickleThread(thread);
+        } else if(need_tickle) {
             tickle();
         }
     }
@@ -95,6 +211,67 @@ public:
         }
     }
 
+    /**
+     * @brief 设置空闲策略
+     */
+    void setIdlePolicy(const IdlePolicy& v) { m_idlePolicy = v;}
+
+    /**
+     * @brief 返回空闲策略
+     */
+    const IdlePolicy& getIdlePolicy() const { return m_idlePolicy;}
+
+    /**
+     * @brief 设置任务时间片
+     * @details 大于0时启动watchdog线程, 任务执行超过时间片且有其他任务排队时,
+     *          请求其在下一个Fiber::MaybeYield安全点让出
+     * @param[in] ms 时间片(毫秒), 0表示关闭
+     * @pre 在start之前调用
+     */
+    void setTimeSlice(uint32_t ms) { m_timeSlice = ms;}
+
+    /**
+     * @brief 返回任务时间片(毫秒)
+     */
+    uint32_t getTimeSlice() const { return m_timeSlice;}
+
+    /**
+     * @brief 开启弹性线程池
+     * @details 任务持续积压时增加工作线程, 工作线程持续空闲时退出
+     * @param[in] min_threads 最少工作线程数量(不含caller线程)
+     * @param[in] max_threads 最多工作线程数量(不含caller线程)
+     * @pre 在start之前调用
+     */
+    void setElastic(size_t min_threads, size_t max_threads);
+
+    /**
+     * @brief 是否为弹性线程池
+     */
+    bool isElastic() const { return m_elastic;}
+
+    /**
+     * @brief 返回当前的工作线程数量(不含caller线程)
+     */
+    size_t getWorkerCount() const { return m_workerCount;}
+
+    /**
+     * @brief 当前协程进入阻塞区间
+     * @details 即将执行无法避免的阻塞调用前调用, 没有空闲线程时补充一个工作线程
+     *          接管任务队列, 补充的线程空闲超时后自动退出
+     */
+    void enterBlocking();
+
+    /**
+     * @brief 当前协程离开阻塞区间
+     */
+    void leaveBlocking();
+
+    /**
+     * @brief 获取统计快照
+     * @details 计数器均为无锁原子变量, 仅在拷贝工作线程列表时短暂加锁
+     */
+    void getStats(Stats& stats);
+
     void switchTo(int thread = -1);
     std::ostream& dump(std::ostream& os);
 protected:
@@ -103,6 +280,12 @@ protected:
      */
 
     virtual void tickle();
+
+    /**
+     * @brief 通知指定线程有任务了
+     * @param[in] thread 线程id
+     */
+    virtual void tickleThread(int thread);
     /**
      * @brief 协程调度函数
      */
@@ -127,6 +310,53 @@ protected:
      * @brief 是否有空闲线程
      */
     bool hasIdleThreads() { return m_idleThreadCount > 0;}
+
+    /**
+     * @brief 是否有未指定线程的待执行任务(无锁, 用于自旋检查)
+     */
+    bool hasPendingTasks() const { return m_pendingTaskCount > 0;}
+
+    /**
+     * @brief 队列中是否有指定线程可执行的任务
+     */
+    bool hasRunnableTask(int thread);
+
+    /**
+     * @brief 空闲策略的自旋与让出阶段
+     * @return 期间是否发现了待执行的任务
+     */
+    bool idleSpin();
+
+    /**
+     * @brief 将当前工作线程挂起在futex上, 直到被唤醒或超时
+     * @return 是否被唤醒
+     */
+    bool idlePark();
+
+    /**
+     * @brief 唤醒一个挂起中的工作线程
+     * @param[in] thread 线程id, -1表示任意线程
+     * @return 是否唤醒了线程
+     */
+    bool wakeParked(int thread = -1);
+
+    /**
+     * @brief 增加一个工作线程
+     * @return 是否增加成功(受最大线程数限制)
+     */
+    bool addThread();
+
+    /**
+     * @brief 当前工作线程是否应该退出(持续空闲且线程数多于下限)
+     * @details 队列中有固定到本线程的任务时不退出
+     * @post 返回true时已从工作线程计数中扣除
+     */
+    bool shouldRetire();
+
+    /**
+     * @brief watchdog线程, 检查执行超过时间片的任务
+     */
+    void watchdog();
 private:
     /**
      * @brief 协程调度启动(无锁)
@@ -136,11 +366,16 @@ private:
         bool need_tickle = m_fibers.empty();
         FiberAndThread ft(fc, thread);
         if(ft.fiber || ft.cb) {
+            ft.ts = arvin::GetMonotonicUS();
+            ft.owner = GetWorkerStats();
             m_fibers.push_back(ft);
+            if(thread == -1) {
+                ++m_pendingTaskCount;
+            }
         }
         return need_tickle;
     }
-private:
+protected:
     /**
      * @brief 协程/函数/线程组
      */
@@ -151,6 +386,14 @@ private:
         std::function<void()> cb;
         /// 线程id
         int thread;
+        /// 入队的单调时间(微秒)
+        uint64_t ts = 0;
+        /// 投递任务的工作线程
+        const WorkerStats* owner = nullptr;
+#if ARVIN_IO_TRACE
+        /// IO就绪的单调时间(微秒), 0表示不是IO事件
+        uint64_t ready_us = 0;
+#endif
 
         /**
          * @brief 构造函数
@@ -206,8 +449,37 @@ private:
             fiber = nullptr;
             cb = nullptr;
             thread = -1;
+            ts = 0;
+            owner = nullptr;
+#if ARVIN_IO_TRACE
+            ready_us = 0;
+#endif
         }
     };
+
+    /**
+     * @brief 批量调度任务
+     * @details 整批只加一次锁, 队列原本为空时只tickle一次, 指定线程的任务定向唤醒,
+     *          其余工作线程由取到任务的线程级联唤醒
+     * @param[in, out] tasks 任务数组, 调用后被清空
+     */
+    void scheduleBatch(std::vector<FiberAndThread>& tasks);
+private:
+    /**
+     * @brief 挂起中的工作线程
+     */
+    struct IdleWaiter {
+        /// 线程id
+        int thread;
+        /// 挂起/唤醒原语
+        Parker parker;
+    };
+
+    /**
+     * @brief 任务积压时按需增加工作线程
+     * @param[in] ts 刚取出的任务的入队时间(微秒)
+     */
+    void checkGrow(uint64_t ts);
 private:
     /// Mutex
     MutexType m_mutex;
@@ -219,15 +491,49 @@ private:
     Fiber::ptr m_rootFiber;
     /// 协程调度器名称
     std::string m_name;
+    /// 挂起线程列表的锁
+    Spinlock m_idleMutex;
+    /// 挂起中的工作线程(后进先出, 优先唤醒缓存最热的线程)
+    std::vector<IdleWaiter*> m_parked;
+    /// 空闲策略
+    IdlePolicy m_idlePolicy;
+    /// 已退出等待回收的工作线程id
+    std::vector<int> m_retiredIds;
+    /// 工作线程名称序号
+    size_t m_threadSeq = 0;
+    /// 任务开始持续积压的时间(毫秒), 0表示未积压
+    std::atomic<uint64_t> m_saturatedSince = {0};
+    /// 各工作线程的统计
+    std::vector<WorkerStats::ptr> m_workerStats;
+    /// 已回收线程的累计统计
+    WorkerStatsData m_retiredStats;
+    /// 任务时间片(毫秒)
+    uint32_t m_timeSlice = 0;
+    /// watchdog线程
+    Thread::ptr m_watchdog;
+    /// 用于唤醒watchdog线程退出
+    Parker m_watchdogParker;
 protected:
     /// 协程下的线程id数组
     std::vector<int> m_threadIds;
     /// 线程数量
     size_t m_threadCount = 0;
+    /// 是否为弹性线程池
+    bool m_elastic = false;
+    /// 最少工作线程数量
+    size_t m_minThreads = 0;
+    /// 最多工作线程数量
+    size_t m_maxThreads = 0;
+    /// 当前工作线程数量(不含caller线程)
+    std::atomic<size_t> m_workerCount = {0};
+    /// 处于阻塞区间的协程数量
+    std::atomic<size_t> m_blockingCount = {0};
     /// 工作线程数量
     std::atomic<size_t> m_activeThreadCount = {0};
     /// 空闲线程数量
     std::atomic<size_t> m_idleThreadCount = {0};
+    /// 未指定线程的待执行任务数量
+    std::atomic<size_t> m_pendingTaskCount = {0};
     /// 是否正在停止
     bool m_stopping = true;
     /// 是否自动停止
@@ -244,4 +550,16 @@ private:
     Scheduler* m_caller;
 };
 
+/**
+ * @brief 阻塞区间(RAII)
+ * @details 在协程中包裹第三方库等无法避免的阻塞调用, 期间由其他工作线程接管任务队列
+ */
+class BlockingSection : public Noncopyable {
+public:
+    BlockingSection();
+    ~BlockingSection();
+private:
+    Scheduler* m_scheduler;
+};
+
 }
\ No newline at end of file
@@ -1,9 +1,52 @@
 #include "socket.h"
+#include "config.h"
+#include "fd_manager.h"
+#include "hook.h"
+#include "iomanager.h"
 #include "log.h"
+#include "macro.h"
+#include "mutex.h"
+#include "util.h"
 #include <limits.h>
+#include <linux/errqueue.h>
+#include <poll.h>
+#include <sstream>
+#include <string.h>
+#include <unordered_map>
 
 namespace arvin {
 static arvin::Logger::ptr g_logger = ARVIN_LOG_NAME("system");
+
+static ConfigVar<uint32_t>::ptr g_zerocopy_min_size = Config::Lookup<uint32_t>(
+    "socket.zerocopy.min_size", 16384,
+    "smaller sendZeroCopy buffers are copied, pinning pages costs more");
+static ConfigVar<uint64_t>::ptr g_zerocopy_close_timeout =
+    Config::Lookup<uint64_t>(
+        "socket.zerocopy.close_timeout", 1000,
+        "max ms close waits for outstanding zerocopy completions");
+
+struct Socket::ZeroCopyState {
+  /**
+   * @brief 一次sendZeroCopy的缓冲区
+   */
+  struct Buffer {
+    /// 未完成的发送数(含正在进行的sendZeroCopy)
+    uint32_t remaining = 1;
+    std::function<void()> done;
+  };
+
+  Mutex mutex;
+  /// 是否开启
+  bool enabled = false;
+  /// 内核为下一次成功的MSG_ZEROCOPY发送分配的编号
+  uint32_t next_id = 0;
+  /// 发送编号 -> 缓冲区
+  std::unordered_map<uint32_t, std::shared_ptr<Buffer>> ids;
+  /// 未完成的缓冲区数
+  size_t buffers = 0;
+  /// 被退化为拷贝的通知数
+  uint64_t copied = 0;
+};
 Socket::ptr Socket::CreateTCP(arvin::Address::ptr address) {
   Socket::ptr sock(new Socket(address->getFamily(), TCP, 0));
   return sock;
@@ -54,6 +97,631 @@ Socket::Socket(int family, int type, int protocol)
 
 Socket::~Socket() { close(); }
 
+int64_t Socket::getSendTimeout() {
+  FdCtx *ctx = FdMgr::GetInstance()->get(m_sock);
+  if (ctx) {
+    return ctx->getTimeout(SO_SNDTIMEO);
+  }
+  return -1;
+}
+
+void Socket::setSendTimeout(int64_t v) {
+  struct timeval tv {
+    int(v / 1000), int(v % 1000 * 1000)
+  };
+  setOption(SOL_SOCKET, SO_SNDTIMEO, tv);
+}
+
+int64_t Socket::getRecvTimeout() {
+  FdCtx *ctx = FdMgr::GetInstance()->get(m_sock);
+  if (ctx) {
+    return ctx->getTimeout(SO_RCVTIMEO);
+  }
+  return -1;
+}
+
+void Socket::setRecvTimeout(int64_t v) {
+  struct timeval tv {
+    int(v / 1000), int(v % 1000 * 1000)
+  };
+  setOption(SOL_SOCKET, SO_RCVTIMEO, tv);
+}
+
+bool Socket::getOption(int level, int option, void *result, socklen_t *len) {
+  int rt = getsockopt(m_sock, level, option, result, (socklen_t *)len);
+  if (rt) {
+    ARVIN_LOG_DEBUG(g_logger) << "getOption sock=" << m_sock
+                              << " level=" << level << " option=" << option
+                              << " errno=" << errno
+                              << " errstr=" << strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+bool Socket::setOption(int level, int option, const void *result,
+                       socklen_t len) {
+  if (setsockopt(m_sock, level, option, result, (socklen_t)len)) {
+    ARVIN_LOG_DEBUG(g_logger) << "setOption sock=" << m_sock
+                              << " level=" << level << " option=" << option
+                              << " errno=" << errno
+                              << " errstr=" << strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+Socket::ptr Socket::accept() {
+  Socket::ptr sock(new Socket(m_family, m_type, m_protocol));
+  int newsock = ::accept(m_sock, nullptr, nullptr);
+  if (newsock == -1) {
+    ARVIN_LOG_ERROR(g_logger) << "accept(" << m_sock << ") errno=" << errno
+                              << " errstr=" << strerror(errno);
+    return nullptr;
+  }
+  if (sock->init(newsock)) {
+    return sock;
+  }
+  return nullptr;
+}
+
+bool Socket::init(int sock) {
+  FdCtx *ctx = FdMgr::GetInstance()->get(sock);
+  if (ctx && ctx->isSocket() && !ctx->isClose()) {
+    m_sock = sock;
+    m_isConnected = true;
+    initSock();
+    getLocalAddress();
+    getRemoteAddress();
+    return true;
+  }
+  return false;
+}
+
+bool Socket::bind(const Address::ptr addr) {
+  if (!isValid()) {
+    newSock();
+    if (ARVIN_UNLIKELY(!isValid())) {
+      return false;
+    }
+  }
+
+  if (ARVIN_UNLIKELY(addr->getFamily() != m_family)) {
+    ARVIN_LOG_ERROR(g_logger)
+        << "bind sock.family(" << m_family << ") addr.family("
+        << addr->getFamily() << ") not equal, addr=" << addr->toString();
+    return false;
+  }
+
+  UnixAddress::ptr uaddr = std::dynamic_pointer_cast<UnixAddress>(addr);
+  if (uaddr) {
+    Socket::ptr sock = Socket::CreateUnixTCPSocket();
+    if (sock->connect(uaddr)) {
+      return false;
+    }
+    unlink(uaddr->getPath().c_str());
+  }
+
+  if (::bind(m_sock, addr->getAddr(), addr->getAddrLen())) {
+    ARVIN_LOG_ERROR(g_logger) << "bind error errno=" << errno
+                              << " errstr=" << strerror(errno);
+    return false;
+  }
+  getLocalAddress();
+  return true;
+}
+
+bool Socket::reconnect(uint64_t timeout_ms) {
+  if (!m_remoteAddress) {
+    ARVIN_LOG_ERROR(g_logger) << "reconnect m_remoteAddress is null";
+    return false;
+  }
+  m_localAddress.reset();
+  return connect(m_remoteAddress, timeout_ms);
+}
+
+bool Socket::connect(const Address::ptr addr, uint64_t timeout_ms) {
+  m_remoteAddress = addr;
+  if (!isValid()) {
+    newSock();
+    if (ARVIN_UNLIKELY(!isValid())) {
+      return false;
+    }
+  }
+
+  if (ARVIN_UNLIKELY(addr->getFamily() != m_family)) {
+    ARVIN_LOG_ERROR(g_logger)
+        << "connect sock.family(" << m_family << ") addr.family("
+        << addr->getFamily() << ") not equal, addr=" << addr->toString();
+    return false;
+  }
+
+  if (timeout_ms == (uint64_t)-1) {
+    if (::connect(m_sock, addr->getAddr(), addr->getAddrLen())) {
+      ARVIN_LOG_ERROR(g_logger)
+          << "sock=" << m_sock << " connect(" << addr->toString()
+          << ") error errno=" << errno << " errstr=" << strerror(errno);
+      close();
+      return false;
+    }
+  } else {
+    if (::connect_with_timeout(m_sock, addr->getAddr(), addr->getAddrLen(),
+                               timeout_ms)) {
+      ARVIN_LOG_ERROR(g_logger)
+          << "sock=" << m_sock << " connect(" << addr->toString()
+          << ") timeout=" << timeout_ms << " error errno=" << errno
+          << " errstr=" << strerror(errno);
+      close();
+      return false;
+    }
+  }
+  m_isConnected = true;
+  getRemoteAddress();
+  getLocalAddress();
+  return true;
+}
+
+bool Socket::listen(int backlog) {
+  if (!isValid()) {
+    ARVIN_LOG_ERROR(g_logger) << "listen error sock=-1";
+    return false;
+  }
+  if (::listen(m_sock, backlog)) {
+    ARVIN_LOG_ERROR(g_logger) << "listen error errno=" << errno
+                              << " errstr=" << strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+bool Socket::close() {
+  if (!m_isConnected && m_sock == -1) {
+    return true;
+  }
+  m_isConnected = false;
+  if (m_sock != -1) {
+    if (m_zerocopy) {
+      // 关闭后无法再收取通知, 尽量等内核用完已发送的缓冲区
+      size_t pending = reapZeroCopy(g_zerocopy_close_timeout->getValue());
+      if (pending) {
+        ARVIN_LOG_WARN(g_logger)
+            << "close sock=" << m_sock << " with " << pending
+            << " zerocopy buffers not completed, their callbacks are dropped";
+      }
+    }
+    ::close(m_sock);
+    m_sock = -1;
+  }
+  return false;
+}
+
+int Socket::send(const void *buffer, size_t length, int flags) {
+  if (isConnected()) {
+    return ::send(m_sock, buffer, length, flags);
+  }
+  return -1;
+}
+
+int Socket::send(const iovec *buffers, size_t length, int flags) {
+  if (isConnected()) {
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (iovec *)buffers;
+    msg.msg_iovlen = length;
+    return ::sendmsg(m_sock, &msg, flags);
+  }
+  return -1;
+}
+
+int Socket::sendTo(const void *buffer, size_t length, const Address::ptr to,
+                   int flags) {
+  if (isConnected()) {
+    return ::sendto(m_sock, buffer, length, flags, to->getAddr(),
+                    to->getAddrLen());
+  }
+  return -1;
+}
+
+int Socket::sendTo(const iovec *buffers, size_t length, const Address::ptr to,
+                   int flags) {
+  if (isConnected()) {
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (iovec *)buffers;
+    msg.msg_iovlen = length;
+    msg.msg_name = to->getAddr();
+    msg.msg_namelen = to->getAddrLen();
+    return ::sendmsg(m_sock, &msg, flags);
+  }
+  return -1;
+}
+
+int64_t Socket::sendFile(int fd, off_t offset, size_t length) {
+  if (!isConnected()) {
+    return -1;
+  }
+  // sendfile经过hook, 写缓冲区满时挂起协程; 数据在内核中从页缓存直接进入socket
+  size_t total = 0;
+  while (total < length) {
+    ssize_t n = ::sendfile(m_sock, fd, &offset, length - total);
+    if (n <= 0) {
+      return total ? (int64_t)total : n;
+    }
+    total += n;
+  }
+  return total;
+}
+
+bool Socket::setZeroCopy(bool v) {
+  if (!isValid()) {
+    newSock();
+    if (ARVIN_UNLIKELY(!isValid())) {
+      return false;
+    }
+  }
+  int val = v;
+  if (!setOption(SOL_SOCKET, SO_ZEROCOPY, val)) {
+    return false;
+  }
+  // 关闭后保留状态: 未收取的通知仍需处理, 内核编号也不会重置
+  if (!m_zerocopy) {
+    m_zerocopy.reset(new ZeroCopyState);
+  }
+  Mutex::Lock lock(m_zerocopy->mutex);
+  m_zerocopy->enabled = v;
+  return true;
+}
+
+bool Socket::isZeroCopy() const {
+  if (!m_zerocopy) {
+    return false;
+  }
+  Mutex::Lock lock(m_zerocopy->mutex);
+  return m_zerocopy->enabled;
+}
+
+uint64_t Socket::getZeroCopyCopied() const {
+  if (!m_zerocopy) {
+    return 0;
+  }
+  Mutex::Lock lock(m_zerocopy->mutex);
+  return m_zerocopy->copied;
+}
+
+int Socket::sendZeroCopy(const void *buffer, size_t length,
+                         std::function<void()> done, int flags) {
+  std::shared_ptr<ZeroCopyState> state = m_zerocopy;
+  if (!isConnected() || !isZeroCopy() ||
+      length < g_zerocopy_min_size->getValue()) {
+    int rt = send(buffer, length, flags);
+    if (done) {
+      done();
+    }
+    return rt;
+  }
+
+  std::shared_ptr<ZeroCopyState::Buffer> buf(new ZeroCopyState::Buffer);
+  buf->done.swap(done);
+  {
+    Mutex::Lock lock(state->mutex);
+    ++state->buffers;
+  }
+
+  const char *data = (const char *)buffer;
+  size_t offset = 0;
+  ssize_t rt = 0;
+  while (offset < length) {
+    uint32_t id;
+    {
+      // 先登记编号, 其他线程收取通知时不会错过这次发送
+      Mutex::Lock lock(state->mutex);
+      id = state->next_id;
+      state->ids[id] = buf;
+      ++buf->remaining;
+    }
+    rt = ::send(m_sock, data + offset, length - offset, flags | MSG_ZEROCOPY);
+    {
+      Mutex::Lock lock(state->mutex);
+      if (rt > 0) {
+        ++state->next_id;
+      } else {
+        state->ids.erase(id);
+        --buf->remaining;
+      }
+    }
+    if (rt < 0 && errno == ENOBUFS) {
+      // 未收取的通知占满了optmem, 收取后这一段改为拷贝发送
+      collectZeroCopy();
+      rt = ::send(m_sock, data + offset, length - offset, flags);
+    }
+    if (rt <= 0) {
+      break;
+    }
+    offset += rt;
+  }
+
+  // 发送结束, 释放正在发送的计数
+  std::function<void()> cb;
+  {
+    Mutex::Lock lock(state->mutex);
+    if (--buf->remaining == 0) {
+      --state->buffers;
+      cb.swap(buf->done);
+    }
+  }
+  if (cb) {
+    cb();
+  }
+  collectZeroCopy();
+  return offset ? (int)offset : (int)rt;
+}
+
+size_t Socket::collectZeroCopy() {
+  std::shared_ptr<ZeroCopyState> state = m_zerocopy;
+  if (!state) {
+    return 0;
+  }
+  std::vector<std::function<void()>> cbs;
+  while (isValid()) {
+    char control[128];
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    // 错误队列不走hook, 没有通知时立即返回
+    if (recvmsg_f(m_sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+      break;
+    }
+    for (cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+      if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+          !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+        continue;
+      }
+      const sock_extended_err *err = (const sock_extended_err *)CMSG_DATA(cm);
+      if (err->ee_origin != SO_EE_ORIGIN_ZEROCOPY || err->ee_errno) {
+        continue;
+      }
+      Mutex::Lock lock(state->mutex);
+      if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+        ++state->copied;
+      }
+      // [ee_info, ee_data]为完成的发送编号区间, 编号可能回绕
+      for (uint32_t id = err->ee_info;; ++id) {
+        auto it = state->ids.find(id);
+        if (it != state->ids.end()) {
+          std::shared_ptr<ZeroCopyState::Buffer> buf = it->second;
+          state->ids.erase(it);
+          if (--buf->remaining == 0) {
+            --state->buffers;
+            cbs.emplace_back();
+            cbs.back().swap(buf->done);
+          }
+        }
+        if (id == err->ee_data) {
+          break;
+        }
+      }
+    }
+  }
+
+  size_t pending;
+  {
+    Mutex::Lock lock(state->mutex);
+    pending = state->buffers;
+  }
+  for (auto &cb : cbs) {
+    if (cb) {
+      cb();
+    }
+  }
+  return pending;
+}
+
+/**
+ * @brief 等待fd的错误队列可读(EPOLLERR)
+ * @details IOManager把EPOLLERR同时投递给PRI等待者, 协程中等待PRI事件,
+ *          不占用读写方向; 不在IOManager中时用poll等待
+ */
+static void wait_error_queue(int fd, uint64_t timeout_ms) {
+  IOManager *iom = IOManager::GetThis();
+  if (!iom) {
+    pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = 0;
+    pfd.revents = 0;
+    poll(&pfd, 1, timeout_ms > INT_MAX ? -1 : (int)timeout_ms);
+    return;
+  }
+  std::shared_ptr<int> cond(new int(0));
+  std::weak_ptr<int> wcond(cond);
+  Timer::ptr timer;
+  if (timeout_ms != ~0ull) {
+    timer = iom->addConditionTimer(
+        timeout_ms, [iom, fd]() { iom->cancelEvent(fd, IOManager::PRI); },
+        wcond);
+  }
+  if (iom->addEvent(fd, IOManager::PRI) == 0) {
+    Fiber::YieldToHold();
+  }
+  cond.reset();
+  if (timer) {
+    timer->cancel();
+  }
+}
+
+size_t Socket::reapZeroCopy(uint64_t timeout_ms) {
+  uint64_t start = GetMonotonicMS();
+  while (true) {
+    size_t pending = collectZeroCopy();
+    uint64_t elapsed = GetMonotonicMS() - start;
+    if (!pending || elapsed >= timeout_ms || !isValid()) {
+      return pending;
+    }
+    wait_error_queue(m_sock,
+                     timeout_ms == ~0ull ? ~0ull : timeout_ms - elapsed);
+  }
+}
+
+int Socket::recv(void *buffer, size_t length, int flags) {
+  if (isConnected()) {
+    return ::recv(m_sock, buffer, length, flags);
+  }
+  return -1;
+}
+
+int Socket::recv(iovec *buffers, size_t length, int flags) {
+  if (isConnected()) {
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (iovec *)buffers;
+    msg.msg_iovlen = length;
+    return ::recvmsg(m_sock, &msg, flags);
+  }
+  return -1;
+}
+
+int Socket::recvFrom(void *buffer, size_t length, Address::ptr from,
+                     int flags) {
+  if (isConnected()) {
+    socklen_t len = from->getAddrLen();
+    return ::recvfrom(m_sock, buffer, length, flags, from->getAddr(), &len);
+  }
+  return -1;
+}
+
+int Socket::recvFrom(iovec *buffers, size_t length, Address::ptr from,
+                     int flags) {
+  if (isConnected()) {
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (iovec *)buffers;
+    msg.msg_iovlen = length;
+    msg.msg_name = from->getAddr();
+    msg.msg_namelen = from->getAddrLen();
+    return ::recvmsg(m_sock, &msg, flags);
+  }
+  return -1;
+}
+
+/**
+ * @brief 按协议簇创建空地址, 供getsockname/getpeername填充
+ */
+static Address::ptr CreateEmptyAddress(int family) {
+  switch (family) {
+  case AF_INET:
+    return Address::ptr(new IPv4Address());
+  case AF_INET6:
+    return Address::ptr(new IPv6Address());
+  case AF_UNIX:
+    return Address::ptr(new UnixAddress());
+  default:
+    return Address::ptr(new UnknownAddress(family));
+  }
+}
 
+Address::ptr Socket::getRemoteAddress() {
+  if (m_remoteAddress) {
+    return m_remoteAddress;
+  }
+  Address::ptr result = CreateEmptyAddress(m_family);
+  socklen_t addrlen = result->getAddrLen();
+  if (getpeername(m_sock, result->getAddr(), &addrlen)) {
+    return Address::ptr(new UnknownAddress(m_family));
+  }
+  if (m_family == AF_UNIX) {
+    UnixAddress::ptr addr = std::dynamic_pointer_cast<UnixAddress>(result);
+    addr->setAddrLen(addrlen);
+  }
+  m_remoteAddress = result;
+  return m_remoteAddress;
+}
+
+Address::ptr Socket::getLocalAddress() {
+  if (m_localAddress) {
+    return m_localAddress;
+  }
+  Address::ptr result = CreateEmptyAddress(m_family);
+  socklen_t addrlen = result->getAddrLen();
+  if (getsockname(m_sock, result->getAddr(), &addrlen)) {
+    ARVIN_LOG_ERROR(g_logger) << "getsockname error sock=" << m_sock
+                              << " errno=" << errno
+                              << " errstr=" << strerror(errno);
+    return Address::ptr(new UnknownAddress(m_family));
+  }
+  if (m_family == AF_UNIX) {
+    UnixAddress::ptr addr = std::dynamic_pointer_cast<UnixAddress>(result);
+    addr->setAddrLen(addrlen);
+  }
+  m_localAddress = result;
+  return m_localAddress;
+}
+
+bool Socket::isValid() const { return m_sock != -1; }
+
+int Socket::getError() {
+  int error = 0;
+  socklen_t len = sizeof(error);
+  if (!getOption(SOL_SOCKET, SO_ERROR, &error, &len)) {
+    error = errno;
+  }
+  return error;
+}
+
+std::ostream &Socket::dump(std::ostream &os) const {
+  os << "[Socket sock=" << m_sock << " is_connected=" << m_isConnected
+     << " family=" << m_family << " type=" << m_type
+     << " protocol=" << m_protocol;
+  if (m_localAddress) {
+    os << " local_address=" << m_localAddress->toString();
+  }
+  if (m_remoteAddress) {
+    os << " remote_address=" << m_remoteAddress->toString();
+  }
+  os << "]";
+  return os;
+}
+
+std::string Socket::toString() const {
+  std::stringstream ss;
+  dump(ss);
+  return ss.str();
+}
+
+bool Socket::cancelRead() {
+  return IOManager::GetThis()->cancelEvent(m_sock, arvin::IOManager::READ);
+}
+
+bool Socket::cancelWrite() {
+  return IOManager::GetThis()->cancelEvent(m_sock, arvin::IOManager::WRITE);
+}
+
+bool Socket::cancelAccept() {
+  return IOManager::GetThis()->cancelEvent(m_sock, arvin::IOManager::READ);
+}
+
+bool Socket::cancelAll() { return IOManager::GetThis()->cancelAll(m_sock); }
+
+void Socket::initSock() {
+  int val = 1;
+  setOption(SOL_SOCKET, SO_REUSEADDR, val);
+  if (m_type == SOCK_STREAM) {
+    setOption(IPPROTO_TCP, TCP_NODELAY, val);
+  }
+}
+
+void Socket::newSock() {
+  m_sock = socket(m_family, m_type, m_protocol);
+  if (ARVIN_LIKELY(m_sock != -1)) {
+    initSock();
+  } else {
+    ARVIN_LOG_ERROR(g_logger) << "socket(" << m_family << ", " << m_type << ", "
+                              << m_protocol << ") errno=" << errno
+                              << " errstr=" << strerror(errno);
+  }
+}
+
+std::ostream &operator<<(std::ostream &os, const Socket &sock) {
+  return sock.dump(os);
+}
 
 } // namespace arvin
\ No newline at end of file
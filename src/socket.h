@@ -1,5 +1,6 @@
 #pragma once
 
+#include <functional>
 #include <memory>
 #include <netinet/tcp.h>
 #include <sys/types.h>
@@ -229,6 +230,62 @@ public:
      */
     virtual int sendTo(const iovec* buffers, size_t length, const Address::ptr to, int flags = 0);
 
+    /**
+     * @brief 发送文件内容
+     * @details 通过sendfile在内核中把fd的数据直接写入socket, 不经过用户态缓冲区.
+     *          写缓冲区满时只挂起当前协程, 直到发完length字节、文件结束或出错
+     * @param[in] fd 源文件句柄, 不改变它的文件偏移
+     * @param[in] offset 起始偏移
+     * @param[in] length 发送的字节数
+     * @return
+     *      @retval >0 发送成功对应大小的数据(文件提前结束或发送部分后出错时小于length)
+     *      @retval =0 offset已在文件末尾或length为0, 没有发送数据
+     *      @retval <0 未发送任何数据就出错(对端关闭时为EPIPE/ECONNRESET, 见errno)
+     */
+    virtual int64_t sendFile(int fd, off_t offset, size_t length);
+
+    /**
+     * @brief 开启/关闭MSG_ZEROCOPY发送
+     * @details 开启时设置SO_ZEROCOPY, 之后sendZeroCopy以MSG_ZEROCOPY发送
+     * @return 内核不支持时返回false
+     */
+    bool setZeroCopy(bool v);
+
+    /**
+     * @brief 是否开启了MSG_ZEROCOPY发送
+     */
+    bool isZeroCopy() const;
+
+    /**
+     * @brief 零拷贝发送
+     * @details 开启零拷贝且length不小于socket.zerocopy.min_size时以MSG_ZEROCOPY发完
+     *          整个缓冲区, 内核直接引用buffer的页面, 错误队列收到这些页面的完成通知后
+     *          才调用done; 在此之前buffer不能修改或释放.
+     *          否则普通发送, 返回前调用done.
+     *          close时最多等待socket.zerocopy.close_timeout毫秒, 之后仍未完成的done不再调用.
+     *          同一时间只能有一个协程发送或等待通知
+     * @param[in] buffer 待发送数据的内存
+     * @param[in] length 待发送数据的长度
+     * @param[in] done 内核不再使用buffer时的回调, 在收取通知的协程中执行
+     * @param[in] flags 标志字
+     * @return 同send
+     */
+    int sendZeroCopy(const void* buffer, size_t length, std::function<void()> done, int flags = 0);
+
+    /**
+     * @brief 收取零拷贝完成通知, 调用已完成缓冲区的done
+     * @details 通知通过错误队列到达, epoll以EPOLLERR报告,
+     *          在IOManager中等待时挂起当前协程(等待PRI事件), 否则poll等待
+     * @param[in] timeout_ms 等待全部完成的最长时间(毫秒), 0表示不等待
+     * @return 仍未完成的缓冲区数
+     */
+    size_t reapZeroCopy(uint64_t timeout_ms = 0);
+
+    /**
+     * @brief 返回被内核退化为拷贝发送的完成通知数(如loopback)
+     */
+    uint64_t getZeroCopyCopied() const;
+
     /**
      * @brief 接受数据
      * @param[out] buffer 接收数据的内存
@@ -365,6 +422,17 @@ protected:
      * @brief 初始化sock
      */
     virtual bool init(int sock);
+
+    /**
+     * @brief 零拷贝发送状态
+     */
+    struct ZeroCopyState;
+
+    /**
+     * @brief 不等待地读空错误队列
+     * @return 仍未完成的缓冲区数
+     */
+    size_t collectZeroCopy();
 protected:
     /// socket句柄
     int m_sock;
@@ -380,6 +448,8 @@ protected:
     Address::ptr m_localAddress;
     /// 远端地址
     Address::ptr m_remoteAddress;
+    /// 零拷贝发送状态, 从未开启时为空
+    std::shared_ptr<ZeroCopyState> m_zerocopy;
 };
 
 class SSLSocket : public Socket {
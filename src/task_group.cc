@@ -0,0 +1,69 @@
+#include "task_group.h"
+#include "log.h"
+
+namespace arvin {
+
+static arvin::Logger::ptr g_logger = ARVIN_LOG_NAME("system");
+
+TaskGroup::TaskGroup(Scheduler *scheduler)
+    : m_scheduler(scheduler ? scheduler : Scheduler::GetThis()),
+      m_state(new State) {
+  if (!m_scheduler) {
+    throw std::logic_error("TaskGroup requires a scheduler");
+  }
+}
+
+TaskGroup::~TaskGroup() {
+  try {
+    wait();
+  } catch (std::exception &ex) {
+    ARVIN_LOG_ERROR(g_logger) << "~TaskGroup unhandled task exception: "
+                              << ex.what();
+  } catch (...) {
+    ARVIN_LOG_ERROR(g_logger) << "~TaskGroup unhandled task exception";
+  }
+}
+
+void TaskGroup::wait() {
+  while (m_joined < m_state->spawned) {
+    m_state->done.wait();
+    ++m_joined;
+  }
+  Spinlock::Lock lock(m_state->mutex);
+  if (m_state->error) {
+    std::exception_ptr ex = m_state->error;
+    // 只抛出一次
+    m_state->error = nullptr;
+    lock.unlock();
+    std::rethrow_exception(ex);
+  }
+}
+
+size_t TaskGroup::waitAny() {
+  if (m_state->first < 0) {
+    if (m_joined >= m_state->spawned) {
+      throw std::logic_error("TaskGroup::waitAny on empty group");
+    }
+    m_state->done.wait();
+    ++m_joined;
+  }
+  return m_state->first;
+}
+
+void TaskGroup::State::fail(std::exception_ptr ex) {
+  {
+    Spinlock::Lock lock(mutex);
+    if (!error) {
+      error = ex;
+    }
+  }
+  cancelled = true;
+}
+
+void TaskGroup::State::complete(size_t idx) {
+  long expected = -1;
+  first.compare_exchange_strong(expected, (long)idx);
+  done.notify();
+}
+
+} // namespace arvin
@@ -0,0 +1,314 @@
+#pragma once
+
+#include "mutex.h"
+#include "scheduler.h"
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+
+namespace arvin {
+
+/**
+ * @brief 任务因所在的TaskGroup被取消而未执行
+ */
+class TaskCancelled : public std::runtime_error {
+public:
+  TaskCancelled() : std::runtime_error("task cancelled") {}
+};
+
+namespace detail {
+
+/**
+ * @brief Future/Promise共享状态的公共部分
+ */
+class FutureStateBase {
+public:
+  /**
+   * @brief 等待结果就绪(协程中只挂起当前协程)
+   */
+  void wait() {
+    if (m_done.load(std::memory_order_acquire)) {
+      return;
+    }
+    m_sem.wait();
+    // 唤醒下一个等待者
+    m_sem.notify();
+  }
+
+  /**
+   * @brief 结果是否就绪
+   */
+  bool ready() const { return m_done.load(std::memory_order_acquire); }
+
+  /**
+   * @brief 设置异常
+   * @return 是否设置成功(结果只能设置一次)
+   */
+  bool setException(std::exception_ptr ex) {
+    if (!m_set.test_and_set()) {
+      m_exception = ex;
+      finish();
+      return true;
+    }
+    return false;
+  }
+
+  /**
+   * @brief 有异常时重新抛出
+   */
+  void rethrow() const {
+    if (m_exception) {
+      std::rethrow_exception(m_exception);
+    }
+  }
+
+protected:
+  /**
+   * @brief 标记完成并唤醒等待者
+   */
+  void finish() {
+    m_done.store(true, std::memory_order_release);
+    m_sem.notify();
+  }
+
+protected:
+  /// 是否已设置结果
+  std::atomic_flag m_set = ATOMIC_FLAG_INIT;
+  /// 结果是否就绪
+  std::atomic<bool> m_done = {false};
+  /// 异常
+  std::exception_ptr m_exception;
+  /// 等待者
+  FiberSemaphore m_sem;
+};
+
+template <class T> class FutureState : public FutureStateBase {
+public:
+  typedef std::shared_ptr<FutureState> ptr;
+
+  bool setValue(T v) {
+    if (!m_set.test_and_set()) {
+      m_value.emplace(std::move(v));
+      finish();
+      return true;
+    }
+    return false;
+  }
+
+  T &get() {
+    wait();
+    rethrow();
+    return *m_value;
+  }
+
+private:
+  std::optional<T> m_value;
+};
+
+template <> class FutureState<void> : public FutureStateBase {
+public:
+  typedef std::shared_ptr<FutureState> ptr;
+
+  bool setValue() {
+    if (!m_set.test_and_set()) {
+      finish();
+      return true;
+    }
+    return false;
+  }
+
+  void get() {
+    wait();
+    rethrow();
+  }
+};
+
+} // namespace detail
+
+/**
+ * @brief 异步结果
+ * @details get/wait在协程中只挂起当前协程, 不阻塞线程; 可被多次读取
+ */
+template <class T> class Future {
+public:
+  typedef typename detail::FutureState<T>::ptr StatePtr;
+
+  Future() {}
+  explicit Future(StatePtr state) : m_state(state) {}
+
+  /**
+   * @brief 是否关联了结果
+   */
+  bool valid() const { return !!m_state; }
+
+  /**
+   * @brief 结果是否就绪
+   */
+  bool ready() const { return m_state && m_state->ready(); }
+
+  /**
+   * @brief 等待结果就绪
+   */
+  void wait() const { m_state->wait(); }
+
+  /**
+   * @brief 等待并返回结果, 任务抛出异常时重新抛出
+   */
+  decltype(auto) get() const { return m_state->get(); }
+
+private:
+  StatePtr m_state;
+};
+
+/**
+ * @brief 异步结果的设置端
+ */
+template <class T> class Promise {
+public:
+  Promise() : m_state(new detail::FutureState<T>) {}
+
+  /**
+   * @brief 返回关联的Future
+   */
+  Future<T> getFuture() const { return Future<T>(m_state); }
+
+  /**
+   * @brief 设置结果
+   */
+  template <class... Args> bool setValue(Args &&...args) {
+    return m_state->setValue(std::forward<Args>(args)...);
+  }
+
+  /**
+   * @brief 设置异常
+   */
+  bool setException(std::exception_ptr ex) {
+    return m_state->setException(ex);
+  }
+
+private:
+  typename detail::FutureState<T>::ptr m_state;
+};
+
+/**
+ * @brief 结构化并发任务组
+ * @details spawn的子任务在调度器上并发执行, wait/waitAny在协程中不阻塞线程.
+ *          任一子任务抛出异常时取消组内其他尚未开始的任务, 正在执行的任务
+ *          可通过isCancelled()主动退出. 析构时等待所有子任务结束
+ */
+class TaskGroup : Noncopyable {
+public:
+  typedef std::shared_ptr<TaskGroup> ptr;
+
+  /**
+   * @brief 构造函数
+   * @param[in] scheduler 子任务执行的调度器, nullptr表示当前调度器
+   */
+  TaskGroup(Scheduler *scheduler = nullptr);
+
+  /**
+   * @brief 析构函数, 等待所有子任务结束(不抛出异常)
+   */
+  ~TaskGroup();
+
+  /**
+   * @brief 启动子任务
+   * @param[in] cb 任务函数
+   * @return 任务结果
+   */
+  template <class F> auto spawn(F cb) -> Future<std::invoke_result_t<F>> {
+    typedef std::invoke_result_t<F> R;
+    typename detail::FutureState<R>::ptr state(new detail::FutureState<R>);
+    std::shared_ptr<State> group = m_state;
+    size_t idx = m_state->spawned++;
+    m_scheduler->schedule([group, state, idx, cb]() mutable {
+      if (group->cancelled) {
+        state->setException(std::make_exception_ptr(TaskCancelled()));
+      } else {
+        try {
+          if constexpr (std::is_void_v<R>) {
+            cb();
+            state->setValue();
+          } else {
+            state->setValue(cb());
+          }
+        } catch (...) {
+          std::exception_ptr ex = std::current_exception();
+          state->setException(ex);
+          group->fail(ex);
+        }
+      }
+      group->complete(idx);
+    });
+    return Future<R>(state);
+  }
+
+  /**
+   * @brief 等待所有子任务结束
+   * @details 有子任务失败时抛出第一个失败的异常
+   */
+  void wait();
+
+  /**
+   * @brief 等待任意一个子任务结束
+   * @return 最先结束的子任务序号(按spawn顺序从0开始)
+   */
+  size_t waitAny();
+
+  /**
+   * @brief 取消尚未开始的子任务
+   */
+  void cancel() { m_state->cancelled = true; }
+
+  /**
+   * @brief 是否已被取消
+   */
+  bool isCancelled() const { return m_state->cancelled; }
+
+  /**
+   * @brief 返回子任务数量
+   */
+  size_t size() const { return m_state->spawned; }
+
+private:
+  /**
+   * @brief 子任务共享的组状态
+   */
+  struct State {
+    /// 已启动的子任务数量
+    std::atomic<size_t> spawned = {0};
+    /// 最先结束的子任务序号
+    std::atomic<long> first = {-1};
+    /// 是否已取消
+    std::atomic<bool> cancelled = {false};
+    /// 子任务结束通知, 每结束一个notify一次
+    FiberSemaphore done;
+    /// 保护error
+    Spinlock mutex;
+    /// 第一个失败的异常
+    std::exception_ptr error;
+
+    /**
+     * @brief 记录失败并取消其他子任务
+     */
+    void fail(std::exception_ptr ex);
+
+    /**
+     * @brief 子任务结束
+     */
+    void complete(size_t idx);
+  };
+
+private:
+  /// 子任务执行的调度器
+  Scheduler *m_scheduler;
+  /// 组状态
+  std::shared_ptr<State> m_state;
+  /// 已消费的结束通知数量
+  size_t m_joined = 0;
+};
+
+} // namespace arvin
@@ -47,6 +47,15 @@ namespace arvin
     }
     m_semaphore.wait();
   }
+
+  Thread::~Thread()
+  {
+    if (m_thread)
+    {
+      pthread_detach(m_thread);
+    }
+  }
+
   void Thread::join()
   {
     if (m_thread)
@@ -1,10 +1,15 @@
 #include "timer.h"
+#include "config.h"
+#include "log.h"
 #include "macro.h"
 #include "util.h"
+#include <algorithm>
 
 namespace arvin {
-bool Timer::Comparator::operator()(const Timer::ptr &lhs,
-                                   const Timer::ptr &rhs) const {
+
+static arvin::Logger::ptr g_logger = ARVIN_LOG_NAME("system");
+bool Timer::Comparator::operator()(const Timer *lhs,
+                                   const Timer *rhs) const {
   if (!lhs && !rhs) {
     return false;
   }
@@ -20,79 +25,612 @@ bool Timer::Comparator::operator()(const Timer::ptr &lhs,
   if (rhs->m_next < lhs->m_next) {
     return false;
   }
-  return lhs.get() < rhs.get();
+  return lhs < rhs;
 }
 
-Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring,
-             TimerManager *manager)
-    : m_recurring(recurring), m_ms(ms), m_cb(cb), m_manager(manager) {
-  m_next = arvin::GetCurrentMS() + m_ms;
-}
+/**
+ * @brief 分层时间轮
+ * @details 精度1毫秒. 第0层256个槽位, 第1~3层各64个槽位, 覆盖约18.6小时,
+ *          更远的定时器先放在最高层, 降级时按实际时间重新放置.
+ *          每个槽位是定时器的侵入式双向链表, 增删O(1);
+ *          每层用位图记录非空槽位, 推进时间和计算下次到期时跳过空槽位.
+ *          不持有定时器, 生命周期由TimerManager管理
+ */
+class TimingWheel {
+public:
+  static const int LEVELS = 4;
+  static const int ROOT_BITS = 8;
+  static const int LEVEL_BITS = 6;
+  static const uint64_t ROOT_SIZE = 1 << ROOT_BITS;
+  static const uint64_t LEVEL_SIZE = 1 << LEVEL_BITS;
+  /// 时间轮能直接表示的最大间隔
+  static const uint64_t MAX_DELTA =
+      (uint64_t)1 << (ROOT_BITS + (LEVELS - 1) * LEVEL_BITS);
+
+  TimingWheel(uint64_t now_ms) : m_tick(now_ms) {}
 
-Timer::Timer(uint64_t next) : m_next(next) {}
+  size_t size() const { return m_size; }
 
-bool Timer::cancel() {
-  TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
-  if (m_cb) {
-    m_cb = nullptr;
-    auto it = m_manager->m_timers.find(shared_from_this());
-    m_manager->m_timers.erase(it);
+  /**
+   * @brief 按m_next放入对应槽位
+   */
+  void add(Timer *timer) {
+    link(timer);
+    ++m_size;
+  }
+
+  /**
+   * @brief 移除定时器
+   */
+  bool remove(Timer *timer) {
+    if (timer->m_wheelLevel < 0) {
+      return false;
+    }
+    unlink(timer);
+    --m_size;
     return true;
   }
-  return false;
-}
 
-bool Timer::refresh() {
-  TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
-  if (!m_cb) {
-    return false;
+  /**
+   * @brief 推进到now_ms, 取出所有到期的定时器(按到期时间排序)
+   */
+  void advance(uint64_t now_ms, std::vector<Timer *> &expired) {
+    while (m_tick <= now_ms) {
+      if (!m_size) {
+        m_tick = now_ms + 1;
+        break;
+      }
+      uint64_t idx = m_tick & (ROOT_SIZE - 1);
+      if (idx == 0) {
+        cascade();
+      }
+      Timer *head = m_slots[slotIndex(0, idx)];
+      while (head) {
+        Timer *next = head->m_wheelNext;
+        remove(head);
+        expired.push_back(head);
+        head = next;
+      }
+      // 跳到第0层下一个非空槽位, 但不越过下一次降级和now_ms
+      uint64_t step =
+          std::min(nextRootDistance(idx + 1) + 1, ROOT_SIZE - idx);
+      m_tick += std::min(step, now_ms + 1 - m_tick);
+    }
   }
-  auto it = m_manager->m_timers.find(shared_from_this());
-  if (it == m_manager->m_timers.end()) {
-    return false;
+
+  /**
+   * @brief 下一次需要处理的时间(毫秒时间戳), 没有定时器返回~0ull
+   * @details 取第0层最近的到期时间与各层最近一次降级时间中较早的一个,
+   *          可能早于实际到期(降级后重新计算), 但不会晚于
+   */
+  uint64_t next() const {
+    if (!m_size) {
+      return ~0ull;
+    }
+    uint64_t next = ~0ull;
+    uint64_t step = nextRootDistance(m_tick & (ROOT_SIZE - 1));
+    if (step < ROOT_SIZE) {
+      next = m_tick + step;
+    }
+    for (int level = 1; level < LEVELS; ++level) {
+      int shift = ROOT_BITS + (level - 1) * LEVEL_BITS;
+      uint64_t cur = m_tick >> shift;
+      uint64_t bits = m_bitmap[levelWord(level)];
+      if (!bits) {
+        continue;
+      }
+      // m_tick正好在本层边界上时当前槽位还未降级, 否则从下一个槽位开始找
+      uint64_t first = (m_tick & (((uint64_t)1 << shift) - 1)) ? 1 : 0;
+      uint64_t start = (cur + first) & (LEVEL_SIZE - 1);
+      uint64_t rotated =
+          (bits >> start) | (start ? bits << (LEVEL_SIZE - start) : 0);
+      uint64_t k = __builtin_ctzll(rotated) + first;
+      next = std::min(next, (cur + k) << shift);
+    }
+    return next;
   }
-  m_manager->m_timers.erase(it);
-  m_next = arvin::GetCurrentMS() + m_ms;
-  m_manager->m_timers.insert(shared_from_this());
-  return true;
+
+  /**
+   * @brief 取出所有定时器
+   */
+  void takeAll(std::vector<Timer *> &timers) {
+    for (size_t i = 0; i < SLOTS; ++i) {
+      while (m_slots[i]) {
+        Timer *t = m_slots[i];
+        remove(t);
+        timers.push_back(t);
+      }
+    }
+  }
+
+private:
+  static const size_t SLOTS = ROOT_SIZE + (LEVELS - 1) * LEVEL_SIZE;
+
+  static size_t slotIndex(int level, uint64_t idx) {
+    return level ? ROOT_SIZE + (level - 1) * LEVEL_SIZE + idx : idx;
+  }
+
+  /// 第1~3层的位图在m_bitmap中的下标(第0层占前4个)
+  static int levelWord(int level) { return ROOT_SIZE / 64 + level - 1; }
+
+  void setBit(int level, uint64_t idx) {
+    if (level) {
+      m_bitmap[levelWord(level)] |= (uint64_t)1 << idx;
+    } else {
+      m_bitmap[idx >> 6] |= (uint64_t)1 << (idx & 63);
+    }
+  }
+
+  void clearBit(int level, uint64_t idx) {
+    if (level) {
+      m_bitmap[levelWord(level)] &= ~((uint64_t)1 << idx);
+    } else {
+      m_bitmap[idx >> 6] &= ~((uint64_t)1 << (idx & 63));
+    }
+  }
+
+  /**
+   * @brief 第0层从槽位from开始(循环)到下一个非空槽位的距离
+   * @return 全空时返回ROOT_SIZE
+   */
+  uint64_t nextRootDistance(uint64_t from) const {
+    for (uint64_t i = 0; i < ROOT_SIZE;) {
+      uint64_t idx = (from + i) & (ROOT_SIZE - 1);
+      uint64_t word = m_bitmap[idx >> 6] >> (idx & 63);
+      if (word) {
+        return i + __builtin_ctzll(word);
+      }
+      i += 64 - (idx & 63);
+    }
+    return ROOT_SIZE;
+  }
+
+  void link(Timer *timer) {
+    uint64_t expires = std::max(timer->m_next, m_tick);
+    uint64_t delta = expires - m_tick;
+    if (delta >= MAX_DELTA) {
+      expires = m_tick + MAX_DELTA - 1;
+      delta = MAX_DELTA - 1;
+    }
+    int level = 0;
+    uint64_t idx = expires & (ROOT_SIZE - 1);
+    if (delta >= ROOT_SIZE) {
+      for (level = 1; level < LEVELS - 1; ++level) {
+        if (delta < (uint64_t)1 << (ROOT_BITS + level * LEVEL_BITS)) {
+          break;
+        }
+      }
+      idx = (expires >> (ROOT_BITS + (level - 1) * LEVEL_BITS)) &
+            (LEVEL_SIZE - 1);
+    }
+    Timer *&head = m_slots[slotIndex(level, idx)];
+    timer->m_wheelLevel = level;
+    timer->m_wheelSlot = idx;
+    timer->m_wheelPrev = nullptr;
+    timer->m_wheelNext = head;
+    if (head) {
+      head->m_wheelPrev = timer;
+    }
+    head = timer;
+    setBit(level, idx);
+  }
+
+  void unlink(Timer *timer) {
+    int level = timer->m_wheelLevel;
+    Timer *&head = m_slots[slotIndex(level, timer->m_wheelSlot)];
+    if (timer->m_wheelPrev) {
+      timer->m_wheelPrev->m_wheelNext = timer->m_wheelNext;
+    } else {
+      head = timer->m_wheelNext;
+    }
+    if (timer->m_wheelNext) {
+      timer->m_wheelNext->m_wheelPrev = timer->m_wheelPrev;
+    }
+    if (!head) {
+      clearBit(level, timer->m_wheelSlot);
+    }
+    timer->m_wheelPrev = timer->m_wheelNext = nullptr;
+    timer->m_wheelLevel = -1;
+  }
+
+  /**
+   * @brief 第0层转完一圈, 把上层当前槽位的定时器降级
+   */
+  void cascade() {
+    for (int level = 1; level < LEVELS; ++level) {
+      int shift = ROOT_BITS + (level - 1) * LEVEL_BITS;
+      uint64_t idx = (m_tick >> shift) & (LEVEL_SIZE - 1);
+      Timer *&head = m_slots[slotIndex(level, idx)];
+      Timer *t = head;
+      head = nullptr;
+      clearBit(level, idx);
+      while (t) {
+        Timer *next = t->m_wheelNext;
+        link(t);
+        t = next;
+      }
+      if (idx) {
+        break;
+      }
+    }
+  }
+
+private:
+  /// 下一个要处理的时间(毫秒)
+  uint64_t m_tick;
+  /// 定时器数量
+  size_t m_size = 0;
+  /// 各层槽位的链表头
+  Timer *m_slots[SLOTS] = {nullptr};
+  /// 非空槽位位图, 第0层4个字, 其余每层1个字
+  uint64_t m_bitmap[ROOT_SIZE / 64 + LEVELS - 1] = {0};
+};
+
+static ConfigVar<std::string>::ptr g_timer_backend =
+    Config::Lookup<std::string>("timer.backend", "set",
+                                "timer storage set or wheel");
+
+static ConfigVar<uint64_t>::ptr g_timer_slack = Config::Lookup<uint64_t>(
+    "timer.slack_ms", 0, "default timer slack ms for coalescing expirations");
+
+static ConfigVar<bool>::ptr g_timer_thread_shard = Config::Lookup<bool>(
+    "timer.thread_shard", true, "worker threads own lock-free timer shards");
+
+/**
+ * @brief 定时器分片
+ * @details 线程分片只由所属线程访问(关闭后改由m_mutex保护), 共享分片由m_mutex
+ *          保护. size与next发布给其他线程读取.
+ *          节点池按块分配, 节点在分片析构前不释放, 旧句柄访问时不会悬空
+ */
+struct TimerShard {
+  /// 节点池每块的节点数
+  static const size_t SLAB_SIZE = 256;
+
+  TimerShard(TimerManager *m, TimerManager::Backend b, int t)
+      : thread(t), manager(m) {
+    setBackend(b, arvin::GetLoopMS());
+  }
+
+  void setBackend(TimerManager::Backend b, uint64_t now_ms) {
+    backend = b;
+    if (b == TimerManager::WHEEL) {
+      wheel.reset(new TimingWheel(now_ms));
+    } else {
+      wheel.reset();
+    }
+  }
+
+  size_t count() const { return wheel ? wheel->size() : timers.size(); }
+
+  /**
+   * @brief 最早执行时间, 没有定时器返回~0ull
+   */
+  uint64_t first() const {
+    if (wheel) {
+      return wheel->next();
+    }
+    return timers.empty() ? ~0ull : (*timers.begin())->m_next;
+  }
+
+  /**
+   * @return 是否成为最早执行的定时器
+   */
+  bool insert(Timer *timer) {
+    if (wheel) {
+      // 已发布的next总是在修改后重新计算, 可代替扫描时间轮
+      bool at_front = timer->m_next < next.load(std::memory_order_relaxed);
+      wheel->add(timer);
+      return at_front;
+    }
+    // 先插入再取begin, 两者在同一表达式中的求值顺序不确定
+    auto it = timers.insert(timer).first;
+    return it == timers.begin();
+  }
+
+  /**
+   * @return 定时器不在其中时返回false
+   */
+  bool erase(Timer *timer) {
+    if (wheel) {
+      return wheel->remove(timer);
+    }
+    auto it = timers.find(timer);
+    if (it == timers.end()) {
+      return false;
+    }
+    timers.erase(it);
+    return true;
+  }
+
+  /**
+   * @brief 取出到期的定时器
+   */
+  void takeExpired(uint64_t now_ms, std::vector<Timer *> &expired) {
+    if (wheel) {
+      wheel->advance(now_ms, expired);
+      return;
+    }
+    auto it = timers.begin();
+    while (it != timers.end() && (*it)->m_next <= now_ms) {
+      ++it;
+    }
+    expired.insert(expired.end(), timers.begin(), it);
+    timers.erase(timers.begin(), it);
+  }
+
+  void takeAll(std::vector<Timer *> &all) {
+    if (wheel) {
+      wheel->takeAll(all);
+    } else {
+      all.insert(all.end(), timers.begin(), timers.end());
+      timers.clear();
+    }
+  }
+
+  /**
+   * @brief 发布数量和最早执行时间
+   */
+  void publish() {
+    size.store(count(), std::memory_order_release);
+    next.store(first(), std::memory_order_release);
+  }
+
+  /**
+   * @brief 只插入了timer时的发布, 不必重新计算最早执行时间
+   */
+  void publishAdd(const Timer *timer) {
+    size.store(count(), std::memory_order_release);
+    if (timer->m_next < next.load(std::memory_order_relaxed)) {
+      next.store(timer->m_next, std::memory_order_release);
+    }
+  }
+
+  /**
+   * @brief 从节点池取一个空闲节点, 代数不变
+   */
+  Timer *alloc() {
+    if (!freeList) {
+      Timer *slab = new Timer[SLAB_SIZE];
+      slabs.emplace_back(slab);
+      for (size_t i = 0; i < SLAB_SIZE; ++i) {
+        slab[i].m_pooled = true;
+        slab[i].m_manager = manager;
+        slab[i].m_home = this;
+        slab[i].m_state = Timer::Pack(0, Timer::DONE);
+        slab[i].m_wheelNext = i + 1 < SLAB_SIZE ? &slab[i + 1] : nullptr;
+      }
+      freeList = slab;
+    }
+    Timer *timer = freeList;
+    freeList = timer->m_wheelNext;
+    timer->m_wheelNext = nullptr;
+    return timer;
+  }
+
+  /**
+   * @brief 节点放回节点池
+   */
+  void free(Timer *timer) {
+    timer->m_wheelNext = freeList;
+    freeList = timer;
+  }
+
+  /// 所属线程, 共享分片为-1
+  int thread;
+  /// 所属管理器
+  TimerManager *manager;
+  /// 所属线程已退出
+  std::atomic<bool> closed = {false};
+  /// 存储结构
+  TimerManager::Backend backend = TimerManager::SET;
+  /// 定时器集合
+  std::set<Timer *, Timer::Comparator> timers;
+  /// 时间轮
+  std::unique_ptr<TimingWheel> wheel;
+  /// 已发布的定时器数量
+  std::atomic<size_t> size = {0};
+  /// 已发布的最早执行时间
+  std::atomic<uint64_t> next = {~0ull};
+  /// 其他线程投递的修改, 无锁栈
+  std::atomic<TimerOp *> mailbox = {nullptr};
+  /// 节点池
+  std::vector<std::unique_ptr<Timer[]>> slabs;
+  /// 空闲节点链表
+  Timer *freeList = nullptr;
+};
+
+/**
+ * @brief 投递给定时器所在分片的修改
+ */
+struct TimerOp {
+  enum Type { CANCEL, REFRESH, RESET };
+
+  TimerOp(Timer *t, uint64_t g, Type ty, uint64_t m = 0, bool f = false)
+      : timer(t), gen(g), type(ty), ms(m), from_now(f),
+        now(arvin::GetLoopMS()) {}
+
+  Timer *timer;
+  /// 发起修改时定时器的代数, 节点被回收复用后修改作废
+  uint64_t gen;
+  /// 投递期间保持非节点池定时器存活
+  Timer::ptr keep;
+  Type type;
+  /// RESET的新周期
+  uint64_t ms;
+  /// RESET是否从当前时间开始计算
+  bool from_now;
+  /// 发起修改的时间
+  uint64_t now;
+  TimerOp *next = nullptr;
+};
+
+/// 管理器编号分配
+static std::atomic<uint64_t> s_timer_manager_id = {0};
+/// 当前线程在各管理器中的分片
+static thread_local std::vector<std::pair<uint64_t, TimerShard *>> t_shards;
+
+Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring,
+             TimerManager *manager, uint64_t slack)
+    : m_recurring(recurring), m_ms(ms), m_slack(slack), m_cb(cb),
+      m_manager(manager) {
+  m_next = deadline(arvin::GetLoopMS());
 }
 
+uint64_t Timer::deadline(uint64_t start) const {
+  uint64_t next = start + m_ms;
+  if (m_slack > 1) {
+    next = (next + m_slack - 1) / m_slack * m_slack;
+  }
+  return next;
+}
+
+bool Timer::cancel() { return m_manager->cancel(this, 0); }
+
+bool Timer::refresh() { return m_manager->refresh(this, 0); }
+
 bool Timer::reset(uint64_t ms, bool from_now) {
   if (ms == m_ms && !from_now) {
     return true;
   }
-  TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
-  if (!m_cb) {
-    return false;
+  return m_manager->reset(this, 0, ms, from_now);
+}
+
+bool TimerHandle::cancel() {
+  return m_node && m_node->m_manager->cancel(m_node, m_gen);
+}
+
+bool TimerHandle::refresh() {
+  return m_node && m_node->m_manager->refresh(m_node, m_gen);
+}
+
+bool TimerHandle::reset(uint64_t ms, bool from_now) {
+  return m_node && m_node->m_manager->reset(m_node, m_gen, ms, from_now);
+}
+
+bool TimerHandle::isActive() const {
+  return m_node && m_node->m_state == Timer::Pack(m_gen, Timer::ACTIVE);
+}
+
+TimerManager::TimerManager()
+    : TimerManager(g_timer_backend->getValue() == "wheel" ? WHEEL : SET) {}
+
+TimerManager::TimerManager(Backend backend)
+    : m_id(++s_timer_manager_id), m_backend(backend),
+      m_defaultSlack(g_timer_slack->getValue()),
+      m_shared(new TimerShard(this, backend, -1)) {
+  for (size_t i = 0; i < MAX_THREAD_SHARDS; ++i) {
+    m_threadShards[i].store(nullptr, std::memory_order_relaxed);
   }
-  auto it = m_manager->m_timers.find(shared_from_this());
-  if (it == m_manager->m_timers.end()) {
-    return false;
+}
+
+TimerManager::~TimerManager() {
+  std::vector<TimerShard *> shards;
+  size_t n = m_threadShardCount;
+  for (size_t i = 0; i < n; ++i) {
+    if (TimerShard *shard = m_threadShards[i]) {
+      shards.push_back(shard);
+    }
   }
-  m_manager->m_timers.erase(it);
-  uint64_t start = 0;
-  if (from_now) {
-    start = arvin::GetCurrentMS();
-  } else {
-    start = m_next - m_ms;
+  shards.insert(shards.end(), m_closedShards.begin(), m_closedShards.end());
+  shards.push_back(m_shared.get());
+  // 先释放所有定时器的自身引用, 节点池最后随分片一起释放
+  for (auto shard : shards) {
+    TimerOp *op = shard->mailbox.exchange(nullptr);
+    while (op) {
+      TimerOp *next = op->next;
+      delete op;
+      op = next;
+    }
+    std::vector<Timer *> timers;
+    shard->takeAll(timers);
+    for (auto timer : timers) {
+      timer->m_cb = nullptr;
+      if (!timer->m_pooled) {
+        timer->m_self.reset();
+      }
+    }
+  }
+  shards.pop_back();
+  for (auto shard : shards) {
+    delete shard;
   }
-  m_ms = ms;
-  m_next = start + m_ms;
-  m_manager->addTimer(shared_from_this(), lock);
-  return true;
 }
 
-TimerManager::TimerManager() { m_previouseTime = arvin::GetCurrentMS(); }
+bool TimerManager::setBackend(Backend backend) {
+  if (hasTimer()) {
+    return false;
+  }
+  m_backend = backend;
+  // 线程分片在所属线程下一次添加定时器时切换
+  RWMutexType::WriteLock lock(m_mutex);
+  m_shared->setBackend(backend, arvin::GetLoopMS());
+  return true;
+}
 
-TimerManager::~TimerManager() {}
+TimerShard *TimerManager::localShard() const {
+  for (auto &i : t_shards) {
+    if (i.first == m_id) {
+      return i.second;
+    }
+  }
+  return nullptr;
+}
 
 Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb,
-                                  bool recurring) {
-  Timer::ptr timer(new Timer(ms, cb, recurring, this));
-  RWMutexType::WriteLock lock(m_mutex);
-  addTimer(timer, lock);
+                                  bool recurring, uint64_t slack) {
+  if (slack == DEFAULT_SLACK) {
+    slack = m_defaultSlack;
+  }
+  Timer::ptr timer(new Timer(ms, cb, recurring, this, slack));
+  timer->m_self = timer;
+  addTimer(timer.get());
   return timer;
 }
+
+TimerHandle TimerManager::addTimerHandle(uint64_t ms, std::function<void()> cb,
+                                         bool recurring, uint64_t slack) {
+  if (slack == DEFAULT_SLACK) {
+    slack = m_defaultSlack;
+  }
+  auto init = [&](Timer *timer) {
+    timer->m_recurring = recurring;
+    timer->m_ms = ms;
+    timer->m_slack = slack;
+    timer->m_cb = std::move(cb);
+    timer->m_next = timer->deadline(arvin::GetLoopMS());
+    uint64_t gen = timer->m_state >> 2;
+    timer->m_state = Timer::Pack(gen, Timer::ACTIVE);
+    return TimerHandle(timer, gen);
+  };
+  if (TimerShard *local = localShard()) {
+    Timer *timer = local->alloc();
+    TimerHandle handle = init(timer);
+    addTimer(timer);
+    return handle;
+  }
+  RWMutexType::WriteLock lock(m_mutex);
+  Timer *timer = m_shared->alloc();
+  TimerHandle handle = init(timer);
+  insertShared(timer, lock);
+  return handle;
+}
+
+void TimerManager::addTimer(Timer *timer) {
+  TimerShard *local = localShard();
+  if (local) {
+    // 所属线程此时不在等待, 回到事件循环时会重新计算超时, 无需唤醒
+    if (local->backend != m_backend && !local->count()) {
+      local->setBackend(m_backend, arvin::GetLoopMS());
+    }
+    timer->m_shard = local;
+    local->insert(timer);
+    local->publishAdd(timer);
+    return;
+  }
+  RWMutexType::WriteLock lock(m_mutex);
+  insertShared(timer, lock);
+}
+
 static void OnTimer(std::weak_ptr<void> weak_cond, std::function<void()> cb) {
   std::shared_ptr<void> tmp = weak_cond.lock();
   if (tmp) {
@@ -103,70 +641,238 @@ static void OnTimer(std::weak_ptr<void> weak_cond, std::function<void()> cb) {
 Timer::ptr TimerManager::addConditionTimer(uint64_t ms,
                                            std::function<void()> cb,
                                            std::weak_ptr<void> weak_cond,
-                                           bool recurring) {
-  return addTimer(ms, std::bind(&OnTimer, weak_cond, cb), recurring);
+                                           bool recurring, uint64_t slack) {
+  return addTimer(ms, std::bind(&OnTimer, weak_cond, cb), recurring, slack);
 }
 
-uint64_t TimerManager::getNextTimer() {
-  RWMutexType::ReadLock lock(m_mutex);
-  m_tickled = false;
-  if (m_timers.empty()) {
-    return ~0ull;
+bool TimerManager::cancel(Timer *timer, uint64_t gen) {
+  uint64_t state = Timer::Pack(gen, Timer::ACTIVE);
+  if (!timer->m_state.compare_exchange_strong(
+          state, Timer::Pack(gen, Timer::CANCELLED))) {
+    return false;
   }
+  TimerOp op(timer, gen, TimerOp::CANCEL);
+  post(op);
+  return true;
+}
 
-  const Timer::ptr &next = *m_timers.begin();
-  uint64_t now_ms = arvin::GetCurrentMS();
-  if (now_ms >= next->m_next) {
-    return 0;
+bool TimerManager::refresh(Timer *timer, uint64_t gen) {
+  if (timer->m_state != Timer::Pack(gen, Timer::ACTIVE)) {
+    return false;
+  }
+  TimerOp op(timer, gen, TimerOp::REFRESH);
+  post(op);
+  return true;
+}
+
+bool TimerManager::reset(Timer *timer, uint64_t gen, uint64_t ms,
+                         bool from_now) {
+  if (timer->m_state != Timer::Pack(gen, Timer::ACTIVE)) {
+    return false;
+  }
+  TimerOp op(timer, gen, TimerOp::RESET, ms, from_now);
+  post(op);
+  return true;
+}
+
+void TimerManager::release(Timer *timer) {
+  timer->m_cb = nullptr;
+  if (timer->m_pooled) {
+    // 代数加一, 旧句柄随之失效
+    uint64_t gen = timer->m_state >> 2;
+    timer->m_state = Timer::Pack(gen + 1, Timer::DONE);
+    timer->m_home->free(timer);
   } else {
-    return next->m_next - now_ms;
+    // 最后释放, timer可能因此析构
+    Timer::ptr self;
+    self.swap(timer->m_self);
   }
 }
 
-void TimerManager::listExpiredCb(std::vector<std::function<void()>> &cbs) {
-  uint64_t now_ms = arvin::GetCurrentMS();
-  std::vector<Timer::ptr> expired;
-  {
-    RWMutexType::ReadLock lock(m_mutex);
-    if (m_timers.empty()) {
-      return;
+void TimerManager::post(TimerOp &op) {
+  TimerShard *shard = op.timer->m_shard.load(std::memory_order_acquire);
+  if (shard == m_shared.get()) {
+    RWMutexType::WriteLock lock(m_mutex);
+    bool at_front = applyOp(&op) && !m_tickled.exchange(true);
+    m_shared->publish();
+    lock.unlock();
+    if (at_front) {
+      onTimerInsertedAtFront();
     }
-  }
-  RWMutexType::WriteLock lock(m_mutex);
-  if (m_timers.empty()) {
     return;
   }
-  bool rollover = detectClockRollover(now_ms);
-  if (!rollover && ((*m_timers.begin())->m_next > now_ms)) {
+  if (shard == localShard()) {
+    applyOp(&op);
+    shard->publish();
     return;
   }
 
-  Timer::ptr now_timer(new Timer(now_ms));
-  auto it = rollover ? m_timers.end() : m_timers.lower_bound(now_timer);
-  while (it != m_timers.end() && (*it)->m_next == now_ms) {
-    ++it;
+  // 只有投递到其他线程时才需要堆上分配
+  TimerOp *boxed = new TimerOp(op);
+  if (!op.timer->m_pooled) {
+    boxed->keep = op.timer->shared_from_this();
+  }
+  boxed->next = shard->mailbox.load(std::memory_order_relaxed);
+  while (!shard->mailbox.compare_exchange_weak(boxed->next, boxed)) {
+  }
+  // 与detachTimerThread先置closed再取邮箱配对, 修改不会遗漏
+  if (shard->closed) {
+    RWMutexType::WriteLock lock(m_mutex);
+    bool at_front = drain(shard) && !m_tickled.exchange(true);
+    lock.unlock();
+    if (at_front) {
+      onTimerInsertedAtFront();
+    }
+  } else if (op.type == TimerOp::RESET) {
+    // 只有重置可能提前执行时间, 取消和刷新等所属线程自然处理即可
+    onTimerPosted(shard->thread);
+  }
+}
+
+bool TimerManager::applyOp(TimerOp *op) {
+  Timer *timer = op->timer;
+  if ((timer->m_state >> 2) != op->gen) {
+    // 节点已回收
+    return false;
+  }
+  TimerShard *shard = timer->m_shard.load(std::memory_order_relaxed);
+  if (op->type == TimerOp::CANCEL) {
+    // 不在存储结构中说明已在到期处理时释放
+    if (shard->erase(timer)) {
+      release(timer);
+    }
+    return false;
+  }
+  if (timer->m_state != Timer::Pack(op->gen, Timer::ACTIVE) ||
+      !shard->erase(timer)) {
+    return false;
+  }
+  if (op->type == TimerOp::REFRESH) {
+    timer->m_next = timer->deadline(op->now);
+  } else {
+    uint64_t start = op->from_now ? op->now : timer->m_next - timer->m_ms;
+    timer->m_ms = op->ms;
+    timer->m_next = timer->deadline(start);
+  }
+  return shard->insert(timer);
+}
+
+bool TimerManager::drain(TimerShard *shard) {
+  TimerOp *op = shard->mailbox.exchange(nullptr);
+  if (!op) {
+    return false;
+  }
+  // 栈中是逆序的, 按投递顺序执行
+  TimerOp *ops = nullptr;
+  while (op) {
+    TimerOp *next = op->next;
+    op->next = ops;
+    ops = op;
+    op = next;
+  }
+  // 所属线程已退出时定时器可能已迁移到共享分片, 此时调用方持有m_mutex
+  bool shared = false;
+  bool at_front = false;
+  while (ops) {
+    TimerOp *next = ops->next;
+    bool is_shared = ops->timer->m_shard == m_shared.get();
+    shared |= is_shared;
+    at_front |= applyOp(ops) && is_shared;
+    delete ops;
+    ops = next;
+  }
+  shard->publish();
+  if (shared) {
+    m_shared->publish();
   }
-  expired.insert(expired.begin(), m_timers.begin(), it);
-  m_timers.erase(m_timers.begin(), it);
-  cbs.reserve(expired.size());
+  return at_front;
+}
 
-  for (auto &timer : expired) {
-    cbs.push_back(timer->m_cb);
+void TimerManager::expire(TimerShard *shard, uint64_t now_ms,
+                          std::vector<std::function<void()>> &cbs) {
+  std::vector<Timer *> expired;
+  shard->takeExpired(now_ms, expired);
+  cbs.reserve(cbs.size() + expired.size());
+  for (auto timer : expired) {
+    uint64_t state = timer->m_state;
     if (timer->m_recurring) {
-      timer->m_next = now_ms + timer->m_ms;
-      m_timers.insert(timer);
-    } else {
-      timer->m_cb = nullptr;
+      if ((state & 3) == Timer::ACTIVE) {
+        cbs.push_back(timer->m_cb);
+        timer->m_next = timer->deadline(now_ms);
+        shard->insert(timer);
+      } else {
+        release(timer);
+      }
+      continue;
+    }
+    // 与其他线程的cancel竞争, 只有一方成功
+    uint64_t gen = state >> 2;
+    state = Timer::Pack(gen, Timer::ACTIVE);
+    if (timer->m_state.compare_exchange_strong(
+            state, Timer::Pack(gen, Timer::DONE))) {
+      cbs.push_back(std::move(timer->m_cb));
     }
+    release(timer);
   }
+  shard->publish();
 }
 
-void TimerManager::addTimer(Timer::ptr val, RWMutexType::WriteLock &lock) {
-  auto it = m_timers.insert(val).first;
-  bool at_front = (it == m_timers.begin()) && !m_tickled;
-  if (at_front) {
-    m_tickled = true;
+uint64_t TimerManager::getNextTimer() {
+  m_tickled = false;
+  uint64_t next = m_shared->next.load(std::memory_order_acquire);
+  TimerShard *local = localShard();
+  if (local) {
+    drain(local);
+    next = std::min(next, local->next.load(std::memory_order_relaxed));
+  } else {
+    size_t n = m_threadShardCount.load(std::memory_order_acquire);
+    for (size_t i = 0; i < n; ++i) {
+      TimerShard *shard = m_threadShards[i].load(std::memory_order_acquire);
+      if (shard) {
+        next = std::min(next, shard->next.load(std::memory_order_acquire));
+      }
+    }
+  }
+  if (next == ~0ull) {
+    return ~0ull;
+  }
+
+  uint64_t now_ms = arvin::GetLoopMS();
+  if (now_ms >= next) {
+    return 0;
+  } else {
+    return next - now_ms;
+  }
+}
+
+void TimerManager::listExpiredCb(std::vector<std::function<void()>> &cbs) {
+  uint64_t now_ms = arvin::GetLoopMS();
+  TimerShard *local = localShard();
+  if (local) {
+    drain(local);
+    if (local->size.load(std::memory_order_relaxed)) {
+      expire(local, now_ms, cbs);
+    }
+  }
+  TimerShard *shared = m_shared.get();
+  // 没有到期时不加锁
+  if (!shared->size.load(std::memory_order_acquire) ||
+      shared->next.load(std::memory_order_acquire) > now_ms) {
+    return;
   }
+  RWMutexType::WriteLock lock(m_mutex);
+  expire(shared, now_ms, cbs);
+}
+
+void TimerManager::addTimer(Timer::ptr val, RWMutexType::WriteLock &lock) {
+  val->m_self = val;
+  insertShared(val.get(), lock);
+}
+
+void TimerManager::insertShared(Timer *timer, RWMutexType::WriteLock &lock) {
+  timer->m_shard = m_shared.get();
+  bool at_front = m_shared->insert(timer) && !m_tickled.exchange(true);
+  m_shared->publishAdd(timer);
   lock.unlock();
 
   if (at_front) {
@@ -174,18 +880,90 @@ void TimerManager::addTimer(Timer::ptr val, RWMutexType::WriteLock &lock) {
   }
 }
 
-bool TimerManager::detectClockRollover(uint64_t now_ms) {
-  bool rollover = false;
-  if (now_ms < m_previouseTime && now_ms < (m_previouseTime - 60 * 60 * 1000)) {
-    rollover = true;
+void TimerManager::attachTimerThread() {
+  if (!g_timer_thread_shard->getValue() || localShard()) {
+    return;
+  }
+  TimerShard *shard = new TimerShard(this, m_backend, arvin::GetThreadId());
+  while (true) {
+    // 优先占用已退出线程空出的槽位, 没有时扩大上界后重新查找
+    size_t n = m_threadShardCount.load(std::memory_order_acquire);
+    for (size_t i = 0; i < n; ++i) {
+      TimerShard *expected = nullptr;
+      if (!m_threadShards[i].load(std::memory_order_relaxed) &&
+          m_threadShards[i].compare_exchange_strong(
+              expected, shard, std::memory_order_release)) {
+        t_shards.emplace_back(m_id, shard);
+        return;
+      }
+    }
+    if (n >= MAX_THREAD_SHARDS) {
+      break;
+    }
+    m_threadShardCount.compare_exchange_weak(n, n + 1);
+  }
+  // 用尽后退回共享分片
+  delete shard;
+  if (!m_shardsExhausted.exchange(true)) {
+    ARVIN_LOG_WARN(g_logger) << "timer thread shards exhausted max="
+                             << MAX_THREAD_SHARDS
+                             << ", fallback to shared shard";
+  }
+}
+
+void TimerManager::detachTimerThread() {
+  TimerShard *shard = localShard();
+  if (!shard) {
+    return;
+  }
+  shard->closed = true;
+  t_shards.erase(std::find_if(
+      t_shards.begin(), t_shards.end(),
+      [this](const std::pair<uint64_t, TimerShard *> &i) {
+        return i.first == m_id;
+      }));
+
+  // 节点池留在关闭的分片中, 迁移出去的节点回收时在m_mutex保护下放回
+  std::vector<Timer *> timers;
+  RWMutexType::WriteLock lock(m_mutex);
+  drain(shard);
+  shard->takeAll(timers);
+  shard->publish();
+  for (auto timer : timers) {
+    if ((timer->m_state & 3) != Timer::ACTIVE) {
+      release(timer);
+      continue;
+    }
+    timer->m_shard = m_shared.get();
+    m_shared->insert(timer);
+  }
+  m_shared->publish();
+  // 空出槽位给新线程, 分片本身保留到管理器析构
+  for (size_t i = 0; i < MAX_THREAD_SHARDS; ++i) {
+    TimerShard *expected = shard;
+    if (m_threadShards[i].compare_exchange_strong(expected, nullptr)) {
+      break;
+    }
+  }
+  m_closedShards.push_back(shard);
+  lock.unlock();
+  if (!timers.empty()) {
+    onTimerInsertedAtFront();
   }
-  m_previouseTime = now_ms;
-  return rollover;
 }
 
 bool TimerManager::hasTimer() {
-  RWMutexType::ReadLock lock(m_mutex);
-  return !m_timers.empty();
+  if (m_shared->size.load(std::memory_order_acquire)) {
+    return true;
+  }
+  size_t n = m_threadShardCount.load(std::memory_order_acquire);
+  for (size_t i = 0; i < n; ++i) {
+    TimerShard *shard = m_threadShards[i].load(std::memory_order_acquire);
+    if (shard && shard->size.load(std::memory_order_acquire)) {
+      return true;
+    }
+  }
+  return false;
 }
 
-} // namespace arvin
\ No newline at end of file
+} // namespace arvin
@@ -1,8 +1,10 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <vector>
 #include <set>
+#include <functional>
 #include "thread.h"
 #include <stdint.h>
 
@@ -10,17 +12,26 @@
 namespace arvin {
 
 class TimerManager;
+class TimingWheel;
+struct TimerShard;
+struct TimerOp;
+class TimerHandle;
 /**
  * @brief 定时器
  */
 class Timer : public std::enable_shared_from_this<Timer> {
 friend class TimerManager;
+friend class TimingWheel;
+friend struct TimerShard;
+friend class TimerHandle;
 public:
     /// 定时器的智能指针类型
     typedef std::shared_ptr<Timer> ptr;
 
     /**
      * @brief 取消定时器
+     * @details 可在任意线程调用, 返回值准确; 定时器在其他线程的分片中时
+     *          由所属线程稍后移除, 但回调不会再执行
      */
     bool cancel();
 
@@ -36,72 +47,198 @@ public:
      */
     bool reset(uint64_t ms, bool from_now);
 private:
+    /**
+     * @brief 定时器状态
+     */
+    enum State {
+        /// 等待执行(循环定时器始终处于该状态)
+        ACTIVE = 0,
+        /// 已执行
+        DONE = 1,
+        /// 已取消
+        CANCELLED = 2,
+    };
+
+    /**
+     * @brief 将代数与状态合成m_state的值
+     */
+    static uint64_t Pack(uint64_t gen, int state) { return gen << 2 | state;}
+
+    /**
+     * @brief 构造池中的空节点
+     */
+    Timer() {}
+
     /**
      * @brief 构造函数
      * @param[in] ms 定时器执行间隔时间
      * @param[in] cb 回调函数
      * @param[in] recurring 是否循环
      * @param[in] manager 定时器管理器
+     * @param[in] slack 允许推迟执行的毫秒数
      */
     Timer(uint64_t ms, std::function<void()> cb,
-          bool recurring, TimerManager* manager);
+          bool recurring, TimerManager* manager, uint64_t slack);
+
     /**
-     * @brief 构造函数
-     * @param[in] next 执行的时间戳(毫秒)
+     * @brief 从start开始计算执行时间, 向上取整到slack的整数倍
+     * @details 相同slack的定时器落在同一时间点上, 合并为一次唤醒
      */
-    Timer(uint64_t next);
+    uint64_t deadline(uint64_t start) const;
 private:
     /// 是否循环定时器
     bool m_recurring = false;
+    /// 是否分配自分片的节点池(由TimerHandle引用)
+    bool m_pooled = false;
     /// 执行周期
     uint64_t m_ms = 0;
-    /// 精确的执行时间
+    /// 执行时间(单调时钟毫秒, 见GetLoopMS)
     uint64_t m_next = 0;
+    /// 允许推迟执行的毫秒数, 0表示精确执行
+    uint64_t m_slack = 0;
     /// 回调函数
     std::function<void()> m_cb;
     /// 定时器管理器
     TimerManager* m_manager = nullptr;
+    /// 高位是节点的代数(回收时加一), 低2位是状态; 状态只能从ACTIVE变为DONE或CANCELLED
+    std::atomic<uint64_t> m_state = {ACTIVE};
+    /// 所在分片, 只会从线程分片迁移到共享分片
+    std::atomic<TimerShard*> m_shard = {nullptr};
+    /// 所属节点池的分片
+    TimerShard* m_home = nullptr;
+    /// 时间轮链表的前后节点, 在节点池空闲链表中时m_wheelNext指向下一个空闲节点
+    Timer* m_wheelPrev = nullptr;
+    Timer* m_wheelNext = nullptr;
+    /// 所在时间轮的层级, -1表示不在时间轮中
+    int16_t m_wheelLevel = -1;
+    /// 所在时间轮的槽位
+    uint16_t m_wheelSlot = 0;
+    /// 在管理器中时持有自身, 离开时释放(节点池中的定时器不使用)
+    Timer::ptr m_self;
 private:
     /**
      * @brief 定时器比较仿函数
      */
     struct Comparator {
         /**
-         * @brief 比较定时器的智能指针的大小(按执行时间排序)
-         * @param[in] lhs 定时器智能指针
-         * @param[in] rhs 定时器智能指针
+         * @brief 比较定时器的大小(按执行时间排序)
+         * @param[in] lhs 定时器
+         * @param[in] rhs 定时器
          */
-        bool operator()(const Timer::ptr& lhs, const Timer::ptr& rhs) const;
+        bool operator()(const Timer* lhs, const Timer* rhs) const;
     };
 };
 
+/**
+ * @brief 轻量定时器句柄
+ * @details 指向管理器节点池中的定时器, 带代数校验: 定时器执行或取消后节点被
+ *          回收复用, 旧句柄的操作返回false. 在所属线程添加和取消都不分配内存
+ *          (回调可放入std::function的内联存储, 且存储结构为时间轮时).
+ *          句柄不能在管理器析构后使用
+ */
+class TimerHandle {
+friend class TimerManager;
+public:
+    TimerHandle() {}
+
+    /**
+     * @brief 取消定时器, 语义同Timer::cancel
+     */
+    bool cancel();
+
+    /**
+     * @brief 刷新定时器的执行时间, 语义同Timer::refresh
+     */
+    bool refresh();
+
+    /**
+     * @brief 重置定时器时间, 语义同Timer::reset
+     */
+    bool reset(uint64_t ms, bool from_now);
+
+    /**
+     * @brief 定时器是否还在等待执行
+     */
+    bool isActive() const;
+
+    explicit operator bool() const { return m_node != nullptr;}
+private:
+    TimerHandle(Timer* node, uint64_t gen)
+        :m_node(node), m_gen(gen) {}
+private:
+    /// 节点池中的定时器
+    Timer* m_node = nullptr;
+    /// 创建时节点的代数
+    uint64_t m_gen = 0;
+};
+
 /**
  * @brief 定时器管理器
+ * @details 调用过attachTimerThread的线程拥有独占的定时器分片, 在本线程添加,
+ *          刷新, 重置, 取消定时器都不加锁; 其他线程对其中定时器的修改投递到
+ *          分片的无锁邮箱, 由所属线程处理. 其余线程的定时器放在共享分片中,
+ *          由m_mutex保护.
+ *          时间基准是单调时钟, 系统时间调整不影响定时器; 事件循环中的线程使用
+ *          每轮缓存的时间, 精度为一个时钟节拍
  */
 class TimerManager {
 friend class Timer;
+friend class TimerHandle;
 public:
     /// 读写锁类型
     typedef RWMutex RWMutexType;
 
+    /**
+     * @brief 定时器的存储结构
+     */
+    enum Backend {
+        /// 按执行时间排序的std::set, 增删改O(log n)
+        SET = 0,
+        /// 分层时间轮, 增删改O(1), 精度1毫秒
+        WHEEL = 1,
+    };
+
     /**
      * @brief 构造函数
+     * @details 存储结构由配置timer.backend(set/wheel)决定
      */
     TimerManager();
 
+    /**
+     * @brief 构造函数
+     * @param[in] backend 定时器的存储结构
+     */
+    TimerManager(Backend backend);
+
     /**
      * @brief 析构函数
      */
     virtual ~TimerManager();
 
+    /// 使用管理器的默认slack
+    static const uint64_t DEFAULT_SLACK = ~0ull;
+
     /**
      * @brief 添加定时器
      * @param[in] ms 定时器执行间隔时间
      * @param[in] cb 定时器回调函数
      * @param[in] recurring 是否循环定时器
+     * @param[in] slack 允许推迟执行的毫秒数, 执行时间向上取整到其整数倍
      */
     Timer::ptr addTimer(uint64_t ms, std::function<void()> cb
-                        ,bool recurring = false);
+                        ,bool recurring = false
+                        ,uint64_t slack = DEFAULT_SLACK);
+
+    /**
+     * @brief 添加节点池中的定时器, 返回轻量句柄
+     * @param[in] ms 定时器执行间隔时间
+     * @param[in] cb 定时器回调函数
+     * @param[in] recurring 是否循环定时器
+     * @param[in] slack 允许推迟执行的毫秒数
+     */
+    TimerHandle addTimerHandle(uint64_t ms, std::function<void()> cb
+                        ,bool recurring = false
+                        ,uint64_t slack = DEFAULT_SLACK);
 
     /**
      * @brief 添加条件定时器
@@ -109,10 +246,22 @@ public:
      * @param[in] cb 定时器回调函数
      * @param[in] weak_cond 条件
      * @param[in] recurring 是否循环
+     * @param[in] slack 允许推迟执行的毫秒数
      */
     Timer::ptr addConditionTimer(uint64_t ms, std::function<void()> cb
                         ,std::weak_ptr<void> weak_cond
-                        ,bool recurring = false);
+                        ,bool recurring = false
+                        ,uint64_t slack = DEFAULT_SLACK);
+
+    /**
+     * @brief 返回默认slack(毫秒)
+     */
+    uint64_t getDefaultSlack() const { return m_defaultSlack;}
+
+    /**
+     * @brief 设置默认slack(毫秒), 只影响之后添加的定时器
+     */
+    void setDefaultSlack(uint64_t v) { m_defaultSlack = v;}
 
     /**
      * @brief 到最近一个定时器执行的时间间隔(毫秒)
@@ -129,6 +278,17 @@ public:
      * @brief 是否有定时器
      */
     bool hasTimer();
+
+    /**
+     * @brief 返回定时器的存储结构
+     */
+    Backend getBackend() const { return m_backend;}
+
+    /**
+     * @brief 切换定时器的存储结构
+     * @return 已有定时器时不能切换, 返回false
+     */
+    bool setBackend(Backend backend);
 protected:
 
     /**
@@ -137,22 +297,108 @@ protected:
     virtual void onTimerInsertedAtFront() = 0;
 
     /**
-     * @brief 将定时器添加到管理器中
+     * @brief 其他线程修改了thread分片中的定时器, 执行时间可能提前
+     * @details 默认执行onTimerInsertedAtFront
+     */
+    virtual void onTimerPosted(int thread) { onTimerInsertedAtFront();}
+
+    /**
+     * @brief 将定时器添加到共享分片中
      */
     void addTimer(Timer::ptr val, RWMutexType::WriteLock& lock);
+
+    /**
+     * @brief 为当前线程创建独占的定时器分片
+     * @details 之后该线程添加的定时器只由该线程处理, 需要该线程持续调用
+     *          getNextTimer/listExpiredCb. 受配置timer.thread_shard控制
+     */
+    void attachTimerThread();
+
+    /**
+     * @brief 关闭当前线程的定时器分片, 剩余定时器迁移到共享分片
+     */
+    void detachTimerThread();
 private:
     /**
-     * @brief 检测服务器时间是否被调后了
+     * @brief 返回当前线程在本管理器中的分片, 没有返回nullptr
+     */
+    TimerShard* localShard() const;
+
+    /**
+     * @brief 放入当前线程的分片或共享分片
+     */
+    void addTimer(Timer* timer);
+
+    /**
+     * @brief 放入共享分片, 成为最早执行的定时器时通知
+     */
+    void insertShared(Timer* timer, RWMutexType::WriteLock& lock);
+
+    /**
+     * @brief 取消代数为gen的定时器
+     */
+    bool cancel(Timer* timer, uint64_t gen);
+
+    /**
+     * @brief 刷新代数为gen的定时器
+     */
+    bool refresh(Timer* timer, uint64_t gen);
+
+    /**
+     * @brief 重置代数为gen的定时器
+     */
+    bool reset(Timer* timer, uint64_t gen, uint64_t ms, bool from_now);
+
+    /**
+     * @brief 定时器离开存储结构后释放: 节点池中的回收, 其余释放自身引用
+     * @details 调用方需持有定时器所在分片的访问权
+     */
+    void release(Timer* timer);
+
+    /**
+     * @brief 修改定时器, 按其所在分片加锁执行, 本线程执行或投递到邮箱
+     */
+    void post(TimerOp& op);
+
+    /**
+     * @brief 在定时器所在分片中执行修改
+     * @return 是否成为分片中最早执行的定时器
+     */
+    bool applyOp(TimerOp* op);
+
+    /**
+     * @brief 处理分片邮箱中的所有修改
+     * @return 是否有定时器成为最早执行的定时器
+     */
+    bool drain(TimerShard* shard);
+
+    /**
+     * @brief 取出分片中到期的定时器, 循环定时器重新放入
      */
-    bool detectClockRollover(uint64_t now_ms);
+    void expire(TimerShard* shard, uint64_t now_ms
+                ,std::vector<std::function<void()> >& cbs);
 private:
-    /// Mutex
+    /// 同时存在的线程分片的最大数量, 线程退出后槽位复用
+    static const size_t MAX_THREAD_SHARDS = 256;
+    /// 保护共享分片
     RWMutexType m_mutex;
-    /// 定时器集合
-    std::set<Timer::ptr, Timer::Comparator> m_timers;
+    /// 管理器编号, 用于查找线程局部的分片
+    uint64_t m_id;
+    /// 存储结构
+    std::atomic<Backend> m_backend = {SET};
+    /// 默认slack, 初始值来自配置timer.slack_ms
+    std::atomic<uint64_t> m_defaultSlack = {0};
+    /// 共享分片
+    std::unique_ptr<TimerShard> m_shared;
+    /// 线程分片
+    std::atomic<TimerShard*> m_threadShards[MAX_THREAD_SHARDS];
+    /// 已使用过的槽位上界
+    std::atomic<size_t> m_threadShardCount = {0};
+    /// 已关闭的线程分片, 迁移出去的节点仍属于其节点池, 由m_mutex保护
+    std::vector<TimerShard*> m_closedShards;
+    /// 槽位用尽的警告是否已输出
+    std::atomic<bool> m_shardsExhausted = {false};
     /// 是否触发onTimerInsertedAtFront
-    bool m_tickled = false;
-    /// 上次执行时间
-    uint64_t m_previouseTime = 0;
+    std::atomic<bool> m_tickled = {false};
 };
 } // namespace arvin
\ No newline at end of file
@@ -0,0 +1,199 @@
+#include "uring.h"
+#include "log.h"
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace arvin {
+
+static arvin::Logger::ptr g_logger = ARVIN_LOG_NAME("system");
+
+static int io_uring_setup(uint32_t entries, io_uring_params *p) {
+  return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, uint32_t to_submit, uint32_t min_complete,
+                          uint32_t flags) {
+  return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                 nullptr, 0);
+}
+
+static int io_uring_register(int fd, uint32_t opcode, const void *arg,
+                             uint32_t nr_args) {
+  return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+bool IoUring::IsSupported() {
+  static int s_supported = -1;
+  if (s_supported < 0) {
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = io_uring_setup(2, &p);
+    if (fd >= 0) {
+      close(fd);
+      // 需要单次mmap与不丢弃完成事件的特性(5.5+)
+      s_supported = (p.features & IORING_FEAT_SINGLE_MMAP) &&
+                    (p.features & IORING_FEAT_NODROP);
+    } else {
+      s_supported = 0;
+    }
+  }
+  return s_supported;
+}
+
+IoUring::IoUring(uint32_t entries) {
+  memset(&m_params, 0, sizeof(m_params));
+  m_fd = io_uring_setup(entries, &m_params);
+  if (m_fd < 0) {
+    ARVIN_LOG_ERROR(g_logger) << "io_uring_setup(" << entries
+                              << ") errno=" << errno << " " << strerror(errno);
+    m_fd = -1;
+    return;
+  }
+
+  m_sqRingSize = m_params.sq_off.array + m_params.sq_entries * sizeof(uint32_t);
+  m_cqRingSize =
+      m_params.cq_off.cqes + m_params.cq_entries * sizeof(io_uring_cqe);
+  if (m_params.features & IORING_FEAT_SINGLE_MMAP) {
+    m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+  }
+  m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+  if (m_sqRing == MAP_FAILED) {
+    m_sqRing = nullptr;
+    goto failed;
+  }
+  if (m_params.features & IORING_FEAT_SINGLE_MMAP) {
+    m_cqRing = m_sqRing;
+  } else {
+    m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+    if (m_cqRing == MAP_FAILED) {
+      m_cqRing = nullptr;
+      goto failed;
+    }
+  }
+  m_sqesSize = m_params.sq_entries * sizeof(io_uring_sqe);
+  m_sqes = (io_uring_sqe *)mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_POPULATE, m_fd,
+                                IORING_OFF_SQES);
+  if (m_sqes == MAP_FAILED) {
+    m_sqes = nullptr;
+    goto failed;
+  }
+
+#define XX(ring, off) (uint32_t *)((char *)ring + off)
+  m_sqHead = XX(m_sqRing, m_params.sq_off.head);
+  m_sqTail = XX(m_sqRing, m_params.sq_off.tail);
+  m_sqMask = XX(m_sqRing, m_params.sq_off.ring_mask);
+  m_sqEntries = XX(m_sqRing, m_params.sq_off.ring_entries);
+  m_sqFlags = XX(m_sqRing, m_params.sq_off.flags);
+  m_sqArray = XX(m_sqRing, m_params.sq_off.array);
+  m_cqHead = XX(m_cqRing, m_params.cq_off.head);
+  m_cqTail = XX(m_cqRing, m_params.cq_off.tail);
+  m_cqMask = XX(m_cqRing, m_params.cq_off.ring_mask);
+  m_cqes = (io_uring_cqe *)((char *)m_cqRing + m_params.cq_off.cqes);
+#undef XX
+
+  // 提交项与提交队列下标一一对应
+  for (uint32_t i = 0; i < *m_sqEntries; ++i) {
+    m_sqArray[i] = i;
+  }
+  m_sqeTail = *m_sqTail;
+  return;
+
+failed:
+  ARVIN_LOG_ERROR(g_logger) << "io_uring mmap errno=" << errno << " "
+                            << strerror(errno);
+  release();
+}
+
+IoUring::~IoUring() { release(); }
+
+void IoUring::release() {
+  if (m_sqes) {
+    munmap(m_sqes, m_sqesSize);
+    m_sqes = nullptr;
+  }
+  if (m_cqRing && m_cqRing != m_sqRing) {
+    munmap(m_cqRing, m_cqRingSize);
+  }
+  m_cqRing = nullptr;
+  if (m_sqRing) {
+    munmap(m_sqRing, m_sqRingSize);
+    m_sqRing = nullptr;
+  }
+  if (m_fd >= 0) {
+    close(m_fd);
+    m_fd = -1;
+  }
+}
+
+io_uring_sqe *IoUring::getSqe() {
+  uint32_t head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+  if (m_sqeTail - head >= *m_sqEntries) {
+    return nullptr;
+  }
+  io_uring_sqe *sqe = &m_sqes[m_sqeTail & *m_sqMask];
+  ++m_sqeTail;
+  memset(sqe, 0, sizeof(io_uring_sqe));
+  return sqe;
+}
+
+uint32_t IoUring::unsubmitted() const {
+  return m_sqeTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+}
+
+int IoUring::submit() {
+  __atomic_store_n(m_sqTail, m_sqeTail, __ATOMIC_RELEASE);
+  uint32_t to_submit = unsubmitted();
+  uint32_t flags = 0;
+  if (__atomic_load_n(m_sqFlags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW) {
+    // 完成队列溢出时由内核暂存, 需要GETEVENTS才会回填
+    flags |= IORING_ENTER_GETEVENTS;
+  }
+  if (!to_submit && !flags) {
+    return 0;
+  }
+  int rt = 0;
+  do {
+    rt = io_uring_enter(m_fd, to_submit, 0, flags);
+  } while (rt < 0 && errno == EINTR);
+  return rt < 0 ? -errno : rt;
+}
+
+size_t IoUring::reap(std::vector<io_uring_cqe> &cqes) {
+  uint32_t head = *m_cqHead;
+  uint32_t tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+  size_t count = tail - head;
+  for (; head != tail; ++head) {
+    cqes.push_back(m_cqes[head & *m_cqMask]);
+  }
+  __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+  return count;
+}
+
+int IoUring::registerBuffers(const iovec *iovs, unsigned count) {
+  int rt = io_uring_register(m_fd, IORING_REGISTER_BUFFERS, iovs, count);
+  return rt < 0 ? -errno : rt;
+}
+
+int IoUring::registerFiles(const int *fds, unsigned count) {
+  int rt = io_uring_register(m_fd, IORING_REGISTER_FILES, fds, count);
+  return rt < 0 ? -errno : rt;
+}
+
+int IoUring::unregisterBuffers() {
+  int rt = io_uring_register(m_fd, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+  return rt < 0 ? -errno : rt;
+}
+
+int IoUring::unregisterFiles() {
+  int rt = io_uring_register(m_fd, IORING_UNREGISTER_FILES, nullptr, 0);
+  return rt < 0 ? -errno : rt;
+}
+
+} // namespace arvin
@@ -0,0 +1,135 @@
+/**
+ * @file uring.h
+ * @brief io_uring封装
+ * @details 直接使用io_uring_setup/io_uring_enter/io_uring_register系统调用,
+ *          不依赖liburing. 提交与收割都不加锁, 由调用方保证互斥
+ */
+#pragma once
+
+#include "noncopyable.h"
+#include <linux/io_uring.h>
+#include <memory>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <vector>
+
+namespace arvin {
+
+/**
+ * @brief io_uring实例
+ */
+class IoUring : Noncopyable {
+public:
+  typedef std::shared_ptr<IoUring> ptr;
+
+  /**
+   * @brief 当前内核是否支持io_uring(结果会被缓存)
+   */
+  static bool IsSupported();
+
+  /**
+   * @brief 构造函数
+   * @param[in] entries 提交队列长度, 完成队列为其两倍
+   */
+  IoUring(uint32_t entries);
+
+  /**
+   * @brief 析构函数
+   */
+  ~IoUring();
+
+  /**
+   * @brief 是否创建成功
+   */
+  bool isValid() const { return m_fd >= 0; }
+
+  /**
+   * @brief 返回io_uring的文件句柄, 有完成事件时可读, 可加入epoll
+   */
+  int getFd() const { return m_fd; }
+
+  /**
+   * @brief 获取一个空闲的提交项
+   * @return 提交队列已满时返回nullptr
+   */
+  io_uring_sqe *getSqe();
+
+  /**
+   * @brief 返回已填写尚未提交给内核的提交项数量
+   */
+  uint32_t unsubmitted() const;
+
+  /**
+   * @brief 将已填写的提交项提交给内核
+   * @return 成功返回提交的数量, 失败返回-errno
+   */
+  int submit();
+
+  /**
+   * @brief 收割所有已完成的事件
+   * @param[out] cqes 完成事件, 追加在末尾
+   * @return 收割的数量
+   */
+  size_t reap(std::vector<io_uring_cqe> &cqes);
+
+  /**
+   * @brief 注册固定缓冲区, 供READ_FIXED/WRITE_FIXED使用
+   * @return 成功返回0, 失败返回-errno
+   */
+  int registerBuffers(const iovec *iovs, unsigned count);
+
+  /**
+   * @brief 注册固定文件, 提交时以IOSQE_FIXED_FILE标志使用其下标
+   * @return 成功返回0, 失败返回-errno
+   */
+  int registerFiles(const int *fds, unsigned count);
+
+  /**
+   * @brief 注销固定缓冲区
+   */
+  int unregisterBuffers();
+
+  /**
+   * @brief 注销固定文件
+   */
+  int unregisterFiles();
+
+private:
+  /**
+   * @brief 解除映射并关闭句柄
+   */
+  void release();
+
+private:
+  /// io_uring文件句柄
+  int m_fd = -1;
+  /// 创建参数
+  io_uring_params m_params;
+  /// 提交队列映射
+  void *m_sqRing = nullptr;
+  size_t m_sqRingSize = 0;
+  /// 完成队列映射(SINGLE_MMAP时与提交队列相同)
+  void *m_cqRing = nullptr;
+  size_t m_cqRingSize = 0;
+  /// 提交项数组映射
+  io_uring_sqe *m_sqes = nullptr;
+  size_t m_sqesSize = 0;
+
+  /// 提交队列
+  uint32_t *m_sqHead = nullptr;
+  uint32_t *m_sqTail = nullptr;
+  uint32_t *m_sqMask = nullptr;
+  uint32_t *m_sqEntries = nullptr;
+  uint32_t *m_sqFlags = nullptr;
+  uint32_t *m_sqArray = nullptr;
+  /// 本地已填写的提交项末尾
+  uint32_t m_sqeTail = 0;
+
+  /// 完成队列
+  uint32_t *m_cqHead = nullptr;
+  uint32_t *m_cqTail = nullptr;
+  uint32_t *m_cqMask = nullptr;
+  io_uring_cqe *m_cqes = nullptr;
+};
+
+} // namespace arvin
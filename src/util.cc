@@ -1,6 +1,9 @@
 #include "util.h"
 #include <algorithm>
+#include <execinfo.h>
 #include <fstream>
+#include <sys/time.h>
+#include <time.h>
 namespace arvin
 {
 
@@ -11,6 +14,109 @@ namespace arvin
         return 0; 
     }
 
+    static std::string demangle(const char *str)
+    {
+        size_t size = 0;
+        int status = 0;
+        std::string rt;
+        rt.resize(256);
+        if (1 == sscanf(str, "%*[^(]%*[^_]%255[^)+]", &rt[0]))
+        {
+            char *v = abi::__cxa_demangle(&rt[0], nullptr, &size, &status);
+            if (v)
+            {
+                std::string result(v);
+                free(v);
+                return result;
+            }
+        }
+        if (1 == sscanf(str, "%255s", &rt[0]))
+        {
+            rt.resize(strlen(rt.c_str()));
+            return rt;
+        }
+        return str;
+    }
+
+    void Backtrace(std::vector<std::string> &bt, int size, int skip)
+    {
+        void **array = (void **)malloc((sizeof(void *) * size));
+        size_t s = ::backtrace(array, size);
+
+        char **strings = backtrace_symbols(array, s);
+        if (strings == NULL)
+        {
+            free(array);
+            return;
+        }
+
+        for (size_t i = skip; i < s; ++i)
+        {
+            bt.push_back(demangle(strings[i]));
+        }
+
+        free(strings);
+        free(array);
+    }
+
+    std::string BacktraceToString(int size, int skip, const std::string &prefix)
+    {
+        std::vector<std::string> bt;
+        Backtrace(bt, size, skip);
+        std::stringstream ss;
+        for (size_t i = 0; i < bt.size(); ++i)
+        {
+            ss << prefix << bt[i] << std::endl;
+        }
+        return ss.str();
+    }
+
+    uint64_t GetCurrentMS()
+    {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        return tv.tv_sec * 1000ul + tv.tv_usec / 1000;
+    }
+
+    uint64_t GetCurrentUS()
+    {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        return tv.tv_sec * 1000 * 1000ul + tv.tv_usec;
+    }
+
+    uint64_t GetMonotonicMS()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return ts.tv_sec * 1000ul + ts.tv_nsec / 1000000;
+    }
+
+    uint64_t GetMonotonicUS()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000 * 1000ul + ts.tv_nsec / 1000;
+    }
+
+    /// 0表示当前线程不在事件循环中
+    static thread_local uint64_t t_loop_ms = 0;
+
+    uint64_t GetLoopMS()
+    {
+        return t_loop_ms ? t_loop_ms : GetMonotonicMS();
+    }
+
+    uint64_t UpdateLoopMS()
+    {
+        return t_loop_ms = GetMonotonicMS();
+    }
+
+    void ClearLoopMS()
+    {
+        t_loop_ms = 0;
+    }
+
     std::string ToUpper(const std::string &name)
     {
         std::string rt = name;
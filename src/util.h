@@ -57,6 +57,35 @@ namespace arvin
    */
   uint64_t GetCurrentUS();
 
+  /**
+   * @brief 获取单调时钟的毫秒(CLOCK_MONOTONIC_COARSE)
+   * @details 不受系统时间调整影响, 只能用于计算时间间隔; 精度为一个时钟节拍
+   */
+  uint64_t GetMonotonicMS();
+
+  /**
+   * @brief 获取单调时钟的微秒(CLOCK_MONOTONIC)
+   * @details 用于统计耗时, 系统时间回拨时不会得到负的间隔
+   */
+  uint64_t GetMonotonicUS();
+
+  /**
+   * @brief 获取本线程事件循环缓存的单调时钟毫秒
+   * @details 不在事件循环中的线程直接读取时钟
+   */
+  uint64_t GetLoopMS();
+
+  /**
+   * @brief 刷新本线程缓存的单调时钟, 由事件循环每轮调用
+   * @return 刷新后的时间
+   */
+  uint64_t UpdateLoopMS();
+
+  /**
+   * @brief 清除本线程缓存的单调时钟, 退出事件循环时调用
+   */
+  void ClearLoopMS();
+
   std::string ToUpper(const std::string &name);
 
   std::string ToLower(const std::string &name);
@@ -0,0 +1,80 @@
+#include "../src/coroutine.h"
+#include "../src/log.h"
+#include "../src/macro.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+static arvin::Logger::ptr g_logger = ARVIN_LOG_ROOT();
+
+arvin::co::Task<int> fib(int n) {
+  if (n < 2) {
+    co_return n;
+  }
+  int a = co_await fib(n - 1);
+  co_await arvin::co::yield();
+  int b = co_await fib(n - 2);
+  co_return a + b;
+}
+
+arvin::co::Task<> test_interop() {
+  // 协程等待Fiber任务
+  arvin::TaskGroup group;
+  auto f = group.spawn([]() {
+    usleep(10 * 1000);
+    return 7;
+  });
+  int v = co_await arvin::co::await(f);
+  ARVIN_LOG_INFO(g_logger) << "fiber result=" << v;
+  group.wait();
+}
+
+arvin::co::Task<> test_sleep() {
+  uint64_t start = arvin::GetCurrentMS();
+  co_await arvin::co::sleep{50};
+  ARVIN_LOG_INFO(g_logger) << "sleep 50ms elapsed="
+                           << arvin::GetCurrentMS() - start;
+}
+
+arvin::co::Task<> test_io() {
+  int fds[2];
+  pipe2(fds, O_NONBLOCK);
+  // 写端空闲时立即可写
+  int w = co_await arvin::co::writable(fds[1]);
+  ARVIN_ASSERT(w == 0);
+  arvin::IOManager::GetThis()->addTimer(
+      30, [fds]() { write(fds[1], "x", 1); });
+  uint64_t start = arvin::GetCurrentMS();
+  int r = co_await arvin::co::readable(fds[0]);
+  char c = 0;
+  ssize_t n = read(fds[0], &c, 1);
+  ARVIN_ASSERT(r == 0 && n == 1 && c == 'x');
+  ARVIN_LOG_INFO(g_logger) << "readable elapsed="
+                           << arvin::GetCurrentMS() - start;
+  // 不在IOManager中的fd注册失败时不挂起
+  int bad = co_await arvin::co::readable(-1);
+  ARVIN_ASSERT(bad == -1);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+void test_fiber() {
+  // Fiber等待协程任务
+  auto f = arvin::co::spawn(fib(15));
+  ARVIN_LOG_INFO(g_logger) << "fib(15)=" << f.get();
+  arvin::co::spawn(test_interop()).get();
+}
+
+int main(int argc, char **argv) {
+  arvin::Scheduler sc(3, false, "test");
+  sc.start();
+  sc.schedule(&test_fiber);
+  // 普通线程等待协程任务
+  ARVIN_LOG_INFO(g_logger) << "fib(20)=" << arvin::co::spawn(fib(20), &sc).get();
+  sc.stop();
+
+  arvin::IOManager iom(2, false, "iom");
+  arvin::co::spawn(test_sleep(), &iom).get();
+  arvin::co::spawn(test_io(), &iom).get();
+  ARVIN_LOG_INFO(g_logger) << "over";
+  return 0;
+}
@@ -0,0 +1,198 @@
+#include "../src/address.h"
+#include "../src/dns.h"
+#include "../src/iomanager.h"
+#include "../src/log.h"
+#include "../src/macro.h"
+#include <fstream>
+#include <string.h>
+
+static arvin::Logger::ptr g_logger = ARVIN_LOG_ROOT();
+
+static bool s_stop = false;
+static int s_queries = 0;
+
+static void put16(std::string &out, uint16_t v) {
+  out.push_back((char)(v >> 8));
+  out.push_back((char)(v & 0xff));
+}
+
+static void put32(std::string &out, uint32_t v) {
+  put16(out, v >> 16);
+  put16(out, v & 0xffff);
+}
+
+/**
+ * @brief 本地DNS服务: a.test(TTL 1), b.test(应答延迟100ms), v6.test(AAAA),
+ *        slow.test(600ms后回复ID不匹配的应答), 其余返回NXDOMAIN(SOA MINIMUM为1秒)
+ */
+void dns_server(int fd) {
+  char buf[512];
+  sockaddr_in peer;
+  while (!s_stop) {
+    socklen_t len = sizeof(peer);
+    ssize_t n = recvfrom(fd, buf, sizeof(buf), 0, (sockaddr *)&peer, &len);
+    if (n < 17) {
+      continue;
+    }
+    ++s_queries;
+    std::string name;
+    size_t pos = 12;
+    while (pos < (size_t)n && buf[pos]) {
+      if (!name.empty()) {
+        name += ".";
+      }
+      name.append(buf + pos + 1, buf[pos]);
+      pos += buf[pos] + 1;
+    }
+    size_t qend = pos + 5;
+    uint16_t qtype = ((uint8_t)buf[pos + 1] << 8) | (uint8_t)buf[pos + 2];
+
+    std::string answer;
+    if (name == "a.test" && qtype == 1) {
+      answer = std::string("\x0a\x00\x00\x01", 4);
+    } else if (name == "b.test" && qtype == 1) {
+      usleep(100 * 1000);
+      answer = std::string("\x0a\x00\x00\x02", 4);
+    } else if (name == "v6.test" && qtype == 28) {
+      answer = std::string(15, '\0') + "\x01";
+    } else if (name == "slow.test") {
+      usleep(600 * 1000);
+      buf[0] = ~buf[0];
+    }
+
+    std::string rsp(buf, 2);
+    put16(rsp, answer.empty() ? 0x8183 : 0x8180);
+    put16(rsp, 1);
+    put16(rsp, answer.empty() ? 0 : 1);
+    put16(rsp, answer.empty() ? 1 : 0);
+    put16(rsp, 0);
+    rsp.append(buf + 12, qend - 12);
+    put16(rsp, 0xc00c);
+    if (!answer.empty()) {
+      put16(rsp, qtype);
+      put16(rsp, 1);
+      put32(rsp, name == "a.test" ? 1 : 60);
+      put16(rsp, answer.size());
+      rsp += answer;
+    } else {
+      put16(rsp, 6);
+      put16(rsp, 1);
+      put32(rsp, 60);
+      put16(rsp, 25);
+      rsp += std::string("\x02ns\x00\x00", 5);
+      put32(rsp, 1);
+      put32(rsp, 60);
+      put32(rsp, 60);
+      put32(rsp, 60);
+      put32(rsp, 1);
+    }
+    sendto(fd, rsp.data(), rsp.size(), 0, (sockaddr *)&peer, len);
+  }
+  close(fd);
+}
+
+static std::string resolve(arvin::DnsResolver::ptr resolver,
+                           const std::string &name, int family = AF_INET) {
+  std::vector<arvin::IPAddress::ptr> addrs;
+  if (!resolver->resolve(addrs, name, family)) {
+    return "none";
+  }
+  return addrs[0]->toString();
+}
+
+void dns_client(arvin::DnsResolver::ptr resolver) {
+  std::string host = resolve(resolver, "myhost.test");
+  ARVIN_LOG_INFO(g_logger) << "hosts myhost.test=" << host
+                           << " queries=" << resolver->getQueryCount();
+  ARVIN_ASSERT(host == "10.9.9.9:0");
+  ARVIN_ASSERT(resolver->getQueryCount() == 0);
+
+  std::string a1 = resolve(resolver, "a.test");
+  std::string a2 = resolve(resolver, "A.Test.");
+  ARVIN_LOG_INFO(g_logger) << "a.test=" << a1 << "," << a2
+                           << " queries=" << resolver->getQueryCount();
+  ARVIN_ASSERT(a1 == "10.0.0.1:0" && a2 == a1);
+  ARVIN_ASSERT(resolver->getQueryCount() == 1);
+
+  std::string m1 = resolve(resolver, "missing.test");
+  std::string m2 = resolve(resolver, "missing.test");
+  ARVIN_LOG_INFO(g_logger) << "missing.test=" << m1 << "," << m2
+                           << " queries=" << resolver->getQueryCount();
+  ARVIN_ASSERT(m1 == "none" && m2 == "none");
+  ARVIN_ASSERT(resolver->getQueryCount() == 2);
+
+  // 并发查询同一个域名只发出一次请求
+  auto done = std::make_shared<arvin::FiberSemaphore>();
+  for (int i = 0; i < 10; ++i) {
+    arvin::IOManager::GetThis()->schedule([resolver, done]() {
+      ARVIN_ASSERT(resolve(resolver, "b.test") == "10.0.0.2:0");
+      done->notify();
+    });
+  }
+  for (int i = 0; i < 10; ++i) {
+    done->wait();
+  }
+  ARVIN_LOG_INFO(g_logger) << "b.test x10 queries="
+                           << resolver->getQueryCount();
+  ARVIN_ASSERT(resolver->getQueryCount() == 3);
+
+  // TTL到期后重新查询, b.test的TTL为60秒仍在缓存中
+  usleep(1100 * 1000);
+  resolve(resolver, "a.test");
+  resolve(resolver, "missing.test");
+  resolve(resolver, "b.test");
+  ARVIN_LOG_INFO(g_logger) << "after ttl queries="
+                           << resolver->getQueryCount();
+  ARVIN_ASSERT(resolver->getQueryCount() == 5);
+
+  std::string v6 = resolve(resolver, "v6.test", AF_INET6);
+  ARVIN_LOG_INFO(g_logger) << "v6.test=" << v6;
+  ARVIN_ASSERT(v6 == "[::1]:0");
+
+  // 不匹配的应答不延长等待, 总耗时不超过timeout:1
+  uint64_t start = arvin::GetMonotonicMS();
+  std::string slow = resolve(resolver, "slow.test");
+  uint64_t elapsed = arvin::GetMonotonicMS() - start;
+  ARVIN_LOG_INFO(g_logger) << "slow.test=" << slow << " elapsed=" << elapsed;
+  ARVIN_ASSERT(slow == "none");
+  ARVIN_ASSERT(elapsed >= 900 && elapsed < 1300);
+
+  arvin::Address::ptr addr = arvin::Address::LookupAny("localhost:80");
+  ARVIN_LOG_INFO(g_logger) << "Address::LookupAny localhost:80="
+                           << (addr ? addr->toString() : "none");
+  ARVIN_ASSERT(addr);
+  s_stop = true;
+}
+
+int main(int argc, char **argv) {
+  {
+    std::ofstream ofs("/tmp/arvin_test_hosts");
+    ofs << "# test hosts\n10.9.9.9 myhost.test myhost\n";
+  }
+  {
+    std::ofstream ofs("/tmp/arvin_test_resolv");
+    ofs << "options timeout:1 attempts:1\n";
+  }
+
+  arvin::IOManager iom(1, false);
+  iom.schedule([]() {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    arvin::IPv4Address::ptr addr = arvin::IPv4Address::Create("127.0.0.1");
+    bind(fd, addr->getAddr(), addr->getAddrLen());
+    socklen_t len = addr->getAddrLen();
+    getsockname(fd, addr->getAddr(), &len);
+    timeval tv = {0, 100 * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    arvin::IOManager::GetThis()->schedule(std::bind(&dns_server, fd));
+
+    arvin::DnsResolver::ptr resolver(new arvin::DnsResolver(
+        "/tmp/arvin_test_resolv", "/tmp/arvin_test_hosts"));
+    resolver->setNameservers({addr});
+    dns_client(resolver);
+  });
+  iom.stop();
+  ARVIN_LOG_INFO(g_logger) << "server queries=" << s_queries;
+  unlink("/tmp/arvin_test_hosts");
+  unlink("/tmp/arvin_test_resolv");
+  return 0;
+}
@@ -0,0 +1,256 @@
+#include "../src/fd_manager.h"
+#include "../src/hook.h"
+#include "../src/iomanager.h"
+#include "../src/log.h"
+#include "../src/macro.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <map>
+#include <sstream>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static arvin::Logger::ptr g_logger = ARVIN_LOG_ROOT();
+
+void test_sleep() {
+  // 单线程上两个协程同时sleep, 总耗时取决于较长的一个
+  arvin::IOManager iom(1, false);
+  uint64_t start = arvin::GetMonotonicMS();
+  iom.schedule([]() {
+    usleep(200 * 1000);
+    ARVIN_LOG_INFO(g_logger) << "usleep 200ms";
+  });
+  iom.schedule([]() {
+    struct timespec ts = {0, 300 * 1000 * 1000};
+    nanosleep(&ts, nullptr);
+    ARVIN_LOG_INFO(g_logger) << "nanosleep 300ms";
+  });
+  iom.stop();
+  uint64_t elapsed = arvin::GetMonotonicMS() - start;
+  ARVIN_LOG_INFO(g_logger) << "test_sleep elapsed=" << elapsed;
+  // 两次sleep并发执行, 没有串行成500ms
+  ARVIN_ASSERT(elapsed >= 300 && elapsed < 400);
+}
+
+static int s_port = 0;
+static bool s_echo_done = false;
+
+void echo_server(int listen_fd) {
+  int fd = accept(listen_fd, nullptr, nullptr);
+  close(listen_fd);
+  char buf[64];
+  ssize_t n = 0;
+  while ((n = read(fd, buf, sizeof(buf))) > 0) {
+    if (buf[0] == 'q') {
+      // 不回复, 让客户端读超时
+      continue;
+    }
+    write(fd, buf, n);
+  }
+  close(fd);
+}
+
+void echo_client() {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(s_port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int rt = connect(fd, (const sockaddr *)&addr, sizeof(addr));
+  ARVIN_LOG_INFO(g_logger) << "connect rt=" << rt;
+  ARVIN_ASSERT(rt == 0);
+
+  timeval tv = {0, 100 * 1000};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  char buf[64];
+  send(fd, "hello", 5, 0);
+  ssize_t n = recv(fd, buf, sizeof(buf), 0);
+  ARVIN_LOG_INFO(g_logger) << "echo n=" << n << " data="
+                           << std::string(buf, n > 0 ? n : 0);
+  ARVIN_ASSERT(n == 5 && !memcmp(buf, "hello", 5));
+
+  uint64_t start = arvin::GetMonotonicMS();
+  send(fd, "q", 1, 0);
+  n = recv(fd, buf, sizeof(buf), 0);
+  int err = errno;
+  uint64_t elapsed = arvin::GetMonotonicMS() - start;
+  ARVIN_LOG_INFO(g_logger) << "timeout n=" << n << " errno=" << err << " "
+                           << strerror(err) << " elapsed=" << elapsed;
+  // SO_RCVTIMEO到期: 内核语义是EAGAIN, hook的定时器返回ETIMEDOUT
+  ARVIN_ASSERT(n == -1 && (err == EAGAIN || err == ETIMEDOUT));
+  ARVIN_ASSERT(elapsed >= 100 && elapsed < 200);
+  close(fd);
+  s_echo_done = true;
+}
+
+void test_deadline() {
+  // 截止时间覆盖多次IO, 每次重试不会重新得到完整的SO_RCVTIMEO
+  arvin::IOManager iom(1, false);
+  static bool s_done = false;
+  iom.schedule([]() {
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    arvin::FdMgr::GetInstance()->get(fds[0], true);
+    timeval tv = {0, 100 * 1000};
+    setsockopt(fds[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    arvin::DeadlineScope outer(1000);
+    uint64_t start = arvin::GetMonotonicMS();
+    int count = 0;
+    {
+      arvin::DeadlineScope deadline(250);
+      char buf[16];
+      uint64_t last = arvin::get_deadline_remaining();
+      ARVIN_ASSERT(last <= 250);
+      while (last > 0) {
+        recv(fds[0], buf, sizeof(buf), 0);
+        ++count;
+        // 每次recv都消耗剩余时间
+        uint64_t remain = arvin::get_deadline_remaining();
+        ARVIN_ASSERT(remain < last);
+        last = remain;
+      }
+      uint64_t elapsed = arvin::GetMonotonicMS() - start;
+      ARVIN_LOG_INFO(g_logger) << "deadline recv count=" << count
+                               << " elapsed=" << elapsed;
+      // 100ms, 100ms, 剩余的50ms
+      ARVIN_ASSERT(count == 3);
+      ARVIN_ASSERT(elapsed >= 250 && elapsed < 350);
+      // 到期后立即失败
+      ssize_t n = recv(fds[0], buf, sizeof(buf), 0);
+      int err = errno;
+      ARVIN_LOG_INFO(g_logger) << "after deadline n=" << n << " errno=" << err
+                               << " " << strerror(err);
+      ARVIN_ASSERT(n == -1 && err == ETIMEDOUT);
+      ARVIN_ASSERT(arvin::GetMonotonicMS() - start - elapsed < 20);
+    }
+    // 内层结束后恢复外层的截止时间
+    uint64_t remain = arvin::get_deadline_remaining();
+    ARVIN_LOG_INFO(g_logger) << "deadline restored remaining=" << remain;
+    ARVIN_ASSERT(remain > 500 && remain <= 750);
+    close(fds[0]);
+    close(fds[1]);
+    s_done = true;
+  });
+  iom.stop();
+  ARVIN_ASSERT(s_done);
+}
+
+void test_sock() {
+  // 单线程上服务端与客户端都以阻塞方式编写
+  arvin::IOManager iom(1, false);
+  iom.schedule([]() {
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(listen_fd, (const sockaddr *)&addr, sizeof(addr));
+    listen(listen_fd, 16);
+    socklen_t len = sizeof(addr);
+    getsockname(listen_fd, (sockaddr *)&addr, &len);
+    s_port = ntohs(addr.sin_port);
+    arvin::IOManager::GetThis()->schedule(std::bind(&echo_server, listen_fd));
+    arvin::IOManager::GetThis()->schedule(&echo_client);
+  });
+  iom.stop();
+  ARVIN_ASSERT(s_echo_done);
+}
+
+void test_file_io() {
+  // 普通文件读写由io_uring或阻塞IO线程池完成, 不阻塞工作线程
+  arvin::IOManager iom(1, false);
+  iom.schedule([]() {
+    const char *path = "/tmp/arvin_test_hook_file";
+    int fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0644);
+    std::string data(64 * 1024, 'x');
+    ssize_t n = write(fd, data.data(), data.size());
+    int rt = fsync(fd);
+    std::string buf(data.size(), 0);
+    ssize_t m = pread(fd, &buf[0], buf.size(), 0);
+    ARVIN_LOG_INFO(g_logger) << "file write=" << n << " fsync=" << rt
+                             << " pread=" << m << " equal=" << (buf == data);
+    ARVIN_ASSERT(n == (ssize_t)data.size() && rt == 0);
+    ARVIN_ASSERT(m == (ssize_t)data.size() && buf == data);
+    close(fd);
+    unlink(path);
+  });
+  iom.stop();
+
+  // 分片模式下卸载到阻塞IO线程池的协程回到原线程
+  arvin::IOManager sharded(2, false, "sharded", true);
+  for (int i = 0; i < 8; ++i) {
+    sharded.schedule([i]() {
+      std::string path = "/tmp/arvin_test_hook_shard_" + std::to_string(i);
+      int fd = open(path.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0644);
+      pid_t tid = arvin::GetThreadId();
+      for (int j = 0; j < 4; ++j) {
+        fsync(fd);
+        ARVIN_ASSERT(tid == arvin::GetThreadId());
+      }
+      close(fd);
+      unlink(path.c_str());
+    });
+  }
+  sharded.stop();
+}
+
+#if ARVIN_HOOK_STATS
+/**
+ * @brief 两次统计快照之间某个hook函数的增量
+ */
+struct HookStatsDelta {
+  std::map<std::string, arvin::HookStatsData> before;
+
+  HookStatsDelta() { arvin::get_hook_stats(before); }
+
+  arvin::HookStatsData get(const std::string &key) {
+    std::map<std::string, arvin::HookStatsData> after;
+    arvin::get_hook_stats(after);
+    arvin::HookStatsData d = after[key];
+    const arvin::HookStatsData &b = before[key];
+    d.calls -= b.calls;
+    d.yields -= b.yields;
+    d.timeouts -= b.timeouts;
+    d.blocked_us -= b.blocked_us;
+    return d;
+  }
+};
+#endif
+
+int main(int argc, char **argv) {
+  test_sleep();
+#if ARVIN_HOOK_STATS
+  {
+    HookStatsDelta delta;
+    test_sock();
+    // 客户端: 回显与超时两次recv都要等待, 后一次超时
+    arvin::HookStatsData recv = delta.get("recv/socket");
+    ARVIN_ASSERT(recv.calls == 2 && recv.yields == 2 && recv.timeouts == 1);
+    // 服务端: hello, q, EOF三次read
+    arvin::HookStatsData read = delta.get("read/socket");
+    ARVIN_ASSERT(read.calls == 3 && read.yields <= 3 && read.timeouts == 0);
+    arvin::HookStatsData connect = delta.get("connect/socket");
+    ARVIN_ASSERT(connect.calls == 1 && connect.timeouts == 0);
+  }
+  {
+    HookStatsDelta delta;
+    test_deadline();
+    // 截止时间内三次等待超时, 到期后的一次直接超时不再等待
+    arvin::HookStatsData recv = delta.get("recv/socket");
+    ARVIN_ASSERT(recv.calls == 4 && recv.yields == 3 && recv.timeouts == 4);
+  }
+#else
+  test_sock();
+  test_deadline();
+#endif
+  test_file_io();
+  // 开启ARVIN_HOOK_STATS时输出各hook函数的统计
+  std::stringstream ss;
+  arvin::dump_hook_stats(ss);
+  ARVIN_LOG_INFO(g_logger) << ss.str();
+  return 0;
+}
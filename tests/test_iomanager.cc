@@ -0,0 +1,548 @@
+#include "../src/config.h"
+#include "../src/hook.h"
+#include "../src/iomanager.h"
+#include "../src/log.h"
+#include "../src/macro.h"
+#include <arpa/inet.h>
+#include <atomic>
+#include <fcntl.h>
+#include <set>
+#include <sstream>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static arvin::Logger::ptr g_logger = ARVIN_LOG_ROOT();
+
+static int s_listen = -1;
+static int s_port = 0;
+
+void listen_local() {
+  s_listen = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  bind(s_listen, (const sockaddr *)&addr, sizeof(addr));
+  listen(s_listen, 16);
+  socklen_t len = sizeof(addr);
+  getsockname(s_listen, (sockaddr *)&addr, &len);
+  s_port = ntohs(addr.sin_port);
+}
+
+static std::atomic<int> s_read_cb = {0};
+static std::atomic<int> s_write_cb = {0};
+
+void test_fiber() {
+  ARVIN_LOG_INFO(g_logger) << "test_fiber";
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  fcntl(sock, F_SETFL, O_NONBLOCK);
+
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(s_port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if (!connect(sock, (const sockaddr *)&addr, sizeof(addr))) {
+  } else if (errno == EINPROGRESS) {
+    ARVIN_LOG_INFO(g_logger) << "add event errno=" << errno << " "
+                             << strerror(errno);
+    arvin::IOManager::GetThis()->addEvent(sock, arvin::IOManager::READ, []() {
+      ARVIN_LOG_INFO(g_logger) << "read callback";
+      ++s_read_cb;
+    });
+    arvin::IOManager::GetThis()->addEvent(
+        sock, arvin::IOManager::WRITE, [sock]() {
+          ARVIN_LOG_INFO(g_logger) << "write callback";
+          ++s_write_cb;
+          arvin::IOManager::GetThis()->cancelEvent(sock,
+                                                   arvin::IOManager::READ);
+          arvin::IOManager::GetThis()->cancelAll(sock);
+          close(sock);
+        });
+  } else {
+    ARVIN_LOG_INFO(g_logger) << "else " << errno << " " << strerror(errno);
+  }
+}
+
+void test1() {
+  listen_local();
+  {
+    arvin::IOManager iom(2, false);
+    iom.schedule(&test_fiber);
+  }
+  // 连接建立时写事件触发, 取消读事件时其回调也会执行一次
+  ARVIN_ASSERT(s_write_cb == 1);
+  ARVIN_ASSERT(s_read_cb == 1);
+}
+
+void test_timer(arvin::TimerManager::Backend backend) {
+  static int s_count = 0;
+  static arvin::Timer::ptr s_timer;
+  static std::atomic<uint64_t> s_refreshed_ms = {0};
+  static std::atomic<int> s_cancelled_fired = {0};
+  s_count = 0;
+  s_refreshed_ms = 0;
+  s_cancelled_fired = 0;
+  uint64_t start = arvin::GetMonotonicMS();
+  uint64_t refresh_ms = 0;
+  bool cancel = false;
+  bool cancel_again = true;
+  {
+    arvin::IOManager iom(2);
+    iom.setBackend(backend);
+    s_timer = iom.addTimer(
+        100,
+        [start]() {
+          ARVIN_LOG_INFO(g_logger)
+              << "hello timer count=" << s_count
+              << " elapsed=" << arvin::GetMonotonicMS() - start;
+          if (++s_count == 3) {
+            s_timer->cancel();
+          }
+        },
+        true);
+    // 刷新后重新计时, 取消后不再执行
+    arvin::Timer::ptr refreshed = iom.addTimer(50, []() {
+      s_refreshed_ms = arvin::GetMonotonicMS();
+    });
+    arvin::Timer::ptr cancelled = iom.addTimer(80, []() {
+      ARVIN_LOG_ERROR(g_logger) << "cancelled timer";
+      ++s_cancelled_fired;
+    });
+    usleep(30 * 1000);
+    refresh_ms = arvin::GetMonotonicMS();
+    refreshed->refresh();
+    cancel = cancelled->cancel();
+    cancel_again = cancelled->cancel();
+  }
+  s_timer.reset();
+  ARVIN_LOG_INFO(g_logger) << "timer backend=" << backend
+                           << " refreshed fired after "
+                           << s_refreshed_ms - refresh_ms << "ms"
+                           << " cancel=" << cancel
+                           << " again=" << cancel_again;
+  ARVIN_ASSERT(s_count == 3);
+  ARVIN_ASSERT(s_refreshed_ms >= refresh_ms + 50);
+  ARVIN_ASSERT(cancel && !cancel_again);
+  ARVIN_ASSERT(s_cancelled_fired == 0);
+}
+
+void test_timer_cross_thread(arvin::TimerManager::Backend backend) {
+  // 工作线程添加的定时器在其独占分片中, 由主线程跨线程取消和重置
+  arvin::IOManager iom(2);
+  iom.setBackend(backend);
+  static arvin::Timer::ptr s_cancelled;
+  static arvin::Timer::ptr s_reset;
+  static std::atomic<bool> s_added = {false};
+  static std::atomic<uint64_t> s_fired_ms = {0};
+  static std::atomic<int> s_cancelled_fired = {0};
+  s_added = false;
+  s_fired_ms = 0;
+  s_cancelled_fired = 0;
+  iom.schedule([]() {
+    arvin::IOManager *iom = arvin::IOManager::GetThis();
+    s_cancelled = iom->addTimer(50, []() {
+      ARVIN_LOG_ERROR(g_logger) << "cross thread cancel failed";
+      ++s_cancelled_fired;
+    });
+    s_reset = iom->addTimer(2000,
+                            []() { s_fired_ms = arvin::GetMonotonicMS(); });
+    s_added = true;
+  });
+  while (!s_added) {
+    usleep(1000);
+  }
+  usleep(10 * 1000);
+  uint64_t start = arvin::GetMonotonicMS();
+  bool cancelled = s_cancelled->cancel();
+  bool again = s_cancelled->cancel();
+  s_reset->reset(30, true);
+  usleep(200 * 1000);
+  ARVIN_LOG_INFO(g_logger) << "cross thread backend=" << backend
+                           << " cancel=" << cancelled << " again=" << again
+                           << " reset fired after "
+                           << (s_fired_ms ? s_fired_ms - start : 0) << "ms";
+  ARVIN_ASSERT(cancelled && !again);
+  ARVIN_ASSERT(s_cancelled_fired == 0);
+  // 重置后按新的截止时间触发, 而不是原来的2000ms
+  ARVIN_ASSERT(s_fired_ms >= start + 30);
+  ARVIN_ASSERT(s_fired_ms < start + 200);
+  s_cancelled.reset();
+  s_reset.reset();
+}
+
+size_t test_timer_slack(uint64_t slack) {
+  // 大量相近的超时, slack越大触发的时间点越少
+  static const int N = 2000;
+  static std::set<uint64_t> s_fire_ms;
+  static arvin::Mutex s_fire_mutex;
+  static std::atomic<int> s_early = {0};
+  s_fire_ms.clear();
+  s_early = 0;
+  arvin::IOManager iom(1, false);
+  for (int i = 0; i < N; ++i) {
+    uint64_t ms = 50 + rand() % 300;
+    uint64_t deadline = arvin::GetMonotonicMS() + ms;
+    iom.addTimer(
+        ms,
+        [deadline]() {
+          uint64_t now = arvin::GetMonotonicMS();
+          // slack只会推迟触发, 不会提前
+          if (now < deadline) {
+            ++s_early;
+          }
+          arvin::Mutex::Lock lock(s_fire_mutex);
+          s_fire_ms.insert(now);
+        },
+        false, slack);
+  }
+  iom.stop();
+  ARVIN_LOG_INFO(g_logger) << "timer slack=" << slack << " timers=" << N
+                           << " wakeups=" << s_fire_ms.size()
+                           << " early=" << s_early;
+  ARVIN_ASSERT(s_early == 0);
+  return s_fire_ms.size();
+}
+
+void test_timer_handle() {
+  // 句柄执行或取消后失效, 节点复用后旧句柄的操作返回false
+  arvin::IOManager iom(1, false);
+  static std::atomic<int> s_fired = {0};
+  s_fired = 0;
+  arvin::TimerHandle fired = iom.addTimerHandle(10, []() { ++s_fired; });
+  arvin::TimerHandle cancelled = iom.addTimerHandle(
+      20, []() { ARVIN_LOG_ERROR(g_logger) << "cancelled handle fired"; });
+  bool cancel = cancelled.cancel();
+  usleep(50 * 1000);
+  // 新定时器复用已释放的节点, 旧句柄不能取消它
+  arvin::TimerHandle reused = iom.addTimerHandle(30, []() { ++s_fired; });
+  bool stale = fired.cancel() || cancelled.cancel() || fired.isActive();
+  bool reused_active = reused.isActive();
+  iom.stop();
+  ARVIN_LOG_INFO(g_logger) << "timer handle cancel=" << cancel
+                           << " stale=" << stale
+                           << " reused_active=" << reused_active
+                           << " fired=" << s_fired;
+  ARVIN_ASSERT(cancel);
+  ARVIN_ASSERT(!stale);
+  ARVIN_ASSERT(reused_active);
+  ARVIN_ASSERT(s_fired == 2);
+}
+
+class ChurnTimerManager : public arvin::TimerManager {
+public:
+  ChurnTimerManager() : arvin::TimerManager(arvin::TimerManager::SET) {}
+  using arvin::TimerManager::attachTimerThread;
+  using arvin::TimerManager::detachTimerThread;
+  std::atomic<int> tickles = {0};
+
+protected:
+  void onTimerInsertedAtFront() override { ++tickles; }
+};
+
+void test_timer_shard_churn() {
+  // 线程反复创建退出, 槽位复用后新线程仍能得到独占分片
+  ChurnTimerManager mgr;
+  for (int i = 0; i < 300; ++i) {
+    arvin::Thread thr(
+        [&mgr]() {
+          mgr.attachTimerThread();
+          mgr.addTimerHandle(1000, []() {}).cancel();
+          mgr.detachTimerThread();
+        },
+        "churn");
+    thr.join();
+  }
+  // 独占分片中添加定时器不需要唤醒, 退回共享分片时才会唤醒
+  bool local = false;
+  arvin::Thread thr(
+      [&mgr, &local]() {
+        mgr.attachTimerThread();
+        arvin::TimerHandle handle = mgr.addTimerHandle(1000, []() {});
+        local = mgr.tickles == 0;
+        handle.cancel();
+        mgr.detachTimerThread();
+      },
+      "churn");
+  thr.join();
+  ARVIN_LOG_INFO(g_logger) << "timer shard churn local=" << local
+                           << " tickles=" << mgr.tickles;
+  ARVIN_ASSERT(local);
+  ARVIN_ASSERT(!mgr.hasTimer());
+}
+
+static std::atomic<int> s_accepted = {0};
+static std::atomic<int> s_moved = {0};
+static std::atomic<bool> s_stop = {false};
+static std::vector<int> s_shard_listens;
+static arvin::Mutex s_shard_mutex;
+
+void handle_conn(int fd, int accept_thread) {
+  char buf[64];
+  while (true) {
+    int n = read(fd, buf, sizeof(buf));
+    if (n < 0 && errno == EAGAIN) {
+      arvin::IOManager::GetThis()->addEvent(fd, arvin::IOManager::READ);
+      arvin::Fiber::YieldToHold();
+      continue;
+    }
+    break;
+  }
+  if (arvin::GetThreadId() != accept_thread) {
+    ++s_moved;
+  }
+  arvin::IOManager::GetThis()->cancelAll(fd);
+  close(fd);
+}
+
+void shard_accept(size_t shard) {
+  // 每个分片一个SO_REUSEPORT监听socket
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  int val = 1;
+  setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val));
+  fcntl(sock, F_SETFL, O_NONBLOCK);
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(s_port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(sock, (const sockaddr *)&addr, sizeof(addr)) || listen(sock, 64)) {
+    ARVIN_LOG_ERROR(g_logger) << "shard=" << shard << " listen errno=" << errno;
+    close(sock);
+    return;
+  }
+  {
+    arvin::Mutex::Lock lock(s_shard_mutex);
+    s_shard_listens.push_back(sock);
+  }
+  ARVIN_LOG_INFO(g_logger) << "shard=" << shard << " listen on thread "
+                           << arvin::GetThreadId();
+  while (!s_stop) {
+    int conn = accept(sock, nullptr, nullptr);
+    if (conn < 0) {
+      if (errno == EAGAIN) {
+        arvin::IOManager::GetThis()->addEvent(sock, arvin::IOManager::READ);
+        arvin::Fiber::YieldToHold();
+      }
+      continue;
+    }
+    ++s_accepted;
+    fcntl(conn, F_SETFL, O_NONBLOCK);
+    int thread = arvin::GetThreadId();
+    // 连接在accept所在的线程上处理
+    arvin::IOManager::GetThis()->schedule(
+        std::bind(&handle_conn, conn, thread), thread);
+  }
+  close(sock);
+}
+
+void test_sharded() {
+  // 先绑定一个端口号, 再由每个分片复用
+  int probe = socket(AF_INET, SOCK_STREAM, 0);
+  int val = 1;
+  setsockopt(probe, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val));
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  bind(probe, (const sockaddr *)&addr, sizeof(addr));
+  socklen_t len = sizeof(addr);
+  getsockname(probe, (sockaddr *)&addr, &len);
+  s_port = ntohs(addr.sin_port);
+
+  arvin::IOManager iom(3, false, "shard", true);
+  iom.runOnShards(&shard_accept);
+  while (true) {
+    arvin::Mutex::Lock lock(s_shard_mutex);
+    if (s_shard_listens.size() == iom.getShardCount()) {
+      break;
+    }
+    lock.unlock();
+    usleep(1000);
+  }
+  close(probe);
+
+  for (int i = 0; i < 64; ++i) {
+    int c = socket(AF_INET, SOCK_STREAM, 0);
+    if (!connect(c, (const sockaddr *)&addr, sizeof(addr))) {
+      write(c, "hello", 5);
+    }
+    close(c);
+  }
+  while (s_accepted < 64) {
+    usleep(1000);
+  }
+  s_stop = true;
+  for (auto i : s_shard_listens) {
+    iom.cancelAll(i);
+  }
+  iom.stop();
+  std::stringstream ss;
+  iom.dump(ss);
+  ARVIN_LOG_INFO(g_logger) << "sharded accepted=" << s_accepted
+                           << " moved=" << s_moved << "\n"
+                           << ss.str();
+  // 所有连接都在accept所在的分片线程上处理
+  ARVIN_ASSERT(s_accepted == 64);
+  ARVIN_ASSERT(s_moved == 0);
+}
+
+static int s_hot_reads = 0;
+static int s_cold_at = -1;
+
+void hot_reader(int fd) {
+  char buf[16];
+  while (read(fd, buf, sizeof(buf)) > 0) {
+    ++s_hot_reads;
+    // 连续读取达到上限后让出, 同线程上的其他协程得以执行
+    if (arvin::IOManager::GetThis()->chargeRead(fd)) {
+      arvin::Fiber::YieldToReady();
+    }
+  }
+}
+
+void test_fairness() {
+  int fds[2];
+  socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+  char buf[4096] = {0};
+  write(fds[1], buf, sizeof(buf));
+  {
+    arvin::IOManager iom(1, false);
+    iom.schedule(std::bind(&hot_reader, fds[0]));
+    iom.schedule([]() { s_cold_at = s_hot_reads; });
+  }
+  ARVIN_LOG_INFO(g_logger) << "fairness hot_reads=" << s_hot_reads
+                           << " cold ran after " << s_cold_at;
+  // 4096字节每次读16字节, 冷协程在热协程读完之前得到执行
+  ARVIN_ASSERT(s_hot_reads == 256);
+  ARVIN_ASSERT(s_cold_at >= 0 && s_cold_at < s_hot_reads);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+static int s_pri_recv = -1;
+static char s_pri_data = 0;
+static int s_pri_read = -1;
+static bool s_peer_closed = false;
+
+void wait_pri(int fd) {
+  arvin::IOManager *iom = arvin::IOManager::GetThis();
+  iom->addEvent(fd, arvin::IOManager::PRI);
+  arvin::Fiber::YieldToHold();
+  char c = 0;
+  int n = recv(fd, &c, 1, MSG_OOB);
+  ARVIN_LOG_INFO(g_logger) << "pri recv=" << n << " data=" << c;
+  s_pri_recv = n;
+  s_pri_data = c;
+
+  char buf[16];
+  while (true) {
+    n = read(fd, buf, sizeof(buf));
+    if (n < 0 && errno == EAGAIN) {
+      iom->addEvent(fd, arvin::IOManager::READ);
+      arvin::Fiber::YieldToHold();
+      continue;
+    }
+    break;
+  }
+  ARVIN_LOG_INFO(g_logger) << "read=" << n
+                           << " peer_closed=" << iom->isPeerClosed(fd);
+  s_pri_read = n;
+  s_peer_closed = iom->isPeerClosed(fd);
+  iom->cancelAll(fd);
+  close(fd);
+}
+
+void test_pri_rdhup() {
+  int l = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  bind(l, (const sockaddr *)&addr, sizeof(addr));
+  listen(l, 1);
+  socklen_t len = sizeof(addr);
+  getsockname(l, (sockaddr *)&addr, &len);
+  int c = socket(AF_INET, SOCK_STREAM, 0);
+  connect(c, (const sockaddr *)&addr, sizeof(addr));
+  int srv = accept(l, nullptr, nullptr);
+  close(l);
+  fcntl(srv, F_SETFL, O_NONBLOCK);
+
+  arvin::IOManager iom(1, false);
+  iom.schedule(std::bind(&wait_pri, srv));
+  usleep(20 * 1000);
+  send(c, "!", 1, MSG_OOB);
+  usleep(20 * 1000);
+  shutdown(c, SHUT_WR);
+  iom.stop();
+  close(c);
+  ARVIN_ASSERT(s_pri_recv == 1 && s_pri_data == '!');
+  // 对端关闭写方向: 读到EOF且记录了RDHUP
+  ARVIN_ASSERT(s_pri_read == 0);
+  ARVIN_ASSERT(s_peer_closed);
+}
+
+static std::atomic<int> s_owner = {0};
+static std::atomic<bool> s_owner_ran = {false};
+
+void test_sharded_retire() {
+  auto retire_ms =
+      arvin::Config::Lookup<uint32_t>("scheduler.elastic.retire_ms");
+  uint32_t old_retire_ms = retire_ms->getValue();
+  retire_ms->setValue(1);
+  arvin::IOManager iom(1, false, "retire", true);
+  iom.schedule([]() {
+    s_owner = arvin::GetThreadId();
+    // 阻塞区间内补充一个与独占线程共用分片的工作线程
+    arvin::BlockingSection blocking;
+    // 让补充的线程保持忙碌, 独占线程先空闲超时
+    arvin::IOManager::GetThis()->schedule([]() {
+      arvin::set_hook_enable(false);
+      usleep(3500 * 1000);
+      arvin::set_hook_enable(true);
+    });
+    arvin::set_hook_enable(false);
+    usleep(50 * 1000);
+    arvin::set_hook_enable(true);
+  });
+  usleep(10 * 1000);
+  ARVIN_ASSERT(iom.getWorkerCount() == 2);
+  // 独占线程空闲超时也不能退出, 最终退出的是补充的线程
+  for (int i = 0; i < 10000 && iom.getWorkerCount() > 1; ++i) {
+    usleep(1000);
+  }
+  ARVIN_ASSERT(iom.getWorkerCount() == 1);
+  iom.schedule([]() { s_owner_ran = arvin::GetThreadId() == s_owner; },
+               s_owner);
+  for (int i = 0; i < 1000 && !s_owner_ran; ++i) {
+    usleep(1000);
+  }
+  ARVIN_LOG_INFO(g_logger) << "sharded retire owner=" << s_owner
+                           << " owner_ran=" << s_owner_ran;
+  ARVIN_ASSERT(s_owner_ran);
+  iom.stop();
+  retire_ms->setValue(old_retire_ms);
+}
+
+int main(int argc, char **argv) {
+  test1();
+  test_timer(arvin::TimerManager::SET);
+  test_timer(arvin::TimerManager::WHEEL);
+  test_timer_cross_thread(arvin::TimerManager::SET);
+  test_timer_cross_thread(arvin::TimerManager::WHEEL);
+  size_t wakeups = test_timer_slack(0);
+  size_t slack_wakeups = test_timer_slack(50);
+  ARVIN_ASSERT(slack_wakeups * 4 < wakeups);
+  test_timer_handle();
+  test_timer_shard_churn();
+  test_sharded();
+  test_fairness();
+  test_pri_rdhup();
+  test_sharded_retire();
+  close(s_listen);
+  return 0;
+}
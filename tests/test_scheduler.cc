@@ -0,0 +1,386 @@
+#include "../src/config.h"
+#include "../src/fiber.h"
+#include "../src/log.h"
+#include "../src/macro.h"
+#include "../src/scheduler.h"
+#include "../src/task_group.h"
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
+
+static arvin::Logger::ptr g_logger = ARVIN_LOG_ROOT();
+
+void test_fiber() {
+  static int s_count = 5;
+  ARVIN_LOG_INFO(g_logger) << "test in fiber s_count=" << s_count;
+
+  usleep(100 * 1000);
+  if (--s_count >= 0) {
+    arvin::Scheduler::GetThis()->schedule(&test_fiber, arvin::GetThreadId());
+  }
+}
+
+void test_stats() {
+  static const int N = 100;
+  std::atomic<int> done = {0};
+  arvin::Scheduler sc(2, false, "stats");
+  sc.start();
+  for (int i = 0; i < N; ++i) {
+    sc.schedule([&done]() {
+      usleep(100);
+      ++done;
+    });
+  }
+  sc.stop();
+  arvin::Scheduler::Stats stats;
+  sc.getStats(stats);
+  ARVIN_LOG_INFO(g_logger)
+      << "stats tasks=" << stats.total.tasks
+      << " run_us.count=" << stats.total.run_us.count
+      << " queue_wait_us.max=" << stats.total.queue_wait_us.max
+      << " run_us.max=" << stats.total.run_us.max;
+  ARVIN_ASSERT(done == N);
+  ARVIN_ASSERT(stats.total.tasks >= (uint64_t)N);
+  ARVIN_ASSERT(stats.total.run_us.count >= (uint64_t)N);
+  // 单调时钟下的间隔不会回绕成巨大的无符号数
+  ARVIN_ASSERT(stats.total.queue_wait_us.max < 10 * 1000 * 1000);
+  ARVIN_ASSERT(stats.total.run_us.max < 10 * 1000 * 1000);
+}
+
+void test_parked_wakeup() {
+  // 挂起时间远大于等待时间, 任务只能靠唤醒而不是挂起超时得到执行
+  static std::atomic<int> s_done = {0};
+  static std::atomic<int> s_pinned_done = {0};
+  arvin::Scheduler sc(3, false, "park");
+  arvin::Scheduler::IdlePolicy policy;
+  policy.park_ms = 10 * 1000;
+  sc.setIdlePolicy(policy);
+  sc.start();
+  usleep(50 * 1000);
+
+  // 空闲线程全部挂起后投递, 由tickle按LIFO唤醒
+  static const int N = 100;
+  for (int i = 0; i < N; ++i) {
+    sc.schedule([]() { ++s_done; });
+  }
+  for (int i = 0; i < 1000 && s_done < N; ++i) {
+    usleep(1000);
+  }
+  ARVIN_ASSERT(s_done == N);
+
+  // 固定到指定线程的任务由tickleThread唤醒该线程
+  arvin::Scheduler::Stats stats;
+  sc.getStats(stats);
+  ARVIN_ASSERT(stats.per_worker.size() == 3);
+  usleep(50 * 1000);
+  for (auto &i : stats.per_worker) {
+    int thread = i.thread;
+    sc.schedule(
+        [thread]() {
+          ARVIN_ASSERT(arvin::GetThreadId() == thread);
+          ++s_pinned_done;
+        },
+        thread);
+  }
+  for (int i = 0; i < 1000 && s_pinned_done < 3; ++i) {
+    usleep(1000);
+  }
+  ARVIN_ASSERT(s_pinned_done == 3);
+  sc.getStats(stats);
+  ARVIN_LOG_INFO(g_logger) << "parked wakeup done=" << s_done
+                           << " pinned=" << s_pinned_done
+                           << " wakeups=" << stats.total.wakeups;
+  ARVIN_ASSERT(stats.total.wakeups > 0);
+  sc.stop();
+}
+
+void test_elastic() {
+  auto retire_ms =
+      arvin::Config::Lookup<uint32_t>("scheduler.elastic.retire_ms");
+  uint32_t old_retire_ms = retire_ms->getValue();
+  retire_ms->setValue(50);
+  arvin::Scheduler sc(1, false, "elastic");
+  arvin::Scheduler::IdlePolicy policy;
+  policy.park_ms = 10;
+  sc.setIdlePolicy(policy);
+  sc.setElastic(1, 4);
+  sc.start();
+
+  // 任务持续积压时增加工作线程
+  static std::atomic<int> s_done = {0};
+  static const int N = 40;
+  for (int i = 0; i < N; ++i) {
+    sc.schedule([]() {
+      usleep(20 * 1000);
+      ++s_done;
+    });
+  }
+  size_t max_workers = 0;
+  while (s_done < N) {
+    max_workers = std::max(max_workers, sc.getWorkerCount());
+    usleep(1000);
+  }
+  ARVIN_LOG_INFO(g_logger) << "elastic grow max_workers=" << max_workers;
+  ARVIN_ASSERT(max_workers > 1 && max_workers <= 4);
+
+  // 空闲超过retire_ms后退回下限
+  for (int i = 0; i < 2000 && sc.getWorkerCount() > 1; ++i) {
+    usleep(1000);
+  }
+  ARVIN_ASSERT(sc.getWorkerCount() == 1);
+
+  // 唯一的工作线程阻塞时补充一个线程, 后面的任务不被阻塞
+  static std::atomic<bool> s_blocked = {false};
+  static std::atomic<bool> s_released = {false};
+  static std::atomic<bool> s_ran = {false};
+  sc.schedule([]() {
+    arvin::BlockingSection blocking;
+    s_blocked = true;
+    while (!s_released) {
+      usleep(1000);
+    }
+  });
+  while (!s_blocked) {
+    usleep(1000);
+  }
+  sc.schedule([]() { s_ran = true; });
+  for (int i = 0; i < 1000 && !s_ran; ++i) {
+    usleep(1000);
+  }
+  size_t blocking_workers = sc.getWorkerCount();
+  s_released = true;
+  ARVIN_LOG_INFO(g_logger) << "elastic blocking workers=" << blocking_workers
+                           << " ran=" << s_ran;
+  ARVIN_ASSERT(s_ran);
+  ARVIN_ASSERT(blocking_workers == 2);
+  for (int i = 0; i < 2000 && sc.getWorkerCount() > 1; ++i) {
+    usleep(1000);
+  }
+  ARVIN_ASSERT(sc.getWorkerCount() == 1);
+  sc.stop();
+  retire_ms->setValue(old_retire_ms);
+}
+
+void test_time_slice() {
+  static std::atomic<bool> s_long_done = {false};
+  static std::atomic<bool> s_short_ran = {false};
+  static std::atomic<bool> s_overtaken = {false};
+  arvin::Scheduler sc(1, false, "slice");
+  sc.setTimeSlice(20);
+  sc.start();
+  // 长任务在安全点让出, 排在后面的任务在它结束前得到执行
+  sc.schedule([]() {
+    uint64_t start = arvin::GetMonotonicMS();
+    while (arvin::GetMonotonicMS() - start < 200) {
+      usleep(1000);
+      arvin::Fiber::MaybeYield();
+    }
+    s_overtaken = s_short_ran.load();
+    s_long_done = true;
+  });
+  sc.schedule([]() { s_short_ran = true; });
+  while (!s_long_done) {
+    usleep(1000);
+  }
+  // 等watchdog扫描完最后一段执行再取统计
+  usleep(50 * 1000);
+  arvin::Scheduler::Stats stats;
+  sc.getStats(stats);
+  uint64_t preempts = stats.total.preempts;
+  uint64_t overruns = stats.total.overruns;
+  ARVIN_LOG_INFO(g_logger) << "time slice overtaken=" << s_overtaken
+                           << " preempts=" << preempts
+                           << " overruns=" << overruns;
+  ARVIN_ASSERT(s_overtaken);
+  ARVIN_ASSERT(preempts >= 1);
+  ARVIN_ASSERT(overruns >= preempts);
+
+  // 不经过安全点的任务只被watchdog记录超时, 不会被让出
+  static std::atomic<bool> s_hog_done = {false};
+  sc.schedule([]() {
+    uint64_t start = arvin::GetMonotonicMS();
+    while (arvin::GetMonotonicMS() - start < 100) {
+      usleep(1000);
+    }
+    s_hog_done = true;
+  });
+  while (!s_hog_done) {
+    usleep(1000);
+  }
+  sc.stop();
+  sc.getStats(stats);
+  ARVIN_LOG_INFO(g_logger) << "time slice hog preempts="
+                           << stats.total.preempts
+                           << " overruns=" << stats.total.overruns;
+  ARVIN_ASSERT(stats.total.preempts == preempts);
+  ARVIN_ASSERT(stats.total.overruns == overruns + 1);
+}
+
+void test_task_group() {
+  static std::atomic<int> s_ran = {0};
+  static std::atomic<bool> s_done = {false};
+  // 单线程时子任务都排在驱动任务之后, 执行顺序确定
+  arvin::Scheduler sc(1, false, "group");
+  sc.start();
+  sc.schedule([]() {
+    // 第一个失败取消尚未开始的任务, wait抛出第一个异常
+    arvin::TaskGroup group;
+    auto f0 = group.spawn([]() -> int {
+      ++s_ran;
+      throw std::runtime_error("first");
+    });
+    auto f1 = group.spawn([]() {
+      ++s_ran;
+      throw std::runtime_error("second");
+    });
+    auto f2 = group.spawn([]() {
+      ++s_ran;
+      return 2;
+    });
+    std::string what;
+    try {
+      group.wait();
+    } catch (std::runtime_error &ex) {
+      what = ex.what();
+    }
+    ARVIN_ASSERT(what == "first");
+    ARVIN_ASSERT(s_ran == 1);
+    ARVIN_ASSERT(group.isCancelled());
+    bool cancelled = false;
+    try {
+      f1.get();
+    } catch (arvin::TaskCancelled &) {
+      cancelled = true;
+    }
+    ARVIN_ASSERT(cancelled);
+    cancelled = false;
+    try {
+      f2.get();
+    } catch (arvin::TaskCancelled &) {
+      cancelled = true;
+    }
+    ARVIN_ASSERT(cancelled);
+    what.clear();
+    try {
+      f0.get();
+    } catch (std::runtime_error &ex) {
+      what = ex.what();
+    }
+    ARVIN_ASSERT(what == "first");
+    // 异常只抛出一次
+    group.wait();
+
+    // cancel跳过尚未开始的任务, 不视为失败
+    s_ran = 0;
+    arvin::TaskGroup cancel_group;
+    std::vector<arvin::Future<void>> futures;
+    for (int i = 0; i < 3; ++i) {
+      futures.push_back(cancel_group.spawn([]() { ++s_ran; }));
+    }
+    cancel_group.cancel();
+    cancel_group.wait();
+    ARVIN_ASSERT(s_ran == 0);
+    for (auto &i : futures) {
+      cancelled = false;
+      try {
+        i.get();
+      } catch (arvin::TaskCancelled &) {
+        cancelled = true;
+      }
+      ARVIN_ASSERT(cancelled);
+    }
+
+    // waitAny返回最先结束的任务序号
+    arvin::TaskGroup any_group;
+    bool empty = false;
+    try {
+      any_group.waitAny();
+    } catch (std::logic_error &) {
+      empty = true;
+    }
+    ARVIN_ASSERT(empty);
+    // 先开始的任务挂起等待, 后开始的任务先结束
+    arvin::Promise<int> gate;
+    arvin::Future<int> gate_future = gate.getFuture();
+    auto slow = any_group.spawn([gate_future]() { return gate_future.get(); });
+    auto fast = any_group.spawn([]() { return 1; });
+    size_t first = any_group.waitAny();
+    ARVIN_ASSERT(first == 1);
+    ARVIN_ASSERT(!slow.ready() && fast.ready());
+    // 已有结果时不再等待
+    ARVIN_ASSERT(any_group.waitAny() == 1);
+    gate.setValue(0);
+    any_group.wait();
+    ARVIN_ASSERT(slow.get() == 0 && fast.get() == 1);
+    s_done = true;
+  });
+  sc.stop();
+  ARVIN_LOG_INFO(g_logger) << "task group done=" << s_done;
+  ARVIN_ASSERT(s_done);
+}
+
+static std::atomic<int> s_chain = {0};
+static std::atomic<int> s_chain_moved = {0};
+
+void chain_fiber(int thread) {
+  if (thread != arvin::GetThreadId()) {
+    ++s_chain_moved;
+  }
+  usleep(2 * 1000);
+  if (++s_chain < 100) {
+    // 固定到本线程的任务排队时本线程不能退出
+    arvin::Scheduler::GetThis()->schedule(
+        std::bind(&chain_fiber, arvin::GetThreadId()), arvin::GetThreadId());
+  }
+}
+
+void test_retire_pinned() {
+  arvin::Config::Lookup<uint32_t>("scheduler.elastic.retire_ms")->setValue(1);
+  arvin::Scheduler sc(1, false, "retire");
+  sc.setElastic(1, 2);
+  sc.start();
+  sc.schedule([]() {
+    // 阻塞区间内补充一个工作线程
+    arvin::BlockingSection blocking;
+    usleep(50 * 1000);
+  });
+  usleep(10 * 1000);
+  ARVIN_ASSERT(sc.getWorkerCount() == 2);
+  // 补充的线程空闲1ms即可退出, 期间不断有任务固定到执行它的线程
+  for (int i = 0; i < 2; ++i) {
+    sc.schedule(std::bind(&chain_fiber, -1));
+  }
+  while (s_chain < 100) {
+    usleep(1000);
+  }
+  // 阻塞区间结束后多出的线程最终退出
+  for (int i = 0; i < 1000 && sc.getWorkerCount() > 1; ++i) {
+    usleep(1000);
+  }
+  size_t workers = sc.getWorkerCount();
+  sc.stop();
+  ARVIN_LOG_INFO(g_logger) << "retire chain=" << s_chain
+                           << " moved=" << s_chain_moved
+                           << " workers=" << workers;
+  ARVIN_ASSERT(s_chain_moved == 2);
+  ARVIN_ASSERT(workers == 1);
+}
+
+int main(int argc, char **argv) {
+  ARVIN_LOG_INFO(g_logger) << "main";
+  arvin::Scheduler sc(3, false, "test");
+  sc.start();
+  sleep(1);
+  ARVIN_LOG_INFO(g_logger) << "schedule";
+  sc.schedule(&test_fiber);
+  sc.stop();
+  test_stats();
+  test_parked_wakeup();
+  test_elastic();
+  test_time_slice();
+  test_task_group();
+  test_retire_pinned();
+  ARVIN_LOG_INFO(g_logger) << "over";
+  return 0;
+}
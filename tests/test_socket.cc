@@ -0,0 +1,108 @@
+#include "../src/iomanager.h"
+#include "../src/log.h"
+#include "../src/macro.h"
+#include "../src/socket.h"
+#include <fcntl.h>
+#include <string>
+#include <unistd.h>
+
+static arvin::Logger::ptr g_logger = ARVIN_LOG_ROOT();
+
+static const size_t s_file_size = 4 * 1024 * 1024;
+static const size_t s_buffer_size = 1024 * 1024;
+
+/// 服务端收到的字节数与校验和
+static size_t s_recv_total = 0;
+static uint64_t s_recv_sum = 0;
+/// 客户端发出的字节数与校验和
+static int64_t s_send_total = 0;
+static uint64_t s_send_sum = 0;
+/// 零拷贝缓冲区是否已释放, 收取后仍未完成的缓冲区数
+static bool s_released = false;
+static size_t s_pending = ~0ull;
+
+static uint64_t checksum(const char *data, size_t len, uint64_t sum = 0) {
+  for (size_t i = 0; i < len; ++i) {
+    sum = sum * 31 + (uint8_t)data[i];
+  }
+  return sum;
+}
+
+void server(arvin::Socket::ptr listener) {
+  arvin::Socket::ptr client = listener->accept();
+  std::string buf(64 * 1024, 0);
+  size_t total = 0;
+  uint64_t sum = 0;
+  while (true) {
+    int n = client->recv(&buf[0], buf.size());
+    if (n <= 0) {
+      break;
+    }
+    sum = checksum(buf.data(), n, sum);
+    total += n;
+  }
+  ARVIN_LOG_INFO(g_logger) << "server recv=" << total << " sum=" << sum;
+  s_recv_total = total;
+  s_recv_sum = sum;
+}
+
+void client(arvin::Address::ptr addr) {
+  const char *path = "/tmp/arvin_test_socket_file";
+  std::string data(s_file_size, 0);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = i % 251;
+  }
+  int fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0644);
+  write(fd, data.data(), data.size());
+
+  arvin::Socket::ptr sock = arvin::Socket::CreateTCP(addr);
+  bool zerocopy = sock->setZeroCopy(true);
+  sock->connect(addr);
+
+  // 跳过前1KB, 验证偏移
+  int64_t n = sock->sendFile(fd, 1024, s_file_size - 1024);
+  uint64_t sum = checksum(data.data() + 1024, s_file_size - 1024);
+  close(fd);
+  unlink(path);
+
+  std::string *buffer = new std::string(s_buffer_size, 'z');
+  int m = sock->sendZeroCopy(buffer->data(), buffer->size(), [buffer]() {
+    delete buffer;
+    s_released = true;
+  });
+  sum = checksum(std::string(s_buffer_size, 'z').data(), s_buffer_size, sum);
+  size_t pending = sock->reapZeroCopy(1000);
+  ARVIN_LOG_INFO(g_logger) << "client sendFile=" << n << " zerocopy=" << zerocopy
+                           << " sendZeroCopy=" << m << " pending=" << pending
+                           << " released=" << s_released
+                           << " copied=" << sock->getZeroCopyCopied()
+                           << " expect=" << n + m << " sum=" << sum;
+  ARVIN_ASSERT(n == (int64_t)(s_file_size - 1024));
+  ARVIN_ASSERT(m == (int)s_buffer_size);
+  s_send_total = n + m;
+  s_send_sum = sum;
+  s_pending = pending;
+  sock->close();
+}
+
+int main(int argc, char **argv) {
+  arvin::IOManager iom(1, false);
+  iom.schedule([]() {
+    arvin::Address::ptr addr = arvin::IPv4Address::Create("127.0.0.1");
+    arvin::Socket::ptr listener = arvin::Socket::CreateTCP(addr);
+    listener->bind(addr);
+    listener->listen();
+    ARVIN_LOG_INFO(g_logger) << *listener;
+    arvin::IOManager::GetThis()->schedule(std::bind(&server, listener));
+    arvin::IOManager::GetThis()->schedule(
+        std::bind(&client, listener->getLocalAddress()));
+  });
+  iom.stop();
+  // 偏移错误或done从未调用都会在这里失败
+  ARVIN_ASSERT(s_recv_total == (size_t)s_send_total);
+  ARVIN_ASSERT(s_recv_sum == s_send_sum);
+  ARVIN_ASSERT(s_pending == 0);
+  ARVIN_ASSERT(s_released);
+  ARVIN_LOG_INFO(g_logger) << "test_socket ok";
+  return 0;
+}
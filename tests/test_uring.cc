@@ -0,0 +1,151 @@
+#include "../src/config.h"
+#include "../src/iomanager.h"
+#include "../src/log.h"
+#include "../src/macro.h"
+#include <arpa/inet.h>
+#include <atomic>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static arvin::Logger::ptr g_logger = ARVIN_LOG_ROOT();
+
+/// 多次触发的轮询结束时的结果与触发次数
+static int s_poll_end = 0;
+static int s_polls = 0;
+/// 服务端与客户端的协程都执行完毕
+static std::atomic<int> s_socket_done = {0};
+
+void test_pipe() {
+  arvin::IOManager *iom = arvin::IOManager::GetThis();
+  int fds[2];
+  pipe(fds);
+  ssize_t n = iom->uringWrite(fds[1], "hello", 5);
+  char buf[16] = {0};
+  ssize_t m = iom->uringRead(fds[0], buf, sizeof(buf));
+  ARVIN_LOG_INFO(g_logger) << "pipe write=" << n << " read=" << m
+                           << " buf=" << buf;
+  ARVIN_ASSERT(n == 5 && m == 5 && !strcmp(buf, "hello"));
+
+  // 固定文件: 用注册时的下标代替fd
+  int files[2] = {fds[0], fds[1]};
+  int rt = iom->registerFiles(files, 2);
+  n = iom->uringSubmit([](io_uring_sqe *sqe) {
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->flags |= IOSQE_FIXED_FILE;
+    sqe->fd = 1;
+    sqe->addr = (uint64_t) "fixed";
+    sqe->len = 5;
+    sqe->off = -1;
+  });
+  memset(buf, 0, sizeof(buf));
+  m = iom->uringRead(fds[0], buf, sizeof(buf));
+  ARVIN_LOG_INFO(g_logger) << "fixed file register=" << rt << " write=" << n
+                           << " read=" << m << " buf=" << buf;
+  ARVIN_ASSERT(rt == 0 && n == 5 && m == 5 && !strcmp(buf, "fixed"));
+
+  // 固定缓冲区
+  static char s_fixed[64];
+  iovec iov = {s_fixed, sizeof(s_fixed)};
+  rt = iom->registerBuffers(&iov, 1);
+  memcpy(s_fixed, "registered", 10);
+  n = iom->uringWriteFixed(fds[1], s_fixed, 10, 0);
+  memset(s_fixed, 0, sizeof(s_fixed));
+  m = iom->uringReadFixed(fds[0], s_fixed, sizeof(s_fixed), 0);
+  ARVIN_LOG_INFO(g_logger) << "fixed buffer register=" << rt << " write=" << n
+                           << " read=" << m << " buf=" << s_fixed;
+  ARVIN_ASSERT(rt == 0 && n == 10 && m == 10 && !strcmp(s_fixed, "registered"));
+
+  // 多次触发的就绪轮询
+  uint64_t id = iom->uringPoll(fds[0], POLLIN, [fds](int res) {
+    if (res < 0) {
+      ARVIN_LOG_INFO(g_logger) << "poll end res=" << res
+                               << " polls=" << s_polls;
+      s_poll_end = res;
+      close(fds[0]);
+      close(fds[1]);
+      return;
+    }
+    char c;
+    read(fds[0], &c, 1);
+    ++s_polls;
+  });
+  for (int i = 0; i < 3; ++i) {
+    iom->uringWrite(fds[1], "x", 1);
+    usleep(10 * 1000);
+  }
+  iom->uringPollCancel(id);
+}
+
+static sockaddr_in s_addr;
+
+void test_server(int sock) {
+  arvin::IOManager *iom = arvin::IOManager::GetThis();
+  int conn = iom->uringAccept(sock, nullptr, nullptr);
+  char buf[16] = {0};
+  iovec iov = {buf, sizeof(buf)};
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  ssize_t n = iom->uringRecvmsg(conn, &msg, 0);
+  ARVIN_LOG_INFO(g_logger) << "accept=" << (conn >= 0) << " recvmsg=" << n
+                           << " buf=" << buf;
+  ARVIN_ASSERT(conn >= 0);
+  ARVIN_ASSERT(n == 4 && !strcmp(buf, "ping"));
+  ++s_socket_done;
+  close(conn);
+  close(sock);
+}
+
+void test_client() {
+  arvin::IOManager *iom = arvin::IOManager::GetThis();
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  int rt = iom->uringConnect(sock, (const sockaddr *)&s_addr, sizeof(s_addr));
+  iovec iov = {(void *)"ping", 4};
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  ssize_t n = iom->uringSendmsg(sock, &msg, 0);
+  ARVIN_LOG_INFO(g_logger) << "connect=" << rt << " sendmsg=" << n;
+  ARVIN_ASSERT(rt == 0 && n == 4);
+  ++s_socket_done;
+  close(sock);
+}
+
+void test_socket() {
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  memset(&s_addr, 0, sizeof(s_addr));
+  s_addr.sin_family = AF_INET;
+  s_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  bind(sock, (const sockaddr *)&s_addr, sizeof(s_addr));
+  listen(sock, 16);
+  socklen_t len = sizeof(s_addr);
+  getsockname(sock, (sockaddr *)&s_addr, &len);
+
+  arvin::IOManager::GetThis()->schedule(std::bind(&test_server, sock));
+  arvin::IOManager::GetThis()->schedule(&test_client);
+}
+
+int main(int argc, char **argv) {
+  arvin::Config::Lookup<std::string>("iomanager.backend")->setValue("io_uring");
+  {
+    arvin::IOManager iom(2, false, "uring");
+    ARVIN_LOG_INFO(g_logger) << "io_uring=" << iom.isUring();
+    if (!iom.isUring()) {
+      // 内核不支持或被禁用时已退回epoll, 没有可测试的内容
+      ARVIN_LOG_INFO(g_logger) << "io_uring unavailable, skip";
+      return 0;
+    }
+    iom.schedule(&test_pipe);
+    iom.schedule(&test_socket);
+  }
+  // 三次写入各触发一次, 取消后以-ECANCELED结束
+  ARVIN_ASSERT(s_polls == 3);
+  ARVIN_ASSERT(s_poll_end == -ECANCELED);
+  ARVIN_ASSERT(s_socket_done == 2);
+  return 0;
+}